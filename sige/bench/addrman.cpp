@@ -0,0 +1,101 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <assert.h>
+#include <vector>
+
+#include "addrman.h"
+#include "bench.h"
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+
+/* Sources sending addr messages, each with a batch of routable addresses */
+static const size_t NUM_SOURCES = 64;
+static const size_t NUM_ADDRESSES_PER_SOURCE = 256;
+
+static std::vector<CAddress> g_sources;
+static std::vector<std::vector<CAddress> > g_addresses;
+
+static CService RandomService(FastRandomContext& rand)
+{
+    // Keep the first octet clear of reserved and private ranges
+    uint32_t ip = rand.rand32();
+    struct in_addr addr;
+    addr.s_addr = htonl((ip & 0x3FFFFFFF) | 0x40000000);
+    return CService(CNetAddr(addr), 8560 + (ip >> 30));
+}
+
+static void CreateAddresses()
+{
+    if (g_sources.size() > 0)
+        return;
+
+    FastRandomContext rand(true);
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        g_sources.push_back(CAddress(RandomService(rand), NODE_NETWORK));
+        g_addresses.push_back(std::vector<CAddress>());
+        for (size_t addr_i = 0; addr_i < NUM_ADDRESSES_PER_SOURCE; ++addr_i) {
+            CAddress addr(RandomService(rand), NODE_NETWORK);
+            addr.nTime = GetTime();
+            g_addresses[source_i].push_back(addr);
+        }
+    }
+}
+
+static void AddAddressesToAddrMan(CAddrMan& addrman)
+{
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i)
+        addrman.Add(g_addresses[source_i], g_sources[source_i]);
+}
+
+static void FillAddrMan(CAddrMan& addrman)
+{
+    CreateAddresses();
+    AddAddressesToAddrMan(addrman);
+
+    // Move a share of the addresses to tried, as connecting to them would
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i)
+        for (size_t addr_i = 0; addr_i < NUM_ADDRESSES_PER_SOURCE; addr_i += 8)
+            addrman.Good(g_addresses[source_i][addr_i]);
+}
+
+static void AddrManAdd(benchmark::State& state)
+{
+    CreateAddresses();
+
+    while (state.KeepRunning()) {
+        CAddrMan addrman;
+        AddAddressesToAddrMan(addrman);
+    }
+}
+
+static void AddrManSelect(benchmark::State& state)
+{
+    CAddrMan addrman;
+    FillAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        const CAddress& address = addrman.Select();
+        assert(address.GetPort() > 0);
+    }
+}
+
+static void AddrManSerialize(benchmark::State& state)
+{
+    CAddrMan addrman;
+    FillAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << addrman;
+        CAddrMan addrmanLoaded;
+        ss >> addrmanLoaded;
+        assert(addrmanLoaded.size() == addrman.size());
+    }
+}
+
+BENCHMARK(AddrManAdd);
+BENCHMARK(AddrManSelect);
+BENCHMARK(AddrManSerialize);
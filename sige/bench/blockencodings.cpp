@@ -0,0 +1,58 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "blockencodings.h"
+#include "consensus/merkle.h"
+#include "random.h"
+#include "txmempool.h"
+
+#include <assert.h>
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, CTxMemPool& pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000, 0, 10.0, 1, tx->GetValueOut(), false, 4, lp));
+}
+
+// Reconstructing a compact block of 2000 txn against a mempool of 50000, as
+// a node that has most of the block does. Every mempool txn's short ID is
+// computed, and all but the block's are turned away, most by the short ID
+// filter before the hash map is looked at.
+static void PartiallyDownloadedBlockInit(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx.vout[0].nValue = COIN;
+    block.vtx.push_back(MakeTransactionRef(tx));
+    for (int i = 0; i < 50000; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        // Every 25th txn is in the block, one in ten of those is missing
+        if (i % 25 == 0)
+            block.vtx.push_back(ptx);
+        if (i % 250 != 0)
+            AddTx(ptx, pool);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    const CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    const std::vector<std::pair<uint256, CTransactionRef> > extra_txn;
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ReadStatus status = partialBlock.InitData(cmpctblock, extra_txn);
+        assert(status == READ_STATUS_OK);
+    }
+}
+
+BENCHMARK(PartiallyDownloadedBlockInit);
@@ -7,6 +7,7 @@
 #include "bench.h"
 #include "bloom.h"
 #include "hash.h"
+#include "miner.h"
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
@@ -69,6 +70,28 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+static void BlockHeaderHash(benchmark::State& state)
+{
+    CBlockHeader header;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000; i++) {
+            header.nNonce = i;
+            header.GetHash();
+        }
+    }
+}
+
+static void BlockHeaderHashMidstate(benchmark::State& state)
+{
+    CBlockHeader header;
+    CBlockHeaderHasher hasher(header);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000; i++) {
+            hasher.GetHash(i);
+        }
+    }
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
@@ -76,3 +99,6 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+
+BENCHMARK(BlockHeaderHash);
+BENCHMARK(BlockHeaderHashMidstate);
@@ -5,7 +5,9 @@
 #include "bench.h"
 #include "policy/policy.h"
 #include "txmempool.h"
+#include "utilstrencodings.h"
 
+#include <iostream>
 #include <list>
 #include <vector>
 
@@ -113,3 +115,42 @@ static void MempoolEviction(benchmark::State& state)
 }
 
 BENCHMARK(MempoolEviction);
+
+// Resident cost of a mempool entry: the transaction, the entry and its index
+// nodes, the parent/child links and mapNextTx. Fills a pool with short chains
+// so that most entries carry links, and reports DynamicMemoryUsage() per tx.
+static void MempoolMemoryPerTx(benchmark::State& state)
+{
+    const int nChains = 100;
+    const int nChainLength = 10;
+    std::vector<CTransactionRef> vtx;
+    for (int c = 0; c < nChains; c++) {
+        COutPoint prevout(uint256S(itostr(c + 1)), 0);
+        for (int i = 0; i < nChainLength; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = prevout;
+            tx.vin[0].scriptSig = CScript() << OP_1;
+            tx.vout.resize(2);
+            tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+            tx.vout[0].nValue = 10 * COIN;
+            tx.vout[1].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+            tx.vout[1].nValue = COIN;
+            vtx.push_back(MakeTransactionRef(tx));
+            prevout = COutPoint(vtx.back()->GetHash(), 0);
+        }
+    }
+
+    size_t nUsage = 0;
+    while (state.KeepRunning()) {
+        CTxMemPool pool(CFeeRate(1000));
+        for (const CTransactionRef& tx : vtx) {
+            AddTx(*tx, 1000LL, pool);
+        }
+        nUsage = pool.DynamicMemoryUsage();
+    }
+    double dPerTx = (double)nUsage / vtx.size();
+    std::cout << "MempoolMemoryPerTx-bytes,1," << dPerTx << "," << dPerTx << "," << dPerTx << "\n";
+}
+
+BENCHMARK(MempoolMemoryPerTx);
@@ -0,0 +1,133 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "coins.h"
+#include "key.h"
+#include "keystore.h"
+#include "policy/policy.h"
+#include "pubkey.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "util.h"
+#include "validation.h"
+
+#include <deque>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+// Script checks of a mempool.dat batch, the way AcceptToMemoryPoolBatch
+// handles them: each transaction checked on its own on one thread, as
+// AcceptToMemoryPoolWorker does, against all of the batch's checks handed
+// to the script-checking threads first so that the serial pass only finds
+// their signatures in the cache.
+static const int BATCH_TXS = 200;
+
+struct MempoolScriptBatch
+{
+    ECCVerifyHandle verifyHandle;
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins;
+    std::vector<CTransactionRef> vtx;
+    std::deque<PrecomputedTransactionData> dequeTxData;
+
+    MempoolScriptBatch() : coins(&coinsDummy)
+    {
+
+        CBasicKeyStore keystore;
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        CMutableTransaction txFunding;
+        txFunding.vout.resize(BATCH_TXS);
+        for (int i = 0; i < BATCH_TXS; i++) {
+            txFunding.vout[i].nValue = CENT;
+            txFunding.vout[i].scriptPubKey = scriptPubKey;
+        }
+        coins.ModifyCoins(txFunding.GetHash())->FromTx(txFunding, 1);
+
+        // Typical one input transactions, too small for the per-transaction
+        // parallel path
+        for (int i = 0; i < BATCH_TXS; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.hash = txFunding.GetHash();
+            tx.vin[0].prevout.n = i;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = CENT - 1000;
+            tx.vout[0].scriptPubKey = scriptPubKey;
+            bool fSigned = SignSignature(keystore, scriptPubKey, tx, 0, CENT, SIGHASH_ALL);
+            assert(fSigned);
+            vtx.push_back(MakeTransactionRef(tx));
+            dequeTxData.emplace_back(*vtx.back());
+        }
+    }
+
+    CScriptCheck Check(size_t i, bool fCacheStore)
+    {
+        return CScriptCheck(*coins.AccessCoins(vtx[i]->vin[0].prevout.hash), *vtx[i], 0, STANDARD_SCRIPT_VERIFY_FLAGS, fCacheStore, &dequeTxData[i]);
+    }
+
+    // Erasing from the signature cache only marks entries as discardable and
+    // resizing it in place keeps them, so each round shrinks the cache to its
+    // minimum and grows it back to keep the checks in it cold
+    void ResetCache()
+    {
+        ForceSetArg("-maxsigcachesize", "0");
+        InitSignatureCache();
+        ForceSetArg("-maxsigcachesize", "2");
+        InitSignatureCache();
+    }
+
+    void CheckSerially()
+    {
+        for (size_t i = 0; i < vtx.size(); i++) {
+            bool fValid = Check(i, false)();
+            assert(fValid);
+        }
+    }
+};
+
+static void MempoolScriptCheckSerial(benchmark::State& state)
+{
+    MempoolScriptBatch batch;
+    while (state.KeepRunning()) {
+        batch.ResetCache();
+        batch.CheckSerially();
+    }
+}
+
+static void MempoolScriptCheckPrechecked(benchmark::State& state)
+{
+    MempoolScriptBatch batch;
+    CCheckQueue<CScriptCheck> queue(128);
+    boost::thread_group tg;
+    for (int i = 0; i < std::max(2, GetNumCores()) - 1; i++)
+        tg.create_thread([&]{queue.Thread();});
+
+    while (state.KeepRunning()) {
+        batch.ResetCache();
+        {
+            CCheckQueueControl<CScriptCheck> control(&queue);
+            std::vector<CScriptCheck> vChecks;
+            vChecks.reserve(batch.vtx.size());
+            for (size_t i = 0; i < batch.vtx.size(); i++)
+                vChecks.push_back(batch.Check(i, true));
+            control.Add(vChecks);
+            bool fValid = control.Wait();
+            assert(fValid);
+        }
+        batch.CheckSerially();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BENCHMARK(MempoolScriptCheckSerial);
+BENCHMARK(MempoolScriptCheckPrechecked);
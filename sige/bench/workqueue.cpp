@@ -0,0 +1,64 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <assert.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "httpserver.h"
+#include "workqueue.h"
+
+// This Benchmark pushes batches of requests that do no work through the
+// HTTP work queue from several event threads at once, so the cost of handing
+// requests to the workers, contention included, is all that is measured
+static const int PRODUCERS = DEFAULT_HTTP_EVENT_THREADS * 2;
+static const size_t REQUESTS_PER_PRODUCER = 1000;
+
+class FakeRequest : public HTTPClosure
+{
+public:
+    std::atomic<size_t>& nDone;
+
+    FakeRequest(std::atomic<size_t>& _nDone) : nDone(_nDone) {}
+    void operator()()
+    {
+        nDone++;
+    }
+};
+
+static void HTTPWorkQueueLoad(benchmark::State& state)
+{
+    WorkQueue<HTTPClosure> queue(PRODUCERS * REQUESTS_PER_PRODUCER, DEFAULT_HTTP_THREADS);
+    std::vector<std::thread> vWorkers;
+    for (size_t i = 0; i < queue.Lanes(); i++)
+        vWorkers.push_back(std::thread([&queue, i] { queue.Run(i); }));
+
+    std::atomic<size_t> nDone(0);
+    size_t nExpected = 0;
+    while (state.KeepRunning()) {
+        std::vector<std::thread> vProducers;
+        for (int i = 0; i < PRODUCERS; i++) {
+            vProducers.push_back(std::thread([&queue, &nDone] {
+                for (size_t n = 0; n < REQUESTS_PER_PRODUCER; n++) {
+                    bool fQueued = queue.Enqueue(new FakeRequest(nDone));
+                    assert(fQueued);
+                }
+            }));
+        }
+        for (std::thread& producer : vProducers)
+            producer.join();
+        nExpected += PRODUCERS * REQUESTS_PER_PRODUCER;
+        while (nDone < nExpected)
+            std::this_thread::yield();
+    }
+
+    queue.Interrupt();
+    for (std::thread& worker : vWorkers)
+        worker.join();
+    queue.WaitExit();
+}
+
+BENCHMARK(HTTPWorkQueueLoad);
@@ -8,6 +8,18 @@
 #include "serialize.h"
 #include "streams.h"
 
+#include <limits>
+
+CNetAddrHasher::CNetAddrHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+size_t CNetAddrHasher::operator()(const CNetAddr& addr) const
+{
+    unsigned char vch[16];
+    for (int i = 0; i < 16; i++)
+        vch[i] = addr.GetByte(i);
+    return (size_t)CSipHasher(k0, k1).Write(vch, sizeof(vch)).Finalize();
+}
+
 int CAddrInfo::GetTriedBucket(const uint256& nKey) const
 {
     uint64_t hash1 = (CHashWriter(SER_GETHASH, 0) << nKey << GetKey()).GetHash().GetCheapHash();
@@ -70,12 +82,12 @@ double CAddrInfo::GetChance(int64_t nNow) const
 
 CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int* pnId)
 {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
+    std::unordered_map<CNetAddr, int, CNetAddrHasher>::iterator it = mapAddr.find(addr);
     if (it == mapAddr.end())
         return NULL;
     if (pnId)
         *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
+    std::unordered_map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
     if (it2 != mapInfo.end())
         return &(*it2).second;
     return NULL;
@@ -127,6 +139,34 @@ void CAddrMan::Delete(int nId)
     nNew--;
 }
 
+/** Add or remove a position in the list of occupied positions of a table */
+static void UpdateSlot(std::vector<int>& vSlots, int* pSlotIndex, int nSlot, bool fOccupied)
+{
+    int& nIndex = pSlotIndex[nSlot];
+    if (fOccupied && nIndex == -1) {
+        nIndex = vSlots.size();
+        vSlots.push_back(nSlot);
+    } else if (!fOccupied && nIndex != -1) {
+        // Move the last position into the gap
+        pSlotIndex[vSlots.back()] = nIndex;
+        vSlots[nIndex] = vSlots.back();
+        vSlots.pop_back();
+        nIndex = -1;
+    }
+}
+
+void CAddrMan::SetTried(int nKBucket, int nKBucketPos, int nId)
+{
+    vvTried[nKBucket][nKBucketPos] = nId;
+    UpdateSlot(vTriedSlots, vTriedSlotIndex, nKBucket * ADDRMAN_BUCKET_SIZE + nKBucketPos, nId != -1);
+}
+
+void CAddrMan::SetNew(int nUBucket, int nUBucketPos, int nId)
+{
+    vvNew[nUBucket][nUBucketPos] = nId;
+    UpdateSlot(vNewSlots, vNewSlotIndex, nUBucket * ADDRMAN_BUCKET_SIZE + nUBucketPos, nId != -1);
+}
+
 void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
 {
     // if there is an entry in the specified bucket, delete it.
@@ -135,7 +175,7 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
         CAddrInfo& infoDelete = mapInfo[nIdDelete];
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
-        vvNew[nUBucket][nUBucketPos] = -1;
+        SetNew(nUBucket, nUBucketPos, -1);
         if (infoDelete.nRefCount == 0) {
             Delete(nIdDelete);
         }
@@ -148,7 +188,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
     for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
         int pos = info.GetBucketPosition(nKey, true, bucket);
         if (vvNew[bucket][pos] == nId) {
-            vvNew[bucket][pos] = -1;
+            SetNew(bucket, pos, -1);
             info.nRefCount--;
         }
     }
@@ -169,7 +209,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Remove the to-be-evicted item from the tried set.
         infoOld.fInTried = false;
-        vvTried[nKBucket][nKBucketPos] = -1;
+        SetTried(nKBucket, nKBucketPos, -1);
         nTried--;
 
         // find which new bucket it belongs to
@@ -180,12 +220,12 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Enter it into the new set again.
         infoOld.nRefCount = 1;
-        vvNew[nUBucket][nUBucketPos] = nIdEvict;
+        SetNew(nUBucket, nUBucketPos, nIdEvict);
         nNew++;
     }
     assert(vvTried[nKBucket][nKBucketPos] == -1);
 
-    vvTried[nKBucket][nKBucketPos] = nId;
+    SetTried(nKBucket, nKBucketPos, nId);
     nTried++;
     info.fInTried = true;
 }
@@ -305,7 +345,7 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         if (fInsert) {
             ClearNew(nUBucket, nUBucketPos);
             pinfo->nRefCount++;
-            vvNew[nUBucket][nUBucketPos] = nId;
+            SetNew(nUBucket, nUBucketPos, nId);
         } else {
             if (pinfo->nRefCount == 0) {
                 Delete(nId);
@@ -348,16 +388,11 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
     // Use a 50% chance for choosing between tried and new table entries.
     if (!newOnly &&
        (nTried > 0 && (nNew == 0 || RandomInt(2) == 0))) { 
-        // use a tried node
+        // use a tried node, sampling the occupied positions directly
         double fChanceFactor = 1.0;
         while (1) {
-            int nKBucket = RandomInt(ADDRMAN_TRIED_BUCKET_COUNT);
-            int nKBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand.rand32()) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand.rand32()) % ADDRMAN_BUCKET_SIZE;
-            }
-            int nId = vvTried[nKBucket][nKBucketPos];
+            int nSlot = vTriedSlots[insecure_rand.rand32() % vTriedSlots.size()];
+            int nId = vvTried[nSlot / ADDRMAN_BUCKET_SIZE][nSlot % ADDRMAN_BUCKET_SIZE];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
@@ -365,16 +400,11 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
             fChanceFactor *= 1.2;
         }
     } else {
-        // use a new node
+        // use a new node, sampling the occupied positions directly
         double fChanceFactor = 1.0;
         while (1) {
-            int nUBucket = RandomInt(ADDRMAN_NEW_BUCKET_COUNT);
-            int nUBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand.rand32()) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand.rand32()) % ADDRMAN_BUCKET_SIZE;
-            }
-            int nId = vvNew[nUBucket][nUBucketPos];
+            int nSlot = vNewSlots[insecure_rand.rand32() % vNewSlots.size()];
+            int nId = vvNew[nSlot / ADDRMAN_BUCKET_SIZE][nSlot % ADDRMAN_BUCKET_SIZE];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
             if (RandomInt(1 << 30) < fChanceFactor * info.GetChance() * (1 << 30))
@@ -393,7 +423,7 @@ int CAddrMan::Check_()
     if (vRandom.size() != nTried + nNew)
         return -7;
 
-    for (std::map<int, CAddrInfo>::iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+    for (std::unordered_map<int, CAddrInfo>::iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
         int n = (*it).first;
         CAddrInfo& info = (*it).second;
         if (info.fInTried) {
@@ -426,6 +456,8 @@ int CAddrMan::Check_()
 
     for (int n = 0; n < ADDRMAN_TRIED_BUCKET_COUNT; n++) {
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+             if ((vvTried[n][i] != -1) != (vTriedSlotIndex[n * ADDRMAN_BUCKET_SIZE + i] != -1))
+                 return -20;
              if (vvTried[n][i] != -1) {
                  if (!setTried.count(vvTried[n][i]))
                      return -11;
@@ -440,6 +472,8 @@ int CAddrMan::Check_()
 
     for (int n = 0; n < ADDRMAN_NEW_BUCKET_COUNT; n++) {
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+            if ((vvNew[n][i] != -1) != (vNewSlotIndex[n * ADDRMAN_BUCKET_SIZE + i] != -1))
+                return -21;
             if (vvNew[n][i] != -1) {
                 if (!mapNew.count(vvNew[n][i]))
                     return -12;
@@ -15,6 +15,7 @@
 #include <map>
 #include <set>
 #include <stdint.h>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -106,6 +107,18 @@ public:
 
 };
 
+/** Salted hash of a network address, for indexing addresses by hash */
+class CNetAddrHasher
+{
+private:
+    uint64_t k0, k1;
+
+public:
+    CNetAddrHasher();
+
+    size_t operator()(const CNetAddr& addr) const;
+};
+
 /** Stochastic address manager
  *
  * Design goals:
@@ -181,10 +194,10 @@ private:
     int nIdCount;
 
     //! table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    std::unordered_map<int, CAddrInfo> mapInfo;
 
     //! find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    std::unordered_map<CNetAddr, int, CNetAddrHasher> mapAddr;
 
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -201,6 +214,14 @@ private:
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! occupied positions (bucket * ADDRMAN_BUCKET_SIZE + position) of vvTried and vvNew, to sample from directly
+    std::vector<int> vTriedSlots;
+    std::vector<int> vNewSlots;
+
+    //! index of each position in vTriedSlots and vNewSlots, or -1 if it is empty
+    int vTriedSlotIndex[ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE];
+    int vNewSlotIndex[ADDRMAN_NEW_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE];
+
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
@@ -230,6 +251,10 @@ protected:
     //! Clear a position in a "new" table. This is the only place where entries are actually deleted.
     void ClearNew(int nUBucket, int nUBucketPos);
 
+    //! Store an nId (or -1 to empty it) at a position of the "tried" or "new" table.
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+
     //! Mark an entry "good", possibly moving it from "new" to "tried".
     void Good_(const CService &addr, int64_t nTime);
 
@@ -303,9 +328,10 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
+        std::unordered_map<int, int> mapUnkIds;
+        mapUnkIds.reserve(mapInfo.size());
         int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        for (std::unordered_map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
             mapUnkIds[(*it).first] = nIds;
             const CAddrInfo &info = (*it).second;
             if (info.nRefCount) {
@@ -315,7 +341,7 @@ public:
             }
         }
         nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+        for (std::unordered_map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
             const CAddrInfo &info = (*it).second;
             if (info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
@@ -368,6 +394,10 @@ public:
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
+        mapInfo.reserve(nNew + nTried);
+        mapAddr.reserve(nNew + nTried);
+        vRandom.reserve(nNew + nTried);
+
         // Deserialize entries from the new table.
         for (int n = 0; n < nNew; n++) {
             CAddrInfo &info = mapInfo[n];
@@ -381,7 +411,7 @@ public:
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
@@ -401,7 +431,7 @@ public:
                 vRandom.push_back(nIdCount);
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
+                SetTried(nKBucket, nKBucketPos, nIdCount);
                 nIdCount++;
             } else {
                 nLost++;
@@ -421,7 +451,7 @@ public:
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -429,9 +459,9 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
+        for (std::unordered_map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); ) {
             if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                std::map<int, CAddrInfo>::const_iterator itCopy = it++;
+                std::unordered_map<int, CAddrInfo>::const_iterator itCopy = it++;
                 Delete(itCopy->first);
                 nLostUnk++;
             } else {
@@ -452,13 +482,17 @@ public:
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvNew[bucket][entry] = -1;
+                vNewSlotIndex[bucket * ADDRMAN_BUCKET_SIZE + entry] = -1;
             }
         }
         for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvTried[bucket][entry] = -1;
+                vTriedSlotIndex[bucket * ADDRMAN_BUCKET_SIZE + entry] = -1;
             }
         }
+        std::vector<int>().swap(vTriedSlots);
+        std::vector<int>().swap(vNewSlots);
 
         nIdCount = 0;
         nTried = 0;
@@ -509,17 +543,20 @@ public:
         return fRet;
     }
 
-    //! Add multiple addresses.
+    //! Add multiple addresses. The lock is taken per address, so that a large
+    //! addr message does not hold up Select and GetAddr for its whole length.
     bool Add(const std::vector<CAddress> &vAddr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
-        LOCK(cs);
         int nAdd = 0;
-        Check();
-        for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
+        for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++) {
+            LOCK(cs);
             nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+        }
         Check();
-        if (nAdd)
+        if (nAdd) {
+            LOCK(cs);
             LogPrint("addrman", "Added %i addresses from %s: %i tried, %i new\n", nAdd, source.ToString(), nTried, nNew);
+        }
         return nAdd > 0;
     }
 
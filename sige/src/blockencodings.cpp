@@ -17,6 +17,39 @@
 
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
+/** Number of short IDs computed at a time before they are looked up */
+static const size_t SHORTID_BATCH_SIZE = 256;
+
+/**
+ * Bit set over the low bits of a block's short IDs. It is small enough to
+ * stay in cache, so most candidate txn are rejected without touching the
+ * short ID hash map. Their short IDs (a SipHash each) are still computed.
+ */
+class ShortIDFilter
+{
+private:
+    std::vector<uint64_t> bits;
+    uint64_t mask;
+
+public:
+    explicit ShortIDFilter(const std::vector<uint64_t>& shortids)
+    {
+        // About 16 bits per short ID keeps false positives near 1 in 16
+        uint64_t nbits = 1024;
+        while (nbits < shortids.size() * 16)
+            nbits <<= 1;
+        bits.assign(nbits / 64, 0);
+        mask = nbits - 1;
+        for (uint64_t shortid : shortids)
+            bits[(shortid & mask) >> 6] |= (uint64_t)1 << (shortid & 63);
+    }
+
+    bool MaybeContains(uint64_t shortid) const
+    {
+        return (bits[(shortid & mask) >> 6] >> (shortid & 63)) & 1;
+    }
+};
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
@@ -104,38 +137,48 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
+    const ShortIDFilter filter(cmpctblock.shorttxids);
+    // Short IDs are keyed per block, so they are computed here, in batches
+    // over the mempool's contiguous wtxid table, and only then looked up
+    uint64_t batch[SHORTID_BATCH_SIZE];
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
-                mempool_count++;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
+    for (size_t start = 0; start < vTxHashes.size() && mempool_count != shorttxids.size(); start += SHORTID_BATCH_SIZE) {
+        size_t count = std::min(SHORTID_BATCH_SIZE, vTxHashes.size() - start);
+        for (size_t j = 0; j < count; j++)
+            batch[j] = cmpctblock.GetShortID(vTxHashes[start + j].first);
+        for (size_t j = 0; j < count; j++) {
+            if (!filter.MaybeContains(batch[j]))
+                continue;
+            std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(batch[j]);
+            if (idit != shorttxids.end()) {
+                if (!have_txn[idit->second]) {
+                    txn_available[idit->second] = vTxHashes[start + j].second->GetSharedTx();
+                    have_txn[idit->second]  = true;
+                    mempool_count++;
+                } else {
+                    // If we find two mempool txn that match the short id, just request it.
+                    // This should be rare enough that the extra bandwidth doesn't matter,
+                    // but eating a round-trip due to FillBlock failure would be annoying
+                    if (txn_available[idit->second]) {
+                        txn_available[idit->second].reset();
+                        mempool_count--;
+                    }
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids.size())
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
     }
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
         uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
+        std::unordered_map<uint64_t, uint16_t>::iterator idit = filter.MaybeContains(shortid) ? shorttxids.find(shortid) : shorttxids.end();
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
                 txn_available[idit->second] = extra_txn[i].second;
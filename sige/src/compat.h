@@ -41,9 +41,21 @@
 #include <ifaddrs.h>
 #include <limits.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #endif
 
+// Sockets are waited on with poll() (epoll() on Linux) where available, so
+// file descriptors are not limited by FD_SETSIZE there.
+#ifndef WIN32
+#define USE_POLL
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define USE_EPOLL
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT        0
 #else
@@ -77,7 +89,7 @@ typedef u_int SOCKET;
 #endif
 
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
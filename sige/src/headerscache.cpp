@@ -0,0 +1,104 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headerscache.h"
+
+#include "chain.h"
+#include "protocol.h"
+#include "streams.h"
+#include "version.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+CHeadersCache::CHeadersCache() : nUseCount(0)
+{
+}
+
+void CHeadersCache::Clear()
+{
+    std::vector<unsigned char>().swap(vData);
+    hashTip.SetNull();
+    vResponses.clear();
+}
+
+void CHeadersCache::Sync(const CChain& chain)
+{
+    const CBlockIndex* pindexTip = chain.Tip();
+    if (!pindexTip) {
+        Clear();
+        return;
+    }
+    if (pindexTip->GetBlockHash() == hashTip)
+        return;
+
+    // Find the last height at which we still agree with the chain. The hash
+    // of each stored header but the top one is the next header's prev hash.
+    int nFork = std::min(Height(), chain.Height());
+    while (nFork >= 0) {
+        uint256 hash;
+        if (nFork == Height())
+            hash = hashTip;
+        else
+            memcpy(hash.begin(), GetEntry(nFork + 1) + 4, 32);
+        if (hash == chain[nFork]->GetBlockHash())
+            break;
+        nFork--;
+    }
+
+    vData.resize((nFork + 1) * ENTRY_SIZE);
+    for (int nHeight = nFork + 1; nHeight <= chain.Height(); nHeight++) {
+        CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, vData, vData.size(), chain[nHeight]->GetBlockHeader());
+        vData.push_back(0);
+    }
+    assert(vData.size() == (chain.Height() + 1) * ENTRY_SIZE);
+    hashTip = pindexTip->GetBlockHash();
+
+    // Responses reaching past the fork no longer match the chain
+    for (size_t i = 0; i < vResponses.size(); ) {
+        if (vResponses[i].nHeight + vResponses[i].nCount - 1 > nFork) {
+            vResponses[i] = vResponses.back();
+            vResponses.pop_back();
+        } else {
+            i++;
+        }
+    }
+}
+
+std::shared_ptr<const CSharedNetMsg> CHeadersCache::GetHeadersMsg(int nHeight, int nCount)
+{
+    assert(nHeight >= 0 && nCount >= 0 && nHeight + nCount - 1 <= Height());
+
+    for (size_t i = 0; i < vResponses.size(); i++) {
+        if (vResponses[i].nHeight == nHeight && vResponses[i].nCount == nCount) {
+            vResponses[i].nLastUsed = ++nUseCount;
+            return vResponses[i].msg;
+        }
+    }
+
+    CSerializedNetMsg msg;
+    msg.command = NetMsgType::HEADERS;
+    msg.data.reserve(9 + nCount * ENTRY_SIZE);
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, msg.data, 0, COMPACTSIZE((uint64_t)nCount));
+    if (nCount)
+        msg.data.insert(msg.data.end(), GetEntry(nHeight), GetEntry(nHeight) + nCount * ENTRY_SIZE);
+
+    Response response;
+    response.nHeight = nHeight;
+    response.nCount = nCount;
+    response.nLastUsed = ++nUseCount;
+    response.msg = std::make_shared<const CSharedNetMsg>(std::move(msg));
+    if (vResponses.size() < MAX_HEADERS_RESPONSE_CACHE) {
+        vResponses.push_back(response);
+    } else {
+        // Replace the least recently used response
+        size_t nOldest = 0;
+        for (size_t i = 1; i < vResponses.size(); i++)
+            if (vResponses[i].nLastUsed < vResponses[nOldest].nLastUsed)
+                nOldest = i;
+        vResponses[nOldest] = response;
+    }
+    return response.msg;
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __sig_headerscache_h__
+#define __sig_headerscache_h__
+
+#include "net.h"
+#include "uint256.h"
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+class CBlockIndex;
+class CChain;
+
+/** Number of recent "headers" responses kept for reuse */
+static const size_t MAX_HEADERS_RESPONSE_CACHE = 16;
+
+/**
+ * The active chain's headers, serialized the way a "headers" message
+ * carries them and stored back to back by height, so a response to
+ * "getheaders" is a slice of the array instead of a walk over the block
+ * index that serializes every header again.
+ *
+ * The most recently used responses are also kept as ready-made messages,
+ * header and checksum included, since syncing peers tend to ask for the
+ * same ranges. All methods require cs_main.
+ */
+class CHeadersCache
+{
+public:
+    //! An 80 byte header followed by its (zero) transaction count
+    static const size_t ENTRY_SIZE = 81;
+
+private:
+    struct Response {
+        int nHeight;
+        int nCount;
+        uint64_t nLastUsed;
+        std::shared_ptr<const CSharedNetMsg> msg;
+    };
+
+    std::vector<unsigned char> vData;
+    //! The tip vData was last synced to
+    uint256 hashTip;
+    std::vector<Response> vResponses;
+    uint64_t nUseCount;
+
+public:
+    CHeadersCache();
+
+    /** Bring the array up to the chain's tip, dropping responses a reorg invalidated */
+    void Sync(const CChain& chain);
+
+    /** Height of the last header in the array, -1 if it is empty */
+    int Height() const { return (int)(vData.size() / ENTRY_SIZE) - 1; }
+
+    /** The serialized header at a height */
+    const unsigned char* GetEntry(int nHeight) const { return &vData[nHeight * ENTRY_SIZE]; }
+
+    /** A "headers" message with nCount headers from nHeight on, which must be in the array */
+    std::shared_ptr<const CSharedNetMsg> GetHeadersMsg(int nHeight, int nCount);
+
+    void Clear();
+};
+
+#endif  /* __sig_headerscache_h__ */
@@ -65,6 +65,10 @@ private:
 static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
+/* Worker tasks a batch may use besides the thread it arrived on */
+static int nBatchHelpers = 0;
+/* Milliseconds after which a batch starts no more requests, 0 for no limit */
+static int64_t nBatchTimeout = 0;
 
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
@@ -147,6 +151,74 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return multiUserAuthorized(strUserPass);
 }
 
+CJSONStreamWriter::Sink HTTPJSONReply::Sink()
+{
+    return [this](const std::string& strChunk) {
+        // Sending chunks can wait on the client, holding this worker
+        if (!fStreamChecked) {
+            fStreamChecked = true;
+            HoldHTTPWorker(grant);
+        }
+        if (!grant) {
+            strReply += strChunk;
+            return true;
+        }
+        if (!req->ReplyStarted())
+            req->WriteHeader("Content-Type", "application/json");
+        return req->WriteReplyChunk(HTTP_OK, strChunk);
+    };
+}
+
+bool HTTPJSONReply::Started() const
+{
+    return req->ReplyStarted();
+}
+
+void HTTPJSONReply::End(CJSONStreamWriter& writer)
+{
+    std::string strTail = writer.TakeBuffer() + "\n";
+    if (req->ReplyStarted()) {
+        req->EndChunkedReply(strTail);
+    } else {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strReply + strTail);
+    }
+}
+
+void HTTPJSONReply::Abort()
+{
+    req->AbortChunkedReply();
+}
+
+/** Execute a singleton request through the method's streaming form, sending
+ * the reply while the result is produced. Returns false, without replying,
+ * if the method has no streaming form for the request.
+ */
+static bool JSONRPCExecStream(HTTPRequest* req, const JSONRPCRequest& jreq)
+{
+    HTTPJSONReply reply(req);
+    CJSONStreamWriter writer(reply.Sink());
+    writer.BeginObject();
+    writer.Key("result");
+    try {
+        if (!tableRPC.executeStream(jreq, writer))
+            return false;
+    } catch (...) {
+        // Until the reply is started, errors go out the usual way
+        if (!reply.Started())
+            throw;
+        // Ending the reply would pass a truncated result for a whole one
+        LogPrintf("%s: %s failed after its reply was started\n", __func__, jreq.strMethod);
+        reply.Abort();
+        return true;
+    }
+    writer.KeyValue("error", NullUniValue);
+    writer.KeyValue("id", jreq.id);
+    writer.EndObject();
+    reply.End(writer);
+    return true;
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -190,15 +262,22 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            // Results that can get large are sent as they are produced
+            if (JSONRPCExecStream(req, jreq))
+                return true;
+
             UniValue result = tableRPC.execute(jreq);
 
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
 
         // array of requests
-        } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+        } else if (valRequest.isArray()) {
+            // Helpers are queued like requests, leave at least half of the
+            // free depth to the requests behind this one
+            int nHelpers = std::min<int>(nBatchHelpers, HTTPWorkQueueFree() / 2);
+            strReply = JSONRPCExecBatch(valRequest.get_array(), QueueHTTPWork, nHelpers, nBatchTimeout);
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
         req->WriteHeader("Content-Type", "application/json");
@@ -237,6 +316,8 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
+    nBatchHelpers = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L) - 1;
+    nBatchTimeout = std::max(GetArg("-rpcbatchtimeout", DEFAULT_RPC_BATCH_TIMEOUT), (int64_t)0) * 1000;
     RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
 
     assert(EventBase());
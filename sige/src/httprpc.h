@@ -5,11 +5,19 @@
 #ifndef __sig_http_rpc_h__
 #define __sig_http_rpc_h__
 
+#include "jsonstream.h"
+#include "sync.h"
+#include "uint256.h"
+
 #include <string>
 #include <map>
+#include <memory>
 
 class HTTPRequest;
 
+/** Default for -rpcbatchtimeout, 0 means batches may run as long as they take */
+static const int DEFAULT_RPC_BATCH_TIMEOUT = 0;
+
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
  */
@@ -22,6 +30,33 @@ void InterruptHTTPRPC();
  */
 void StopHTTPRPC();
 
+/** A JSON reply to req written with a CJSONStreamWriter. It is sent in
+ * chunks as it is written, from the first flushed one on, if this worker can
+ * be held for that (HoldHTTPWorker); else the output is gathered and sent as
+ * an ordinary reply once it is complete.
+ */
+class HTTPJSONReply
+{
+private:
+    HTTPRequest* req;
+    CSemaphoreGrant grant;
+    bool fStreamChecked;
+    //! Output gathered while not streaming
+    std::string strReply;
+
+public:
+    explicit HTTPJSONReply(HTTPRequest* reqIn) : req(reqIn), fStreamChecked(false) {}
+
+    /** Sink for the writer; the reply must outlive the writer */
+    CJSONStreamWriter::Sink Sink();
+    /** Whether output was sent already, so errors can no longer be replied */
+    bool Started() const;
+    /** Send the rest of the reply writer wrote */
+    void End(CJSONStreamWriter& writer);
+    /** Give up on a started reply, dropping the connection */
+    void Abort();
+};
+
 /** Start HTTP REST subsystem.
  * Precondition; HTTP and RPC has been started.
  */
@@ -34,4 +69,19 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Parse a /rest/blocktemplate long poll id: the hex hash of the tip the
+ * template was built on, followed by the mempool update count at the time.
+ */
+bool ParseRestLongPollId(const std::string& strId, uint256& hashTip, unsigned int& nTxUpdated);
+/** The serialized template /rest/blocktemplate serves, or null if none was
+ * built on the current tip yet. Never builds one; asking keeps the REST
+ * template thread refreshing it for a while.
+ */
+std::shared_ptr<const std::string> GetRestBlockTemplate();
+/** Rebuild the REST template if the tip moved, or the mempool changed and the
+ * template is more than a few seconds old (the getblocktemplate policy).
+ * Run by the REST template thread. Returns whether a new one was built.
+ */
+bool UpdateRestBlockTemplate();
+
 #endif  /* __sig_http_rpc_h__ */
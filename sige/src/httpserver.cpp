@@ -11,6 +11,7 @@
 #include "rpc/proto.h" // For HTTP status codes
 #include "sync.h"
 #include "uinterface.h"
+#include "workqueue.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,7 +20,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 
 #include <event2/event.h>
 #include <event2/http.h>
@@ -58,101 +61,20 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
- */
-template <typename WorkItem>
-class WorkQueue
+/** Work item for a task handed to the worker threads by a request handler */
+class HTTPTaskItem : public HTTPClosure
 {
-private:
-    /** Mutex protects entire object */
-    std::mutex cs;
-    std::condition_variable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
-    bool running;
-    size_t maxDepth;
-    int numThreads;
-
-    /** RAII object to keep track of number of running worker threads */
-    class ThreadCounter
-    {
-    public:
-        WorkQueue &wq;
-        ThreadCounter(WorkQueue &w): wq(w)
-        {
-            std::lock_guard<std::mutex> lock(wq.cs);
-            wq.numThreads += 1;
-        }
-        ~ThreadCounter()
-        {
-            std::lock_guard<std::mutex> lock(wq.cs);
-            wq.numThreads -= 1;
-            wq.cond.notify_all();
-        }
-    };
-
 public:
-    WorkQueue(size_t _maxDepth) : running(true),
-                                 maxDepth(_maxDepth),
-                                 numThreads(0)
-    {
-    }
-    /** Precondition: worker threads have all stopped
-     * (call WaitExit)
-     */
-    ~WorkQueue()
-    {
-    }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
-    {
-        std::unique_lock<std::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
-            return false;
-        }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
-        cond.notify_one();
-        return true;
-    }
-    /** Thread function */
-    void Run()
-    {
-        ThreadCounter count(*this);
-        while (true) {
-            std::unique_ptr<WorkItem> i;
-            {
-                std::unique_lock<std::mutex> lock(cs);
-                while (running && queue.empty())
-                    cond.wait(lock);
-                if (!running)
-                    break;
-                i = std::move(queue.front());
-                queue.pop_front();
-            }
-            (*i)();
-        }
-    }
-    /** Interrupt and exit loops */
-    void Interrupt()
+    HTTPTaskItem(const std::function<void(void)>& _func): func(_func)
     {
-        std::unique_lock<std::mutex> lock(cs);
-        running = false;
-        cond.notify_all();
     }
-    /** Wait for worker threads to exit */
-    void WaitExit()
+    void operator()()
     {
-        std::unique_lock<std::mutex> lock(cs);
-        while (numThreads > 0)
-            cond.wait(lock);
+        func();
     }
 
-    /** Return current depth of queue */
-    size_t Depth()
-    {
-        std::unique_lock<std::mutex> lock(cs);
-        return queue.size();
-    }
+private:
+    std::function<void(void)> func;
 };
 
 struct HTTPPathHandler
@@ -169,18 +91,20 @@ struct HTTPPathHandler
 
 /** HTTP module state */
 
-//! libevent event loop
-static struct event_base* eventBase = 0;
-//! HTTP server
-struct evhttp* eventHTTP = 0;
+//! libevent event loops, the first one also runs the timers of submodules
+static std::vector<struct event_base*> eventBases;
+//! HTTP servers, one on each event loop, all accepting on the same sockets
+static std::vector<struct evhttp*> eventHTTPs;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Workers that may be held by long-running requests, see HoldHTTPWorker
+static CSemaphore* semHeldWorkers = 0;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
-//! Bound listening sockets
-std::vector<evhttp_bound_socket *> boundSockets;
+//! Bound listening sockets, for each HTTP server
+std::vector<std::vector<evhttp_bound_socket *> > boundSockets;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -316,7 +240,7 @@ static bool ThreadHTTP(struct event_base* base, struct evhttp* http)
 }
 
 /** Bind HTTP server to specified addresses */
-static bool HTTPBindAddresses(struct evhttp* http)
+static bool HTTPBindAddresses(struct evhttp* http, std::vector<evhttp_bound_socket *>& sockets)
 {
     int defaultPort = GetArg("-rpcport", BaseParams().RPCPort());
     std::vector<std::pair<std::string, uint16_t> > endpoints;
@@ -346,19 +270,43 @@ static bool HTTPBindAddresses(struct evhttp* http)
         LogPrint("http", "Binding RPC on address %s port %i\n", i->first, i->second);
         evhttp_bound_socket *bind_handle = evhttp_bind_socket_with_handle(http, i->first.empty() ? NULL : i->first.c_str(), i->second);
         if (bind_handle) {
-            boundSockets.push_back(bind_handle);
+            sockets.push_back(bind_handle);
         } else {
             LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
         }
     }
-    return !boundSockets.empty();
+    return !sockets.empty();
+}
+
+/** Let another HTTP server accept connections on the sockets bound by the first one.
+ * evhttp closes the sockets it accepts on when it is freed, so each server gets
+ * its own duplicate of the descriptor.
+ */
+static bool HTTPShareSockets(struct evhttp* http, std::vector<evhttp_bound_socket *>& sockets)
+{
+#ifdef WIN32
+    return false;
+#else
+    for (evhttp_bound_socket *socket : boundSockets[0]) {
+        evutil_socket_t fd = dup(evhttp_bound_socket_get_fd(socket));
+        if (fd < 0)
+            return false;
+        evhttp_bound_socket *handle = evhttp_accept_socket_with_handle(http, fd);
+        if (!handle) {
+            close(fd);
+            return false;
+        }
+        sockets.push_back(handle);
+    }
+    return true;
+#endif
 }
 
 /** Simple wrapper to set thread name and run work queue */
-static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
+static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue, size_t nLane)
 {
     RenameThread("sigecoin-httpworker");
-    queue->Run();
+    queue->Run(nLane);
 }
 
 /** libevent event log callback */
@@ -374,6 +322,30 @@ static void libevent_log_cb(int severity, const char *msg)
         LogPrint("libevent", "libevent: %s\n", msg);
 }
 
+/** Create an event loop with an HTTP server on it */
+static bool NewHTTPServer(struct event_base*& base, struct evhttp*& http)
+{
+    base = event_base_new(); // XXX RAII
+    if (!base) {
+        LogPrintf("Couldn't create an event_base: exiting\n");
+        return false;
+    }
+
+    /* Create a new evhttp object to handle requests. */
+    http = evhttp_new(base); // XXX RAII
+    if (!http) {
+        LogPrintf("couldn't create evhttp. Exiting.\n");
+        event_base_free(base);
+        return false;
+    }
+
+    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
+    evhttp_set_max_body_size(http, MAX_SIZE);
+    evhttp_set_gencb(http, http_request_cb, NULL);
+    return true;
+}
+
 bool InitHTTPServer()
 {
     struct evhttp* http = 0;
@@ -405,56 +377,63 @@ bool InitHTTPServer()
     evthread_use_pthreads();
 #endif
 
-    base = event_base_new(); // XXX RAII
-    if (!base) {
-        LogPrintf("Couldn't create an event_base: exiting\n");
+    if (!NewHTTPServer(base, http))
         return false;
-    }
 
-    /* Create a new evhttp object to handle requests. */
-    http = evhttp_new(base); // XXX RAII
-    if (!http) {
-        LogPrintf("couldn't create evhttp. Exiting.\n");
-        event_base_free(base);
-        return false;
-    }
-
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
-    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
-    evhttp_set_max_body_size(http, MAX_SIZE);
-    evhttp_set_gencb(http, http_request_cb, NULL);
-
-    if (!HTTPBindAddresses(http)) {
+    boundSockets.resize(1);
+    if (!HTTPBindAddresses(http, boundSockets[0])) {
         LogPrintf("Unable to bind any endpoint for RPC server\n");
+        boundSockets.clear();
         evhttp_free(http);
         event_base_free(base);
         return false;
     }
+    eventBases.push_back(base);
+    eventHTTPs.push_back(http);
+
+    // Further event loops accept on the same sockets, each serving the
+    // connections it accepted, so no single loop carries all the traffic
+    int eventThreads = std::max((long)GetArg("-rpceventthreads", DEFAULT_HTTP_EVENT_THREADS), 1L);
+    while ((int)eventBases.size() < eventThreads) {
+        if (!NewHTTPServer(base, http))
+            break;
+        std::vector<evhttp_bound_socket *> sockets;
+        if (!HTTPShareSockets(http, sockets)) {
+            LogPrintf("HTTP: unable to share the RPC sockets with another event loop\n");
+            evhttp_free(http);
+            event_base_free(base);
+            break;
+        }
+        eventBases.push_back(base);
+        eventHTTPs.push_back(http);
+        boundSockets.push_back(sockets);
+    }
 
     LogPrint("http", "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
+    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
     LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
-    eventBase = base;
-    eventHTTP = http;
+    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth, rpcThreads);
+    semHeldWorkers = new CSemaphore(rpcThreads / 2);
     return true;
 }
 
-std::thread threadHTTP;
-std::future<bool> threadResult;
+std::vector<std::thread> threadHTTP;
+std::vector<std::future<bool> > threadResult;
 
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
-    std::packaged_task<bool(event_base*, evhttp*)> task(ThreadHTTP);
-    threadResult = task.get_future();
-    threadHTTP = std::thread(std::move(task), eventBase, eventHTTP);
+    LogPrintf("HTTP: starting %d event threads and %d worker threads\n", eventBases.size(), workQueue->Lanes());
+    for (size_t i = 0; i < eventBases.size(); i++) {
+        std::packaged_task<bool(event_base*, evhttp*)> task(ThreadHTTP);
+        threadResult.push_back(task.get_future());
+        threadHTTP.push_back(std::thread(std::move(task), eventBases[i], eventHTTPs[i]));
+    }
 
-    for (int i = 0; i < rpcThreads; i++) {
-        std::thread rpc_worker(HTTPWorkQueueRun, workQueue);
+    for (size_t i = 0; i < workQueue->Lanes(); i++) {
+        std::thread rpc_worker(HTTPWorkQueueRun, workQueue, i);
         rpc_worker.detach();
     }
     return true;
@@ -463,13 +442,13 @@ bool StartHTTPServer()
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
-    if (eventHTTP) {
+    for (size_t i = 0; i < eventHTTPs.size(); i++) {
         // Unlisten sockets
-        for (evhttp_bound_socket *socket : boundSockets) {
-            evhttp_del_accept_socket(eventHTTP, socket);
+        for (evhttp_bound_socket *socket : boundSockets[i]) {
+            evhttp_del_accept_socket(eventHTTPs[i], socket);
         }
         // Reject requests on current connections
-        evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
+        evhttp_set_gencb(eventHTTPs[i], http_reject_request_cb, NULL);
     }
     if (workQueue)
         workQueue->Interrupt();
@@ -482,34 +461,66 @@ void StopHTTPServer()
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
         workQueue->WaitExit();
         delete workQueue;
+        workQueue = 0;
     }
-    if (eventBase) {
-        LogPrint("http", "Waiting for HTTP event thread to exit\n");
-        // Give event loop a few seconds to exit (to send back last RPC responses), then break it
+    delete semHeldWorkers;
+    semHeldWorkers = 0;
+    if (!threadHTTP.empty()) {
+        LogPrint("http", "Waiting for HTTP event threads to exit\n");
+        // Give event loops a few seconds to exit (to send back last RPC responses), then break them
         // Before this was solved with event_base_loopexit, but that didn't work as expected in
         // at least libevent 2.0.21 and always introduced a delay. In libevent
         // master that appears to be solved, so in the future that solution
         // could be used again (if desirable).
-        if (threadResult.valid() && threadResult.wait_for(std::chrono::milliseconds(2000)) == std::future_status::timeout) {
-            LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
-            event_base_loopbreak(eventBase);
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(2000);
+        for (size_t i = 0; i < threadHTTP.size(); i++) {
+            if (threadResult[i].valid() && threadResult[i].wait_until(deadline) == std::future_status::timeout) {
+                LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
+                event_base_loopbreak(eventBases[i]);
+            }
+            threadHTTP[i].join();
         }
-        threadHTTP.join();
-    }
-    if (eventHTTP) {
-        evhttp_free(eventHTTP);
-        eventHTTP = 0;
-    }
-    if (eventBase) {
-        event_base_free(eventBase);
-        eventBase = 0;
+        threadHTTP.clear();
+        threadResult.clear();
     }
+    for (struct evhttp* http : eventHTTPs)
+        evhttp_free(http);
+    eventHTTPs.clear();
+    boundSockets.clear();
+    for (struct event_base* base : eventBases)
+        event_base_free(base);
+    eventBases.clear();
     LogPrint("http", "Stopped HTTP server\n");
 }
 
+bool QueueHTTPWork(const std::function<void(void)>& func)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPTaskItem> item(new HTTPTaskItem(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
+size_t HTTPWorkQueueFree()
+{
+    return workQueue ? workQueue->FreeDepth() : 0;
+}
+
+bool HoldHTTPWorker(CSemaphoreGrant& grant)
+{
+    if (!semHeldWorkers)
+        return false;
+    CSemaphoreGrant held(*semHeldWorkers, true);
+    held.MoveTo(grant);
+    return grant;
+}
+
 struct event_base* EventBase()
 {
-    return eventBase;
+    return eventBases.empty() ? 0 : eventBases[0];
 }
 
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
@@ -539,12 +550,17 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
+                                                       base(evhttp_connection_get_base(evhttp_request_get_connection(_req))),
                                                        replySent(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunkedReply) {
+        // The status went out already, all we can do is drop the connection
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        AbortChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -590,23 +606,153 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
-/** Closure sent to main thread to request a reply to be sent to
+/** Closure sent to the http thread to request a reply to be sent to
  * a HTTP request.
- * Replies must be sent in the main loop in the main http thread,
+ * Replies must be sent in the event loop that accepted the connection,
  * this cannot be done from worker threads.
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
-    // Send event to main http thread to send reply message
+    assert(!replySent && req && !chunkedReply);
+    // Send event to the connection's http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+    HTTPEvent* ev = new HTTPEvent(base, true,
         std::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
     replySent = true;
-    req = 0; // transferred back to main thread
+    req = 0; // transferred back to http thread
+}
+
+/** A reply sent in chunks, shared by the worker writing it and the http
+ * thread sending it. The connection's callbacks tell when the client has
+ * taken everything passed on to the connection so far, or has gone away.
+ */
+struct HTTPChunkedReply
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    //! Bytes handed to the http thread that the client has not taken yet
+    size_t nBacklog;
+    //! Of those, the bytes passed on to the connection
+    size_t nSubmitted;
+    bool fClosed;
+
+    HTTPChunkedReply() : nBacklog(0), nSubmitted(0), fClosed(false) {}
+};
+
+/** Connection write callback, the output buffer ran empty */
+static void http_chunk_sent_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->nBacklog -= reply->nSubmitted;
+    reply->nSubmitted = 0;
+    reply->cond.notify_all();
+}
+
+/** Connection close callback, the client went away mid-reply */
+static void http_chunk_closed_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->fClosed = true;
+    reply->cond.notify_all();
+}
+
+static void http_reply_start(struct evhttp_request* req, int nStatus, std::shared_ptr<HTTPChunkedReply> reply)
+{
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (!evcon) {
+        http_chunk_closed_cb(NULL, reply.get());
+        return;
+    }
+    evhttp_connection_set_closecb(evcon, http_chunk_closed_cb, reply.get());
+    evhttp_send_reply_start(req, nStatus, NULL);
+}
+
+static void http_reply_chunk(struct evhttp_request* req, struct evbuffer* evb, std::shared_ptr<HTTPChunkedReply> reply)
+{
+    size_t nSize = evbuffer_get_length(evb);
+    evhttp_send_reply_chunk_with_cb(req, evb, http_chunk_sent_cb, reply.get());
+    std::lock_guard<std::mutex> lock(reply->cs);
+    if (evbuffer_get_length(evb) == 0) {
+        reply->nSubmitted += nSize;
+    } else {
+        // Dropped: the connection is gone, or the reply has no body (HEAD)
+        reply->nBacklog -= nSize;
+        reply->cond.notify_all();
+    }
+    evbuffer_free(evb);
+}
+
+static void http_reply_end(struct evhttp_request* req, struct evbuffer* evb, std::shared_ptr<HTTPChunkedReply> reply)
+{
+    http_reply_chunk(req, evb, reply);
+    // The connection may serve more requests, which are none of our business
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (evcon)
+        evhttp_connection_set_closecb(evcon, NULL, NULL);
+    evhttp_send_reply_end(req);
+}
+
+static void http_reply_abort(struct evhttp_request* req, std::shared_ptr<HTTPChunkedReply> reply)
+{
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (!evcon) {
+        // Nothing to close, this only frees req
+        evhttp_send_reply_end(req);
+        return;
+    }
+    // Frees the pending request, req, along with the connection
+    evhttp_connection_set_closecb(evcon, NULL, NULL);
+    evhttp_connection_free(evcon);
+}
+
+bool HTTPRequest::WriteReplyChunk(int nStatus, const std::string& strChunk)
+{
+    assert(!replySent && req);
+    if (!chunkedReply) {
+        chunkedReply = std::make_shared<HTTPChunkedReply>();
+        HTTPEvent* ev = new HTTPEvent(base, true, std::bind(http_reply_start, req, nStatus, chunkedReply));
+        ev->trigger(0);
+    }
+    {
+        std::unique_lock<std::mutex> lock(chunkedReply->cs);
+        while (chunkedReply->nBacklog > MAX_HTTP_REPLY_BACKLOG && !chunkedReply->fClosed)
+            chunkedReply->cond.wait(lock);
+        if (chunkedReply->fClosed)
+            return false;
+        chunkedReply->nBacklog += strChunk.size();
+    }
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(base, true, std::bind(http_reply_chunk, req, evb, chunkedReply));
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply(const std::string& strChunk)
+{
+    assert(!replySent && req && chunkedReply);
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(base, true, std::bind(http_reply_end, req, evb, chunkedReply));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to http thread
+}
+
+void HTTPRequest::AbortChunkedReply()
+{
+    assert(!replySent && req && chunkedReply);
+    HTTPEvent* ev = new HTTPEvent(base, true, std::bind(http_reply_abort, req, chunkedReply));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to http thread
 }
 
 CService HTTPRequest::GetPeer()
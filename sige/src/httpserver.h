@@ -8,15 +8,21 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_EVENT_THREADS=2;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Bytes of a chunked reply the client may fall behind by before the worker writing it waits */
+static const size_t MAX_HTTP_REPLY_BACKLOG = 1024 * 1024;
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+class CSemaphoreGrant;
+struct HTTPChunkedReply;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -42,7 +48,22 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
-/** Return evhttp event base. This can be used by submodules to
+/** Queue a task for the HTTP worker threads.
+ * Returns false if the server is not running or the work queue is full.
+ */
+bool QueueHTTPWork(const std::function<void(void)>& func);
+/** Number of tasks the work queue takes before it is full (-rpcworkqueue) */
+size_t HTTPWorkQueueFree();
+
+/** Set aside the calling worker thread for a request that may hold it for
+ * long, such as a long poll or a reply streamed to a slow reader. At most half
+ * of the workers (rounded down) can be held at a time, so quick requests
+ * always find one free. Returns false if none is left; the worker is given
+ * back when grant is released or destroyed.
+ */
+bool HoldHTTPWorker(CSemaphoreGrant& grant);
+
+/** Return the first evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
 struct event_base* EventBase();
@@ -54,7 +75,11 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! Event base of the http thread serving the connection, for handing the reply back
+    struct event_base* base;
     bool replySent;
+    //! Set once a reply was started with WriteReplyChunk
+    std::shared_ptr<HTTPChunkedReply> chunkedReply;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -107,9 +132,44 @@ public:
      * strReply is the body of the reply. Keep it empty to send a standard message.
      *
      * @note Can be called only once. As this will give the request back to the
-     * main thread, do not call any other HTTPRequest methods after calling this.
+     * http thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write part of a reply, for replies sent while they are still being
+     * produced. The first call sends the status line and the headers, with
+     * chunked transfer encoding for HTTP/1.1 clients. Waits while the client
+     * is more than MAX_HTTP_REPLY_BACKLOG bytes behind, so do not hold locks
+     * when calling this, and hold the worker with HoldHTTPWorker for the
+     * length of the reply; a client that stops reading altogether is dropped
+     * after -rpcservertimeout.
+     * Returns false once the client has gone away; the rest of the reply can
+     * be skipped then.
+     *
+     * @note Finish the reply with EndChunkedReply or AbortChunkedReply
+     * instead of WriteReply.
+     */
+    bool WriteReplyChunk(int nStatus, const std::string& strChunk);
+
+    /**
+     * Send the last part of a reply started with WriteReplyChunk.
+     *
+     * @note Like WriteReply, this gives the request back to the http thread.
+     */
+    void EndChunkedReply(const std::string& strChunk = "");
+
+    /**
+     * Give up on a reply started with WriteReplyChunk by closing the
+     * connection, so the client does not take the part that was sent for a
+     * whole reply.
+     *
+     * @note Like WriteReply, this gives the request back to the http thread.
+     */
+    void AbortChunkedReply();
+
+    /** Whether a reply was started with WriteReplyChunk */
+    bool ReplyStarted() const { return chunkedReply != nullptr; }
 };
 
 /** Event handler closure.
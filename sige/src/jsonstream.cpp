@@ -0,0 +1,107 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "jsonstream.h"
+
+#include <assert.h>
+
+#include <include/univalue.h>
+
+CJSONStreamWriter::CJSONStreamWriter(const Sink& sinkIn, size_t nChunkSizeIn) : sink(sinkIn),
+                                                                                nChunkSize(nChunkSizeIn),
+                                                                                fAfterKey(false),
+                                                                                fFlushed(false),
+                                                                                fGood(true)
+{
+    strBuffer.reserve(nChunkSize + nChunkSize / 4);
+}
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (vHasElement.empty())
+        return;
+    if (vHasElement.back())
+        strBuffer += ',';
+    vHasElement.back() = true;
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    strBuffer += '{';
+    vHasElement.push_back(false);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vHasElement.empty() && !fAfterKey);
+    vHasElement.pop_back();
+    strBuffer += '}';
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    strBuffer += '[';
+    vHasElement.push_back(false);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vHasElement.empty() && !fAfterKey);
+    vHasElement.pop_back();
+    strBuffer += ']';
+}
+
+void CJSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vHasElement.empty() && !fAfterKey);
+    Separate();
+    strBuffer += UniValue(key).write();
+    strBuffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Value(const UniValue& value)
+{
+    Separate();
+    strBuffer += value.write();
+}
+
+void CJSONStreamWriter::KeyValue(const std::string& key, const UniValue& value)
+{
+    Key(key);
+    Value(value);
+}
+
+void CJSONStreamWriter::Pairs(const UniValue& obj)
+{
+    assert(obj.isObject());
+    const std::vector<std::string>& keys = obj.getKeys();
+    const std::vector<UniValue>& values = obj.getValues();
+    for (size_t i = 0; i < keys.size(); i++)
+        KeyValue(keys[i], values[i]);
+}
+
+bool CJSONStreamWriter::Flush()
+{
+    if (fGood && !strBuffer.empty()) {
+        fFlushed = true;
+        fGood = sink(strBuffer);
+    }
+    // clear() keeps the capacity for the next chunk
+    strBuffer.clear();
+    return fGood;
+}
+
+std::string CJSONStreamWriter::TakeBuffer()
+{
+    std::string strRet;
+    strRet.swap(strBuffer);
+    return strRet;
+}
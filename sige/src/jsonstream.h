@@ -0,0 +1,77 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __sig_jsonstream_h__
+#define __sig_jsonstream_h__
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class UniValue;
+
+/** Output a CJSONStreamWriter gathers before FlushIfFull hands it on */
+static const size_t DEFAULT_JSON_STREAM_CHUNK = 64 * 1024;
+
+/**
+ * Writes a JSON document piece by piece, as the same compact text
+ * UniValue::write() gives for the whole of it, and hands the output to a
+ * sink a chunk at a time. A large result (a block with its transactions, the
+ * mempool) can be built and sent one element at a time that way, instead of
+ * as a UniValue tree and a string that both hold all of it.
+ *
+ * Nothing is handed to the sink except by FlushIfFull and Flush, so callers
+ * choose the points at which the sink may block, outside their locks.
+ */
+class CJSONStreamWriter
+{
+public:
+    /** Takes a chunk of output; returns false if the output is no longer wanted */
+    typedef std::function<bool(const std::string&)> Sink;
+
+private:
+    Sink sink;
+    size_t nChunkSize;
+    std::string strBuffer;
+    //! For each open object or array, whether it has an element yet
+    std::vector<bool> vHasElement;
+    //! A key was written and its value is due
+    bool fAfterKey;
+    bool fFlushed;
+    bool fGood;
+
+    /** Write the comma due before the next element, if any */
+    void Separate();
+
+public:
+    CJSONStreamWriter(const Sink& sinkIn, size_t nChunkSizeIn = DEFAULT_JSON_STREAM_CHUNK);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Write an object key, the value is whatever is written next */
+    void Key(const std::string& key);
+    /** Write a value, nested or not, as a whole */
+    void Value(const UniValue& value);
+    void KeyValue(const std::string& key, const UniValue& value);
+    /** Write every key and value of obj into the open object */
+    void Pairs(const UniValue& obj);
+
+    /** Whether a chunk worth of output is waiting */
+    bool Full() const { return strBuffer.size() >= nChunkSize; }
+    /** Hand the output to the sink if a chunk worth of it is waiting.
+     * Returns false once the sink refused output. */
+    bool FlushIfFull() { return Full() ? Flush() : fGood; }
+    /** Hand whatever output is waiting to the sink */
+    bool Flush();
+    /** Take the output that was not handed to the sink yet */
+    std::string TakeBuffer();
+    /** Whether any output was handed to the sink */
+    bool Flushed() const { return fFlushed; }
+    /** Whether the document is complete, every object and array closed */
+    bool Complete() const { return vHasElement.empty() && !fAfterKey; }
+};
+
+#endif  /* __sig_jsonstream_h__ */
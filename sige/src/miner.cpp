@@ -18,6 +18,7 @@
 #include "pow.h"
 #include "primitives/transaction.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "timedata.h"
 #include "txmempool.h"
 #include "util.h"
@@ -25,6 +26,8 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <atomic>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -143,6 +146,63 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     LOCK2(cs_main, mempool.cs);
     CBlockIndex* pindexPrev = chainActive.Tip();
+    PrepareBlock(pindexPrev);
+
+    addPriorityTxs();
+    addPackageTxs();
+
+    FinishBlock(scriptPubKeyIn, pindexPrev, true);
+
+    return std::move(pblocktemplate);
+}
+
+std::unique_ptr<CBlockTemplate> BlockAssembler::ExtendBlock(const CBlockTemplate& prev, const std::vector<uint256>& vHashesAdded, const CScript& scriptPubKeyIn)
+{
+    // Priority space is filled by its own pass over the whole mempool
+    if (GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE) != 0)
+        return nullptr;
+
+    resetBlock();
+
+    pblocktemplate.reset(new CBlockTemplate());
+    pblock = &pblocktemplate->block;
+
+    pblock->vtx.emplace_back();
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
+
+    LOCK2(cs_main, mempool.cs);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (prev.block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return nullptr;
+    PrepareBlock(pindexPrev);
+
+    // Replay the previous selection; all of it must still be in the mempool.
+    // Each transaction's own feerate stands in for its package's, which
+    // understates parents selected for their children's fees; at worst that
+    // reselects more often than needed.
+    CFeeRate minSelectedFeeRate(std::numeric_limits<CAmount>::max());
+    for (size_t i = 1; i < prev.block.vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(prev.block.vtx[i]->GetHash());
+        if (it == mempool.mapTx.end())
+            return nullptr;
+        AddToBlock(it);
+        minSelectedFeeRate = std::min(minSelectedFeeRate, CFeeRate(it->GetModifiedFee(), it->GetTxSize()));
+    }
+
+    uint64_t nPrevBlockTx = nBlockTx;
+    if (!addNewPackageTxs(vHashesAdded, minSelectedFeeRate))
+        return nullptr;
+
+    // The previous template already passed TestBlockValidity on this tip;
+    // only a changed transaction set needs to be checked again.
+    FinishBlock(scriptPubKeyIn, pindexPrev, nBlockTx != nPrevBlockTx);
+
+    return std::move(pblocktemplate);
+}
+
+void BlockAssembler::PrepareBlock(CBlockIndex* pindexPrev)
+{
     nHeight = pindexPrev->nHeight + 1;
 
     pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
@@ -165,10 +225,10 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     // TODO: replace this with a call to main to assess validity of a mempool
     // transaction (which in most cases can be a no-op).
     fIncludeWitness = IsWitnessEnabled(pindexPrev, chainparams.GetConsensus());
+}
 
-    addPriorityTxs();
-    addPackageTxs();
-
+void BlockAssembler::FinishBlock(const CScript& scriptPubKeyIn, CBlockIndex* pindexPrev, bool fTestValidity)
+{
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
     nLastBlockWeight = nBlockWeight;
@@ -196,11 +256,9 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
     CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+    if (fTestValidity && !TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
     }
-
-    return std::move(pblocktemplate);
 }
 
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
@@ -342,8 +400,9 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
 void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
         indexed_modified_transaction_set &mapModifiedTx)
 {
+    std::vector<CTxMemPool::txiter> descendants;
     BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
-        CTxMemPool::setEntries descendants;
+        descendants.clear();
         mempool.CalculateDescendants(it, descendants);
         // Insert all descendants (not yet in block) into the modified set
         BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
@@ -511,6 +570,63 @@ void BlockAssembler::addPackageTxs()
     }
 }
 
+bool BlockAssembler::addNewPackageTxs(const std::vector<uint256>& vHashesAdded, const CFeeRate& minSelectedFeeRate)
+{
+    std::vector<CTxMemPool::txiter> vCandidates;
+    vCandidates.reserve(vHashesAdded.size());
+    BOOST_FOREACH(const uint256& hash, vHashesAdded) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it != mempool.mapTx.end())
+            vCandidates.push_back(it);
+    }
+    CompareTxMemPoolEntryByAncestorFee compare;
+    std::sort(vCandidates.begin(), vCandidates.end(), [&compare](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+        return compare(*a, *b);
+    });
+
+    BOOST_FOREACH(CTxMemPool::txiter iter, vCandidates) {
+        // May have been pulled in as the ancestor of an earlier candidate
+        if (inBlock.count(iter))
+            continue;
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        // The mapTx ancestor state includes parents that are already in the
+        // block, so sum up what is actually left instead.
+        uint64_t packageSize = 0;
+        CAmount packageFees = 0;
+        int64_t packageSigOpsCost = 0;
+        BOOST_FOREACH(CTxMemPool::txiter it, ancestors) {
+            packageSize += it->GetTxSize();
+            packageFees += it->GetModifiedFee();
+            packageSigOpsCost += it->GetSigOpCost();
+        }
+
+        if (packageFees < blockMinFeeRate.GetFee(packageSize))
+            continue;
+        if (!TestPackage(packageSize, packageSigOpsCost)) {
+            if (packageFees > minSelectedFeeRate.GetFee(packageSize))
+                return false;
+            continue;
+        }
+        if (!TestPackageTransactions(ancestors))
+            continue;
+
+        std::vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, iter, sortedEntries);
+        for (size_t i=0; i<sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+        }
+    }
+    return true;
+}
+
 void BlockAssembler::addPriorityTxs()
 {
     // How much of the block should be dedicated to high-priority transactions,
@@ -593,6 +709,81 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+BlockTemplateCache::BlockTemplateCache() : fStale(true)
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&BlockTemplateCache::TransactionAddedToMempool, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&BlockTemplateCache::TransactionRemovedFromMempool, this, _1, _2));
+}
+
+BlockTemplateCache::~BlockTemplateCache()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&BlockTemplateCache::TransactionAddedToMempool, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&BlockTemplateCache::TransactionRemovedFromMempool, this, _1, _2));
+}
+
+// Both notifications arrive with mempool.cs held
+void BlockTemplateCache::TransactionAddedToMempool(CTransactionRef tx)
+{
+    LOCK(cs);
+    if (fStale)
+        return;
+    if (vHashesAdded.size() >= TEMPLATE_MAX_PENDING_TXS) {
+        fStale = true;
+        vHashesAdded.clear();
+        return;
+    }
+    vHashesAdded.push_back(tx->GetHash());
+}
+
+void BlockTemplateCache::TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    LOCK(cs);
+    if (!fStale && setSelected.count(tx->GetHash())) {
+        fStale = true;
+        vHashesAdded.clear();
+    }
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateCache::Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
+{
+    // Same lock order as the mempool notifications: no event can slip in
+    // between assembling the template and resetting vHashesAdded.
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    if (!fStale && pcached) {
+        pblocktemplate = BlockAssembler(chainparams).ExtendBlock(*pcached, vHashesAdded, scriptPubKeyIn);
+        if (pblocktemplate)
+            LogPrint("bench", "BlockTemplateCache: extended template with %u arrivals\n", vHashesAdded.size());
+    }
+    if (!pblocktemplate)
+        pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKeyIn);
+    if (!pblocktemplate)
+        return nullptr;
+
+    pcached.reset(new CBlockTemplate(*pblocktemplate));
+    setSelected.clear();
+    for (size_t i = 1; i < pcached->block.vtx.size(); i++) {
+        setSelected.insert(pcached->block.vtx[i]->GetHash());
+    }
+    vHashesAdded.clear();
+    fStale = false;
+
+    return pblocktemplate;
+}
+
+static void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int nExtraNonce)
+{
+    unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
+    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
+    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+
+    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
+    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -603,11 +794,113 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
         hashPrevBlock = pblock->hashPrevBlock;
     }
     ++nExtraNonce;
-    unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(*pblock->vtx[0]);
-    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
-    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+    SetExtraNonce(pblock, pindexPrev, nExtraNonce);
+}
 
-    pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+CBlockHeaderHasher::CBlockHeaderHasher(const CBlockHeader& header)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    assert(ss.size() == 80);
+    midstate.Write((const unsigned char*)&ss[0], 64);
+    memcpy(tail, &ss[64], sizeof(tail));
+}
+
+uint256 CBlockHeaderHasher::GetHash(uint32_t nNonce)
+{
+    unsigned char buf[CSHA256::OUTPUT_SIZE];
+    WriteLE32(tail + 12, nNonce);
+    CSHA256(midstate).Write(tail, sizeof(tail)).Finalize(buf);
+    uint256 hash;
+    CSHA256().Write(buf, sizeof(buf)).Finalize(hash.begin());
+    return hash;
+}
+
+static std::atomic<int64_t> nGenerateHashesPerSec(0);
+
+int64_t GetGenerateHashesPerSec()
+{
+    return nGenerateHashesPerSec;
+}
+
+/** Work shared by the threads of one GenerateBlockProof call. Units are
+ *  handed out in order; unit n covers nonce chunk n % nChunks of extranonce
+ *  1 + n / nChunks, so threads never hash the same header twice. */
+struct GenerateWork
+{
+    const CBlock* pblock;
+    const CBlockIndex* pindexPrev;
+    uint64_t nMaxTries;
+    std::atomic<uint64_t> nNextUnit;
+    std::atomic<uint64_t> nTries;
+    std::atomic<bool> fFound;
+    CCriticalSection cs;
+    CBlock blockFound;
+};
+
+static void GenerateThread(GenerateWork& work)
+{
+    static const uint64_t nChunks = (UINT64_C(1) << 32) / GENERATE_NONCE_CHUNK;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(work.pblock->nBits);
+
+    CBlock block(*work.pblock);
+    unsigned int nExtraNonce = 0;
+    while (!work.fFound) {
+        const uint64_t nUnit = work.nNextUnit++;
+        const uint64_t nTriesClaimed = work.nTries.fetch_add(GENERATE_NONCE_CHUNK);
+        if (nTriesClaimed >= work.nMaxTries)
+            return;
+        const uint32_t nCount = std::min<uint64_t>(GENERATE_NONCE_CHUNK, work.nMaxTries - nTriesClaimed);
+
+        if (nExtraNonce != 1 + nUnit / nChunks) {
+            nExtraNonce = 1 + nUnit / nChunks;
+            SetExtraNonce(&block, work.pindexPrev, nExtraNonce);
+        }
+        CBlockHeaderHasher hasher(block);
+        const uint32_t nNonceBegin = (nUnit % nChunks) * GENERATE_NONCE_CHUNK;
+        for (uint32_t i = 0; i < nCount; i++) {
+            if (UintToArith256(hasher.GetHash(nNonceBegin + i)) <= bnTarget) {
+                LOCK(work.cs);
+                if (!work.fFound) {
+                    block.nNonce = nNonceBegin + i;
+                    work.blockFound = block;
+                    work.fFound = true;
+                }
+                return;
+            }
+            if ((i & 0xfff) == 0xfff && work.fFound)
+                return;
+        }
+    }
+}
+
+bool GenerateBlockProof(CBlock& block, const CBlockIndex* pindexPrev, int nThreads, uint64_t& nMaxTries)
+{
+    GenerateWork work;
+    work.pblock = &block;
+    work.pindexPrev = pindexPrev;
+    work.nMaxTries = nMaxTries;
+    work.nNextUnit = 0;
+    work.nTries = 0;
+    work.fFound = false;
+
+    const int64_t nTimeStart = GetTimeMicros();
+    boost::thread_group threads;
+    for (int i = 0; i < std::max(nThreads, 1); i++)
+        threads.create_thread(boost::bind(&GenerateThread, boost::ref(work)));
+    threads.join_all();
+    const int64_t nTimeElapsed = GetTimeMicros() - nTimeStart;
+
+    // Claimed but unscanned nonces are not counted exactly; close enough for a rate
+    const uint64_t nTries = std::min(work.nTries.load(), nMaxTries);
+    nMaxTries -= nTries;
+    if (nTimeElapsed > 0)
+        nGenerateHashesPerSec = nTries * 1000000 / nTimeElapsed;
+    LogPrint("bench", "GenerateBlockProof: %u hashes on %d threads, %.2fms (%d H/s)\n", nTries, nThreads, nTimeElapsed * 0.001, nGenerateHashesPerSec.load());
+
+    if (!work.fFound)
+        return false;
+    block = work.blockFound;
+    return true;
 }
@@ -5,11 +5,14 @@
 #ifndef __sig_miner_h__
 #define __sig_miner_h__
 
+#include "crypto/sha256.h"
 #include "primitives/block.h"
+#include "sync.h"
 #include "txmempool.h"
 
 #include <stdint.h>
 #include <memory>
+#include <set>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 
@@ -22,6 +25,12 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Reselect from scratch once this many mempool arrivals are pending */
+static const unsigned int TEMPLATE_MAX_PENDING_TXS = 5000;
+/** Default number of generate threads; negative means one per core */
+static const int DEFAULT_GENERATE_THREADS = -1;
+/** Nonces a generate thread scans per unit of work it claims */
+static const uint32_t GENERATE_NONCE_CHUNK = 0x10000;
 
 struct CBlockTemplate
 {
@@ -165,11 +174,19 @@ public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
+    /** Extend a template previously built on the current tip with the packages
+     *  of vHashesAdded, leaving its existing selection in place. Returns
+     *  nullptr if the template has to be reselected with CreateNewBlock. */
+    std::unique_ptr<CBlockTemplate> ExtendBlock(const CBlockTemplate& prev, const std::vector<uint256>& vHashesAdded, const CScript& scriptPubKeyIn);
 
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Set up the header fields and chain context for a block on pindexPrev */
+    void PrepareBlock(CBlockIndex* pindexPrev);
+    /** Add the coinbase, fill in the header and optionally run TestBlockValidity */
+    void FinishBlock(const CScript& scriptPubKeyIn, CBlockIndex* pindexPrev, bool fTestValidity);
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -178,6 +195,10 @@ private:
     void addPriorityTxs();
     /** Add transactions based on feerate including unconfirmed ancestors */
     void addPackageTxs();
+    /** Add the packages of the given transactions, best ancestor feerate first.
+     *  Returns false if a package paying more than minSelectedFeeRate did not
+     *  fit, so that it would displace what is selected already. */
+    bool addNewPackageTxs(const std::vector<uint256>& vHashesAdded, const CFeeRate& minSelectedFeeRate);
 
     // helper function for addPriorityTxs
     /** Test if tx will still "fit" in the block */
@@ -205,8 +226,54 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/** Keeps the last block template and extends it with the transactions that
+ *  entered the mempool since, instead of reselecting the whole mempool on
+ *  every request. Selection is rerun from scratch on a new tip, when a
+ *  selected transaction leaves the mempool, or when an arrival that does not
+ *  fit pays more than the worst selected transaction.
+ *  Listens to mempool events, so it must not outlive the mempool. */
+class BlockTemplateCache
+{
+private:
+    CCriticalSection cs;
+    std::unique_ptr<CBlockTemplate> pcached;
+    std::set<uint256> setSelected;     //!< Transactions in pcached
+    std::vector<uint256> vHashesAdded; //!< Mempool arrivals since pcached was built
+    bool fStale;                       //!< pcached can not be extended
+
+    void TransactionAddedToMempool(CTransactionRef tx);
+    void TransactionRemovedFromMempool(CTransactionRef tx, MemPoolRemovalReason reason);
+
+public:
+    BlockTemplateCache();
+    ~BlockTemplateCache();
+
+    /** Return a template for the current tip with coinbase to scriptPubKeyIn */
+    std::unique_ptr<CBlockTemplate> Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn);
+};
+
+/** Double SHA256 of headers that differ only in nNonce. The state after the
+ *  first 64 header bytes is kept, so each nonce costs one block compression
+ *  plus the outer hash instead of a full serialization. */
+class CBlockHeaderHasher
+{
+private:
+    CSHA256 midstate;
+    unsigned char tail[16]; //!< Last 4 merkle root bytes, nTime, nBits, nNonce
+
+public:
+    explicit CBlockHeaderHasher(const CBlockHeader& header);
+    uint256 GetHash(uint32_t nNonce);
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+/** Grind nonce and extranonce on nThreads threads until the header meets its
+ *  nBits target. Returns false once nMaxTries hashes are spent; nMaxTries is
+ *  reduced by the hashes done either way. */
+bool GenerateBlockProof(CBlock& block, const CBlockIndex* pindexPrev, int nThreads, uint64_t& nMaxTries);
+/** Hash rate measured by the most recent GenerateBlockProof */
+int64_t GetGenerateHashesPerSec();
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
 #endif  /* __sig_miner_h__ */
@@ -31,6 +31,9 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+// Maximum number of queued buffers written by one sendmsg() call
+#define SEND_MAX_IOVECS 64
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -50,6 +53,7 @@ const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
+static const uint64_t RANDOMIZER_ID_ADDRCACHE = 0x1cf2e4ddd306dda9ULL; // SHA256("addrcache")[0:8]
 //
 // Global state variables
 //
@@ -322,6 +326,21 @@ bool CConnman::CheckIncomingNonce(uint64_t nonce)
     return true;
 }
 
+/** Get the local address a socket is bound to */
+static CAddress GetBindAddress(SOCKET sock)
+{
+    CAddress addrBind;
+    struct sockaddr_storage sockaddr_bind;
+    socklen_t sockaddr_bind_len = sizeof(sockaddr_bind);
+    if (sock != INVALID_SOCKET) {
+        if (!getsockname(sock, (struct sockaddr*)&sockaddr_bind, &sockaddr_bind_len))
+            addrBind.SetSockAddr((const struct sockaddr*)&sockaddr_bind);
+        else
+            LogPrint("net", "Warning: getsockname failed\n");
+    }
+    return addrBind;
+}
+
 CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure)
 {
     if (pszDest == NULL) {
@@ -375,7 +394,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         // Add node
         NodeId id = GetNewNodeId();
         uint64_t nonce = GetDeterministicRandomizer(RANDOMIZER_ID_LOCALHOSTNONCE).Write(id).Finalize();
-        CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addrConnect, CalculateKeyedNetGroup(addrConnect), nonce, pszDest ? pszDest : "", false);
+        CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addrConnect, CalculateKeyedNetGroup(addrConnect), nonce, pszDest ? pszDest : "", false, GetBindAddress(hSocket));
         pnode->nServicesExpected = ServiceFlags(addrConnect.nServices & nRelevantServices);
         pnode->AddRef();
 
@@ -425,6 +444,8 @@ void CConnman::ClearBanned()
     {
         LOCK(cs_setBanned);
         setBanned.clear();
+        banTrie.clear();
+        setBanExpiry.clear();
         setBannedIsDirty = true;
     }
     DumpBanlist(); //store banlist to disk
@@ -434,19 +455,9 @@ void CConnman::ClearBanned()
 
 bool CConnman::IsBanned(CNetAddr ip)
 {
-    bool fResult = false;
-    {
-        LOCK(cs_setBanned);
-        for (banmap_t::iterator it = setBanned.begin(); it != setBanned.end(); it++)
-        {
-            CSubNet subNet = (*it).first;
-            CBanEntry banEntry = (*it).second;
-
-            if(subNet.Match(ip) && GetTime() < banEntry.nBanUntil)
-                fResult = true;
-        }
-    }
-    return fResult;
+    int64_t nNow = GetTime();
+    LOCK(cs_setBanned);
+    return banTrie.MatchAny(ip, [nNow](int64_t nBanUntil) { return nNow < nBanUntil; });
 }
 
 bool CConnman::IsBanned(CSubNet subnet)
@@ -465,12 +476,8 @@ bool CConnman::IsBanned(CSubNet subnet)
     return fResult;
 }
 
-void CConnman::Ban(const CNetAddr& addr, const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch) {
-    CSubNet subNet(addr);
-    Ban(subNet, banReason, bantimeoffset, sinceUnixEpoch);
-}
-
-void CConnman::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch) {
+static CBanEntry MakeBanEntry(const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch)
+{
     CBanEntry banEntry(GetTime());
     banEntry.banReason = banReason;
     if (bantimeoffset <= 0)
@@ -479,14 +486,58 @@ void CConnman::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t ba
         sinceUnixEpoch = false;
     }
     banEntry.nBanUntil = (sinceUnixEpoch ? 0 : GetTime() )+bantimeoffset;
+    return banEntry;
+}
+
+bool CConnman::AddBanned(const CSubNet& subNet, const CBanEntry& banEntry)
+{
+    AssertLockHeld(cs_setBanned);
+    banmap_t::iterator it = setBanned.find(subNet);
+    if (it != setBanned.end()) {
+        if (it->second.nBanUntil >= banEntry.nBanUntil)
+            return false;
+        setBanExpiry.erase(std::make_pair(it->second.nBanUntil, subNet));
+        it->second = banEntry;
+    } else {
+        setBanned.insert(std::make_pair(subNet, banEntry));
+    }
+    setBanExpiry.insert(std::make_pair(banEntry.nBanUntil, subNet));
+    banTrie.Insert(subNet, banEntry.nBanUntil);
+    setBannedIsDirty = true;
+    return true;
+}
+
+void CConnman::IndexBanned()
+{
+    AssertLockHeld(cs_setBanned);
+    banTrie.clear();
+    setBanExpiry.clear();
+    for (banmap_t::const_iterator it = setBanned.begin(); it != setBanned.end(); ++it) {
+        banTrie.Insert(it->first, it->second.nBanUntil);
+        setBanExpiry.insert(std::make_pair(it->second.nBanUntil, it->first));
+    }
+}
+
+void CConnman::DisconnectBanned()
+{
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        if (IsBanned((CNetAddr)pnode->addr))
+            pnode->fDisconnect = true;
+    }
+}
+
+void CConnman::Ban(const CNetAddr& addr, const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch) {
+    CSubNet subNet(addr);
+    Ban(subNet, banReason, bantimeoffset, sinceUnixEpoch);
+}
+
+void CConnman::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch) {
+    CBanEntry banEntry = MakeBanEntry(banReason, bantimeoffset, sinceUnixEpoch);
 
     {
         LOCK(cs_setBanned);
-        if (setBanned[subNet].nBanUntil < banEntry.nBanUntil) {
-            setBanned[subNet] = banEntry;
-            setBannedIsDirty = true;
-        }
-        else
+        if (!AddBanned(subNet, banEntry))
             return;
     }
     if(clientInterface)
@@ -502,6 +553,27 @@ void CConnman::Ban(const CSubNet& subNet, const BanReason &banReason, int64_t ba
         DumpBanlist(); //store banlist to disk immediately if user requested ban
 }
 
+size_t CConnman::Ban(const std::vector<CSubNet>& vSubNets, const BanReason &banReason, int64_t bantimeoffset, bool sinceUnixEpoch) {
+    CBanEntry banEntry = MakeBanEntry(banReason, bantimeoffset, sinceUnixEpoch);
+
+    size_t nAdded = 0;
+    {
+        LOCK(cs_setBanned);
+        BOOST_FOREACH(const CSubNet& subNet, vSubNets) {
+            if (AddBanned(subNet, banEntry))
+                nAdded++;
+        }
+    }
+    if (nAdded == 0)
+        return 0;
+    if(clientInterface)
+        clientInterface->BannedListChanged();
+    DisconnectBanned();
+    if(banReason == BanReasonManuallyAdded)
+        DumpBanlist(); //store banlist to disk immediately if user requested ban
+    return nAdded;
+}
+
 bool CConnman::Unban(const CNetAddr &addr) {
     CSubNet subNet(addr);
     return Unban(subNet);
@@ -510,8 +582,12 @@ bool CConnman::Unban(const CNetAddr &addr) {
 bool CConnman::Unban(const CSubNet &subNet) {
     {
         LOCK(cs_setBanned);
-        if (!setBanned.erase(subNet))
+        banmap_t::iterator it = setBanned.find(subNet);
+        if (it == setBanned.end())
             return false;
+        setBanExpiry.erase(std::make_pair(it->second.nBanUntil, subNet));
+        banTrie.Erase(subNet);
+        setBanned.erase(it);
         setBannedIsDirty = true;
     }
     if(clientInterface)
@@ -530,6 +606,7 @@ void CConnman::SetBanned(const banmap_t &banMap)
 {
     LOCK(cs_setBanned);
     setBanned = banMap;
+    IndexBanned();
     setBannedIsDirty = true;
 }
 
@@ -538,19 +615,14 @@ void CConnman::SweepBanned()
     int64_t now = GetTime();
 
     LOCK(cs_setBanned);
-    banmap_t::iterator it = setBanned.begin();
-    while(it != setBanned.end())
+    while (!setBanExpiry.empty() && now > setBanExpiry.begin()->first)
     {
-        CSubNet subNet = (*it).first;
-        CBanEntry banEntry = (*it).second;
-        if(now > banEntry.nBanUntil)
-        {
-            setBanned.erase(it++);
-            setBannedIsDirty = true;
-            LogPrint("net", "%s: Removed banned node ip/subnet from banlist.dat: %s\n", __func__, subNet.ToString());
-        }
-        else
-            ++it;
+        CSubNet subNet = setBanExpiry.begin()->second;
+        setBanExpiry.erase(setBanExpiry.begin());
+        setBanned.erase(subNet);
+        banTrie.Erase(subNet);
+        setBannedIsDirty = true;
+        LogPrint("net", "%s: Removed banned node ip/subnet from banlist.dat: %s\n", __func__, subNet.ToString());
     }
 }
 
@@ -569,16 +641,12 @@ void CConnman::SetBannedSetDirty(bool dirty)
 
 bool CConnman::IsWhitelistedRange(const CNetAddr &addr) {
     LOCK(cs_vWhitelistedRange);
-    BOOST_FOREACH(const CSubNet& subnet, vWhitelistedRange) {
-        if (subnet.Match(addr))
-            return true;
-    }
-    return false;
+    return whitelistedRange.Match(addr);
 }
 
 void CConnman::AddWhitelistedRange(const CSubNet &subnet) {
     LOCK(cs_vWhitelistedRange);
-    vWhitelistedRange.push_back(subnet);
+    whitelistedRange.Insert(subnet, true);
 }
 
 
@@ -636,12 +704,15 @@ void CNode::copyStats(CNodeStats &stats)
         LOCK(cs_vSend);
         X(mapSendBytesPerMsgCmd);
         X(nSendBytes);
+        for (int i = 0; i < SEND_PRIORITY_COUNT; i++)
+            stats.sendQueueStats[i] = vSendMsg.GetStats(i);
     }
     {
         LOCK(cs_vRecv);
         X(mapRecvBytesPerMsgCmd);
         X(nRecvBytes);
     }
+    stats.nRecvBufferSize = nRecvBufferSize;
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -666,6 +737,71 @@ void CNode::copyStats(CNodeStats &stats)
 }
 #undef X
 
+/**
+ * Receive buffers bucketed by power-of-two capacity. Payload buffers are
+ * handed back here once a message has been processed, so the receive path
+ * reuses memory across messages and peers instead of reallocating.
+ */
+class CNetMessageBufferPool
+{
+private:
+    static const unsigned int MIN_SIZE_SHIFT = 10; // 1 KiB
+    static const unsigned int NUM_SIZE_CLASSES = 13; // up to 4 MiB
+    static const size_t MAX_POOLED_BYTES = 32 * 1024 * 1024;
+
+    CCriticalSection cs;
+    std::vector<CSerializeData> vFree[NUM_SIZE_CLASSES];
+    size_t nPooledBytes;
+
+    static unsigned int SizeClass(size_t nSize)
+    {
+        unsigned int nClass = 0;
+        while (nClass < NUM_SIZE_CLASSES && ((size_t)1 << (MIN_SIZE_SHIFT + nClass)) < nSize)
+            nClass++;
+        return nClass;
+    }
+
+public:
+    CNetMessageBufferPool() : nPooledBytes(0) {}
+
+    // Hand out an empty buffer with room for at least nSize bytes
+    void Get(size_t nSize, CSerializeData& vch)
+    {
+        unsigned int nClass = SizeClass(nSize);
+        if (nClass == NUM_SIZE_CLASSES) {
+            vch.reserve(nSize);
+            return;
+        }
+        {
+            LOCK(cs);
+            if (!vFree[nClass].empty()) {
+                vch.swap(vFree[nClass].back());
+                vFree[nClass].pop_back();
+                nPooledBytes -= vch.capacity();
+                return;
+            }
+        }
+        vch.reserve((size_t)1 << (MIN_SIZE_SHIFT + nClass));
+    }
+
+    void Release(CSerializeData& vch)
+    {
+        size_t nCapacity = vch.capacity();
+        unsigned int nClass = SizeClass(nCapacity);
+        if (nClass == NUM_SIZE_CLASSES || ((size_t)1 << (MIN_SIZE_SHIFT + nClass)) != nCapacity)
+            return;
+        vch.clear();
+        LOCK(cs);
+        if (nPooledBytes + nCapacity > MAX_POOLED_BYTES)
+            return;
+        vFree[nClass].push_back(CSerializeData());
+        vFree[nClass].back().swap(vch);
+        nPooledBytes += nCapacity;
+    }
+};
+
+static CNetMessageBufferPool netMessageBufferPool;
+
 bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete)
 {
     complete = false;
@@ -678,7 +814,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -686,8 +822,11 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         int handled;
         if (!msg.in_data)
             handled = msg.readHeader(pch, nBytes);
-        else
+        else {
+            size_t nBufferSizeBefore = msg.GetBufferSize();
             handled = msg.readData(pch, nBytes);
+            nRecvBufferSize += msg.GetBufferSize() - nBufferSizeBefore;
+        }
 
         if (handled < 0)
                 return false;
@@ -745,26 +884,31 @@ int CNode::GetSendVersion() const
 }
 
 
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.swap(vch);
+    netMessageBufferPool.Release(vch);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
-    try {
-        hdrbuf >> hdr;
-    }
-    catch (const std::exception&) {
-        return -1;
-    }
+    memcpy(hdr.pchMessageStart, hdrbuf, CMessageHeader::MESSAGE_START_SIZE);
+    memcpy(hdr.pchCommand, hdrbuf + CMessageHeader::MESSAGE_START_SIZE, CMessageHeader::COMMAND_SIZE);
+    hdr.nMessageSize = ReadLE32((const unsigned char*)hdrbuf + CMessageHeader::MESSAGE_SIZE_OFFSET);
+    memcpy(hdr.pchChecksum, hdrbuf + CMessageHeader::CHECKSUM_OFFSET, CMessageHeader::CHECKSUM_SIZE);
 
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
@@ -781,13 +925,19 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
+    if (nBufferSize < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        CSerializeData vch;
+        netMessageBufferPool.Get(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024), vch);
+        vch.insert(vch.end(), vRecv.begin(), vRecv.end());
+        nBufferSize = vch.capacity();
+        vRecv.swap(vch);
+        netMessageBufferPool.Release(vch);
     }
 
+    // The checksum is computed as the payload arrives
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    vRecv.write(pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -812,31 +962,43 @@ const uint256& CNetMessage::GetMessageHash() const
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
-    auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
+    std::vector<CSendQueue::Buffer> vBuffers;
 
-    while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+    while (!pnode->vSendMsg.empty()) {
         int nBytes = 0;
+        size_t nRequested = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            pnode->vSendMsg.GetSendBuffers(vBuffers, 1);
+            nRequested = vBuffers[0].second;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(vBuffers[0].first), nRequested, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            // Hand as many queued buffers as possible to the kernel in one call
+            pnode->vSendMsg.GetSendBuffers(vBuffers, SEND_MAX_IOVECS);
+            struct iovec iov[SEND_MAX_IOVECS];
+            for (size_t i = 0; i < vBuffers.size(); i++) {
+                iov[i].iov_base = const_cast<unsigned char*>(vBuffers[i].first);
+                iov[i].iov_len = vBuffers[i].second;
+                nRequested += vBuffers[i].second;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = vBuffers.size();
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
-                pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
-                it++;
-            } else {
-                // could not send full message; stop sending more
+            pnode->vSendMsg.Consume(nBytes, GetTimeMicros());
+            pnode->fPauseSend = pnode->vSendMsg.size() > nSendBufferMaxSize;
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -854,11 +1016,6 @@ size_t CConnman::SocketSendData(CNode *pnode) const
         }
     }
 
-    if (it == pnode->vSendMsg.end()) {
-        assert(pnode->nSendOffset == 0);
-        assert(pnode->nSendSize == 0);
-    }
-    pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
     return nSentSize;
 }
 
@@ -1078,7 +1235,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     NodeId id = GetNewNodeId();
     uint64_t nonce = GetDeterministicRandomizer(RANDOMIZER_ID_LOCALHOSTNONCE).Write(id).Finalize();
 
-    CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addr, CalculateKeyedNetGroup(addr), nonce, "", true);
+    CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addr, CalculateKeyedNetGroup(addr), nonce, "", true, GetBindAddress(hSocket));
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
     GetNodeSignals().InitializeNode(pnode, *this);
@@ -1089,309 +1246,585 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    RegisterNodeSocket(pnode);
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::RegisterNodeSocket(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (fdEpoll != -1) {
+        // Edge-triggered: the kernel reports each transition to readable or
+        // writable once, so interest never has to be re-armed per iteration.
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = pnode;
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket != INVALID_SOCKET && epoll_ctl(fdEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+            LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+            pnode->fDisconnect = true;
+        }
+    }
+#endif
+    WakeSocketHandler();
+}
+
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (!interruptNet)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        std::vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect)
             {
-                if (pnode->fDisconnect)
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
-            {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_inventory, lockInv);
-                        if (lockInv) {
-                            TRY_LOCK(pnode->cs_vSend, lockSend);
-                            if (lockSend) {
-                                fDelete = true;
-                            }
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_inventory, lockInv);
+                    if (lockInv) {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend) {
+                            fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        DeleteNode(pnode);
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    DeleteNode(pnode);
                 }
             }
         }
-        size_t vNodesSize;
+    }
+}
+
+void CConnman::NotifyNumConnectionsChanged()
+{
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        if(clientInterface)
+            clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
         {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            if(clientInterface)
-                clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
         }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+// Returns true if the read filled the whole buffer, so more data may be waiting
+bool CConnman::ReceiveFromNode(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    }
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler(pnode);
         }
+        return nBytes == (int)sizeof(pchBuf);
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+void CConnman::SendToNode(CNode* pnode)
+{
+    LOCK(pnode->cs_vSend);
+    size_t nBytes = SocketSendData(pnode);
+    if (nBytes) {
+        RecordBytesSent(nBytes);
+    }
+}
+
+bool CConnman::GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        recv_set.insert(hListenSocket.socket);
+    }
 
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
             {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
 
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+            error_set.insert(pnode->hSocket);
+            if (select_send) {
+                send_set.insert(pnode->hSocket);
+                continue;
+            }
+            if (select_recv) {
+                recv_set.insert(pnode->hSocket);
+            }
+        }
+    }
 
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+    return !recv_set.empty() || !send_set.empty() || !error_set.empty();
+}
+
+#ifdef USE_POLL
+void CConnman::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    GenerateSelectSet(recv_select_set, send_select_set, error_select_set);
+
+    std::map<SOCKET, struct pollfd> pollfds;
+    BOOST_FOREACH(SOCKET socket_id, recv_select_set) {
+        pollfds[socket_id].fd = socket_id;
+        pollfds[socket_id].events |= POLLIN;
+    }
+    BOOST_FOREACH(SOCKET socket_id, send_select_set) {
+        pollfds[socket_id].fd = socket_id;
+        pollfds[socket_id].events |= POLLOUT;
+    }
+    BOOST_FOREACH(SOCKET socket_id, error_select_set) {
+        pollfds[socket_id].fd = socket_id;
+        // These flags are ignored, but we set them for clarity
+        pollfds[socket_id].events |= POLLERR|POLLHUP;
+    }
+
+    std::vector<struct pollfd> vpollfds;
+    vpollfds.reserve(pollfds.size() + 1);
+    for (auto it : pollfds) {
+        vpollfds.push_back(std::move(it.second));
+    }
+    struct pollfd pollWake = {};
+    pollWake.fd = fdWakeRead;
+    pollWake.events = POLLIN;
+    vpollfds.push_back(pollWake);
+
+    if (poll(vpollfds.data(), vpollfds.size(), SOCKET_HOUSEKEEPING_INTERVAL) < 0) return;
+
+    if (interruptNet) return;
+
+    for (const struct pollfd& pollfd_entry : vpollfds) {
+        if (pollfd_entry.fd == fdWakeRead) {
+            if (pollfd_entry.revents & POLLIN) {
+                char buf[8];
+                while (read(fdWakeRead, buf, sizeof(buf)) > 0) {}
             }
+            continue;
         }
+        if (pollfd_entry.revents & POLLIN)            recv_set.insert(pollfd_entry.fd);
+        if (pollfd_entry.revents & POLLOUT)           send_set.insert(pollfd_entry.fd);
+        if (pollfd_entry.revents & (POLLERR|POLLHUP)) error_set.insert(pollfd_entry.fd);
+    }
+}
+#else
+void CConnman::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+        interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_HOUSEKEEPING_INTERVAL));
+        return;
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet)
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+
+    int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        int nErr = WSAGetLastError();
+        LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        for (unsigned int i = 0; i <= hSocketMax; i++)
+            FD_SET(i, &fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
             return;
+    }
 
-        if (nSelect == SOCKET_ERROR)
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        if (FD_ISSET(hSocket, &fdsetRecv)) {
+            recv_set.insert(hSocket);
+        }
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        if (FD_ISSET(hSocket, &fdsetSend)) {
+            send_set.insert(hSocket);
+        }
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        if (FD_ISSET(hSocket, &fdsetError)) {
+            error_set.insert(hSocket);
+        }
+    }
+}
+#endif
+
+void CConnman::SocketHandler()
+{
+    std::set<SOCKET> recv_set, send_set, error_set;
+    SocketEvents(recv_set, send_set, error_set);
+
+    if (interruptNet) return;
+
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+    {
+        if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
+            AcceptConnection(hListenSocket);
         }
+    }
+
+    //
+    // Service each socket
+    //
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            pnode->AddRef();
+    }
+    BOOST_FOREACH(CNode* pnode, vNodesCopy)
+    {
+        if (interruptNet)
+            return;
 
         //
-        // Accept new connections
+        // Receive
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        bool recvSet = false;
+        bool sendSet = false;
+        bool errorSet = false;
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            recvSet = recv_set.count(pnode->hSocket) > 0;
+            sendSet = send_set.count(pnode->hSocket) > 0;
+            errorSet = error_set.count(pnode->hSocket) > 0;
         }
+        if (recvSet || errorSet)
+            ReceiveFromNode(pnode);
 
         //
-        // Service each socket
+        // Send
         //
-        std::vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef();
-        }
+        if (sendSet)
+            SendToNode(pnode);
+
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
-        {
-            if (interruptNet)
-                return;
+            pnode->Release();
+    }
+}
 
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
+#ifdef USE_EPOLL
+void CConnman::ThreadSocketHandlerEpoll()
+{
+    // Nodes whose socket reported readable and has not been drained yet. Each
+    // entry holds a reference; with edge-triggered notification a node stays
+    // here until a short read shows its receive queue is empty.
+    std::vector<CNode*> vRecvReady;
+    std::vector<struct epoll_event> vEvents(SOCKET_MAX_EVENTS);
+    int64_t nNextHousekeeping = 0;
+
+    while (!interruptNet)
+    {
+        int64_t nNow = GetTimeMillis();
+        if (nNow >= nNextHousekeeping) {
+            DisconnectNodes();
+            NotifyNumConnectionsChanged();
+
+            std::vector<CNode*> vNodesCopy;
             {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                LOCK(cs_vNodes);
+                vNodesCopy = vNodes;
             }
-            if (recvSet || errorSet)
-            {
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = 0;
-                        {
-                            LOCK(pnode->cs_hSocket);
-                            if (pnode->hSocket == INVALID_SOCKET)
-                                continue;
-                            nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        }
-                        if (nBytes > 0)
-                        {
-                            bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                                pnode->CloseSocketDisconnect();
-                            RecordBytesRecv(nBytes);
-                            if (notify) {
-                                size_t nSizeAdded = 0;
-                                auto it(pnode->vRecvMsg.begin());
-                                for (; it != pnode->vRecvMsg.end(); ++it) {
-                                    if (!it->complete())
-                                        break;
-                                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                                }
-                                {
-                                    LOCK(pnode->cs_vProcessMsg);
-                                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                                    pnode->nProcessQueueSize += nSizeAdded;
-                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                                }
-                                WakeMessageHandler();
-                            }
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                InactivityCheck(pnode);
+            nNextHousekeeping = nNow + SOCKET_HOUSEKEEPING_INTERVAL;
+        }
+
+        // Only wait if no ready node can be served right now. A node is held
+        // back while its message queue is full or, as in the select() loop,
+        // while it still has unsent data, which keeps TCP flow control intact.
+        int nTimeout = std::max<int64_t>(nNextHousekeeping - nNow, 0);
+        BOOST_FOREACH(CNode* pnode, vRecvReady) {
+            if (pnode->fDisconnect || pnode->fPauseRecv)
+                continue;
+            LOCK(pnode->cs_vSend);
+            if (pnode->vSendMsg.empty()) {
+                nTimeout = 0;
+                break;
             }
+        }
 
-            //
-            // Send
-            //
-            if (sendSet)
-            {
-                LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes) {
-                    RecordBytesSent(nBytes);
-                }
+        int nEvents = epoll_wait(fdEpoll, vEvents.data(), vEvents.size(), nTimeout);
+        if (interruptNet)
+            break;
+        if (nEvents < 0) {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR) {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+                if (!interruptNet.sleep_for(std::chrono::milliseconds(SOCKET_HOUSEKEEPING_INTERVAL)))
+                    break;
             }
+            continue;
+        }
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
+        for (int i = 0; i < nEvents; i++) {
+            const struct epoll_event& event = vEvents[i];
+            if (event.data.ptr == NULL) {
+                // Wakeup; reading resets the eventfd counter
+                uint64_t nCount;
+                while (read(fdWakeRead, &nCount, sizeof(nCount)) > 0) {}
+                continue;
+            }
+
+            bool fListen = false;
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+                if (event.data.ptr == &hListenSocket) {
+                    AcceptConnection(hListenSocket);
+                    fListen = true;
+                    break;
                 }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+            }
+            if (fListen)
+                continue;
+
+            // Nodes are only deleted by this thread, after their socket is closed
+            // and thus removed from the epoll set, so the pointer is still valid.
+            CNode* pnode = static_cast<CNode*>(event.data.ptr);
+            if ((event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !pnode->fRecvReady) {
+                pnode->fRecvReady = true;
+                pnode->AddRef();
+                vRecvReady.push_back(pnode);
+            }
+            if (event.events & EPOLLOUT)
+                SendToNode(pnode);
+        }
+
+        // Receive from each ready node once per pass, round-robin, so a fast
+        // peer cannot starve the others.
+        size_t nKeep = 0;
+        for (size_t i = 0; i < vRecvReady.size(); i++) {
+            CNode* pnode = vRecvReady[i];
+            bool fReady = false;
+            if (interruptNet || pnode->fDisconnect) {
+                fReady = false;
+            } else if (pnode->fPauseRecv) {
+                fReady = true;
+            } else {
+                bool fSendPending;
                 {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
+                    LOCK(pnode->cs_vSend);
+                    fSendPending = !pnode->vSendMsg.empty();
                 }
+                fReady = fSendPending || ReceiveFromNode(pnode);
             }
-        }
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (fReady) {
+                vRecvReady[nKeep++] = pnode;
+            } else {
+                pnode->fRecvReady = false;
                 pnode->Release();
+            }
         }
+        vRecvReady.resize(nKeep);
+    }
+
+    BOOST_FOREACH(CNode* pnode, vRecvReady) {
+        pnode->fRecvReady = false;
+        pnode->Release();
     }
 }
+#endif
+
+void CConnman::ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (fdEpoll != -1) {
+        ThreadSocketHandlerEpoll();
+        return;
+    }
+#endif
+    while (!interruptNet)
+    {
+        DisconnectNodes();
+        NotifyNumConnectionsChanged();
+        SocketHandler();
+    }
+}
+
+void CConnman::WakeSocketHandler()
+{
+#ifdef USE_POLL
+    if (fdWakeWrite == -1)
+        return;
+    uint64_t nOne = 1;
+    if (write(fdWakeWrite, &nOne, sizeof(nOne)) < 0) {
+        // The wakeup is already pending if the eventfd counter or pipe is full
+    }
+#endif
+}
 
 void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        std::fill(vfMsgProcWake.begin(), vfMsgProcWake.end(), true);
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
+}
+
+void CConnman::WakeMessageHandler(const CNode* pnode)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexMsgProc);
+        if (vfMsgProcWake.empty())
+            return;
+        vfMsgProcWake[pnode->GetId() % vfMsgProcWake.size()] = true;
+    }
+    condMsgProc.notify_all();
 }
 
 static std::string GetDNSHost(const CDNSSeedData& data, ServiceFlags* requiredServiceBits)
@@ -1782,20 +2215,23 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    RegisterNodeSocket(pnode);
 
     return true;
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->GetId() % nMessageHandlerThreads != nThread)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -1829,9 +2265,9 @@ void CConnman::ThreadMessageHandler()
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, nThread] { return vfMsgProcWake[nThread]; });
         }
-        fMsgProcWake = false;
+        vfMsgProcWake[nThread] = false;
     }
 }
 
@@ -2016,8 +2452,10 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     setBannedIsDirty = false;
     fAddressesInitialized = false;
     nLastNodeId = 0;
+    nPrevNodeCount = 0;
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
+    nMessageHandlerThreads = 1;
     semOutbound = NULL;
     semAddnode = NULL;
     nMaxConnections = 0;
@@ -2026,6 +2464,11 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+#ifdef USE_POLL
+    fdEpoll = -1;
+    fdWakeRead = -1;
+    fdWakeWrite = -1;
+#endif
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2049,6 +2492,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nReceiveFloodSize;
+    nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS));
 
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -2111,8 +2555,49 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        vfMsgProcWake.assign(nMessageHandlerThreads, false);
+    }
+
+#ifdef USE_POLL
+    if (fdWakeRead == -1) {
+#ifdef USE_EPOLL
+        fdWakeRead = fdWakeWrite = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+        int fds[2];
+        if (pipe(fds) == 0) {
+            fdWakeRead = fds[0];
+            fdWakeWrite = fds[1];
+            fcntl(fdWakeRead, F_SETFL, O_NONBLOCK);
+            fcntl(fdWakeWrite, F_SETFL, O_NONBLOCK);
+        }
+#endif
+        if (fdWakeRead == -1) {
+            strNodeError = strprintf("Creating the socket handler wakeup descriptor failed: %s", NetworkErrorString(WSAGetLastError()));
+            return false;
+        }
+    }
+#endif
+#ifdef USE_EPOLL
+    if (fdEpoll == -1) {
+        fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+        bool fEpollOk = fdEpoll != -1;
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        fEpollOk = fEpollOk && epoll_ctl(fdEpoll, EPOLL_CTL_ADD, fdWakeRead, &event) == 0;
+        // Listening sockets stay level-triggered: one connection is accepted per event
+        BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket) {
+            event.data.ptr = &hListenSocket;
+            fEpollOk = fEpollOk && epoll_ctl(fdEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) == 0;
+        }
+        if (!fEpollOk) {
+            LogPrintf("epoll unavailable (%s), falling back to poll\n", NetworkErrorString(WSAGetLastError()));
+            if (fdEpoll != -1)
+                close(fdEpoll);
+            fdEpoll = -1;
+        }
     }
+#endif
 
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
@@ -2130,7 +2615,8 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadMessageHandlers.push_back(std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i))));
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
@@ -2163,6 +2649,7 @@ void CConnman::Interrupt()
 
     interruptNet();
     InterruptSocks5(true);
+    WakeSocketHandler();
 
     if (semOutbound)
         for (int i=0; i<(nMaxOutbound + nMaxFeeler); i++)
@@ -2171,8 +2658,10 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    BOOST_FOREACH(std::thread& threadMessageHandler, threadMessageHandlers)
+        if (threadMessageHandler.joinable())
+            threadMessageHandler.join();
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2210,6 +2699,18 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    if (fdEpoll != -1)
+        close(fdEpoll);
+    fdEpoll = -1;
+#endif
+#ifdef USE_POLL
+    if (fdWakeRead != -1)
+        close(fdWakeRead);
+    if (fdWakeWrite != -1 && fdWakeWrite != fdWakeRead)
+        close(fdWakeWrite);
+    fdWakeRead = fdWakeWrite = -1;
+#endif
     delete semOutbound;
     semOutbound = NULL;
     delete semAddnode;
@@ -2257,9 +2758,24 @@ void CConnman::AddNewAddresses(const std::vector<CAddress>& vAddr, const CAddres
     addrman.Add(vAddr, addrFrom, nTimePenalty);
 }
 
-std::vector<CAddress> CConnman::GetAddresses()
+std::vector<CAddress> CConnman::GetAddresses(const CNode* pfrom)
 {
-    return addrman.GetAddr();
+    // Serve getaddr from a periodically refreshed sample, so that each
+    // request neither shuffles addrman under its lock nor reveals a fresh
+    // part of it to peers that reconnect to scrape our table. Each network
+    // and local address gets its own sample, so the same answer can't link
+    // e.g. our onion service to our clearnet address.
+    std::vector<unsigned char> vchBind = pfrom->addrBind.GetKey();
+    uint64_t nCacheId = GetDeterministicRandomizer(RANDOMIZER_ID_ADDRCACHE).Write(pfrom->addr.GetNetwork()).Write(vchBind.data(), vchBind.size()).Finalize();
+    int64_t nNow = GetTime();
+    LOCK(cs_mapAddrResponseCache);
+    CAddrResponseCache& cache = mapAddrResponseCache[nCacheId];
+    // An empty sample (e.g. taken before addrman was loaded) is not kept
+    if (nNow >= cache.nExpiry || cache.vAddr.empty()) {
+        cache.vAddr = addrman.GetAddr();
+        cache.nExpiry = nNow + AVG_ADDR_RESPONSE_CACHE_INTERVAL / 2 + GetRand(AVG_ADDR_RESPONSE_CACHE_INTERVAL);
+    }
+    return cache.vAddr;
 }
 
 bool CConnman::AddNode(const std::string& strNode)
@@ -2459,9 +2975,10 @@ int CConnman::GetBestHeight() const
 unsigned int CConnman::GetReceiveFloodSize() const { return nReceiveFloodSize; }
 unsigned int CConnman::GetSendBufferSize() const{ return nSendBufferMaxSize; }
 
-CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const std::string& addrNameIn, bool fInboundIn) :
+CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const std::string& addrNameIn, bool fInboundIn, const CAddress& addrBindIn) :
     nTimeConnected(GetSystemTimeInSeconds()),
     addr(addrIn),
+    addrBind(addrBindIn),
     fInbound(fInboundIn),
     id(idIn),
     nKeyedNetGroup(nKeyedNetGroupIn),
@@ -2492,8 +3009,6 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     fSuccessfullyConnected = false;
     fDisconnect = false;
     nRefCount = 0;
-    nSendSize = 0;
-    nSendOffset = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -2518,7 +3033,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fRecvReady = false;
     nProcessQueueSize = 0;
+    nRecvBufferSize = 0;
 
     BOOST_FOREACH(const std::string &msg, getAllNetMessageTypes())
         mapRecvBytesPerMsgCmd[msg] = 0;
@@ -2577,20 +3094,162 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+static const int64_t SEND_PRIORITY_WEIGHT[SEND_PRIORITY_COUNT] = {8, 4, 1};
+
+const char* GetSendPriorityName(int nPriority)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
+    switch (nPriority) {
+    case SEND_PRIORITY_BLOCK: return "block";
+    case SEND_PRIORITY_HEADERS: return "headers";
+    default: return "other";
+    }
+}
+
+static SendPriority GetSendPriority(const std::string& command)
+{
+    if (command == NetMsgType::CMPCTBLOCK || command == NetMsgType::BLOCKTXN)
+        return SEND_PRIORITY_BLOCK;
+    if (command == NetMsgType::HEADERS)
+        return SEND_PRIORITY_HEADERS;
+    return SEND_PRIORITY_NORMAL;
+}
 
+CSharedNetMsg::CSharedNetMsg(CSerializedNetMsg&& msg) : command(std::move(msg.command)), priority(GetSendPriority(command))
+{
+    size_t nMessageSize = msg.data.size();
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
     uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    CMessageHeader hdr(Params().MessageStart(), command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
+    header = std::make_shared<const std::vector<unsigned char>>(std::move(serializedHeader));
+    if (nMessageSize)
+        payload = std::make_shared<const std::vector<unsigned char>>(std::move(msg.data));
+}
+
+CSendQueue::CSendQueue() : nCurrent(-1), nOffset(0), nSize(0)
+{
+    for (int i = 0; i < SEND_PRIORITY_COUNT; i++) {
+        nDeficit[i] = 0;
+        stats[i].nMessages = 0;
+        stats[i].nWaitTotal = 0;
+        stats[i].nWaitMax = 0;
+    }
+}
+
+void CSendQueue::Push(SendPriority priority, const CSendBufferRef& header, const CSendBufferRef& payload, int64_t nNow)
+{
+    std::deque<Entry>& queue = vQueue[priority];
+    if (queue.empty())
+        nDeficit[priority] = SEND_PRIORITY_WEIGHT[priority] * (int64_t)SEND_QUEUE_QUANTUM;
+    queue.push_back(Entry{header, payload, nNow});
+    nSize += queue.back().size();
+}
+
+int CSendQueue::Pick(const size_t* pnTaken, int64_t* pnDeficit) const
+{
+    for (int nPass = 0; nPass < 2; nPass++) {
+        int64_t nRounds = 0;
+        for (int i = 0; i < SEND_PRIORITY_COUNT; i++) {
+            if (pnTaken[i] == vQueue[i].size())
+                continue;
+            if (pnDeficit[i] > 0) {
+                pnDeficit[i] -= vQueue[i][pnTaken[i]].size();
+                return i;
+            }
+            // Rounds of credit until this class may send again
+            int64_t nCredit = SEND_PRIORITY_WEIGHT[i] * (int64_t)SEND_QUEUE_QUANTUM;
+            int64_t n = (nCredit - pnDeficit[i]) / nCredit;
+            if (nRounds == 0 || n < nRounds)
+                nRounds = n;
+        }
+        if (nRounds == 0)
+            return -1;
+        // Nobody has credit left: run as many rounds as it takes for someone to have some
+        for (int i = 0; i < SEND_PRIORITY_COUNT; i++) {
+            if (pnTaken[i] < vQueue[i].size())
+                pnDeficit[i] += nRounds * SEND_PRIORITY_WEIGHT[i] * (int64_t)SEND_QUEUE_QUANTUM;
+        }
+    }
+    assert(false);
+    return -1;
+}
+
+void CSendQueue::AddBuffers(const Entry& entry, size_t nSkip, std::vector<Buffer>& vBuffers, size_t nMaxBuffers)
+{
+    const std::vector<unsigned char>& header = *entry.header;
+    if (nSkip < header.size()) {
+        vBuffers.push_back(Buffer(header.data() + nSkip, header.size() - nSkip));
+        nSkip = 0;
+    } else {
+        nSkip -= header.size();
+    }
+    if (entry.payload && vBuffers.size() < nMaxBuffers)
+        vBuffers.push_back(Buffer(entry.payload->data() + nSkip, entry.payload->size() - nSkip));
+}
+
+void CSendQueue::GetSendBuffers(std::vector<Buffer>& vBuffers, size_t nMaxBuffers) const
+{
+    vBuffers.clear();
+    size_t nTaken[SEND_PRIORITY_COUNT] = {};
+    int64_t nCredit[SEND_PRIORITY_COUNT];
+    std::copy(nDeficit, nDeficit + SEND_PRIORITY_COUNT, nCredit);
+    if (nCurrent != -1) {
+        AddBuffers(vQueue[nCurrent].front(), nOffset, vBuffers, nMaxBuffers);
+        nTaken[nCurrent] = 1;
+    }
+    while (vBuffers.size() < nMaxBuffers) {
+        int nPriority = Pick(nTaken, nCredit);
+        if (nPriority == -1)
+            break;
+        AddBuffers(vQueue[nPriority][nTaken[nPriority]++], 0, vBuffers, nMaxBuffers);
+    }
+}
+
+void CSendQueue::Consume(size_t nBytes, int64_t nNow)
+{
+    // Replays the picks GetSendBuffers made, this time on the real credit
+    while (nBytes > 0) {
+        if (nCurrent == -1) {
+            size_t nTaken[SEND_PRIORITY_COUNT] = {};
+            nCurrent = Pick(nTaken, nDeficit);
+            assert(nCurrent != -1);
+            nOffset = 0;
+        }
+        std::deque<Entry>& queue = vQueue[nCurrent];
+        size_t nRemaining = queue.front().size() - nOffset;
+        if (nBytes < nRemaining) {
+            nOffset += nBytes;
+            nSize -= nBytes;
+            break;
+        }
+        nBytes -= nRemaining;
+        nSize -= nRemaining;
+        ClassStats& classStats = stats[nCurrent];
+        int64_t nWait = nNow - queue.front().nTimeQueued;
+        classStats.nMessages++;
+        classStats.nWaitTotal += nWait;
+        classStats.nWaitMax = std::max(classStats.nWaitMax, nWait);
+        queue.pop_front();
+        nCurrent = -1;
+        nOffset = 0;
+    }
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, CSharedNetMsg(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsg& msg)
+{
+    size_t nMessageSize = msg.payload ? msg.payload->size() : 0;
+    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
+    LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
+
     size_t nBytesSent = 0;
     {
         LOCK(pnode->cs_vSend);
@@ -2598,17 +3257,18 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         //log total amount of bytes per command
         pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
-        pnode->nSendSize += nTotalSize;
+        pnode->vSendMsg.Push(msg.priority, msg.header, msg.payload, GetTimeMicros());
 
-        if (pnode->nSendSize > nSendBufferMaxSize)
+        if (pnode->vSendMsg.size() > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
 
         // If write queue empty, attempt "optimistic write"
-        if (optimisticSend == true)
+        if (optimisticSend == true) {
             nBytesSent = SocketSendData(pnode);
+            // Let a level-triggered socket handler start watching for writability
+            if (!pnode->vSendMsg.empty())
+                WakeSocketHandler();
+        }
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
@@ -16,12 +16,15 @@
 #include "protocol.h"
 #include "random.h"
 #include "streams.h"
+#include "subnettrie.h"
 #include "sync.h"
 #include "uint256.h"
 #include "threadinterrupt.h"
 
 #include <atomic>
 #include <deque>
+#include <map>
+#include <set>
 #include <stdint.h>
 #include <thread>
 #include <memory>
@@ -53,6 +56,8 @@ static const int FEELER_INTERVAL = 120;
 static const unsigned int MAX_INV_SZ = 50000;
 /** The maximum number of new addresses to accumulate before announcing. */
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
+/** Average seconds a getaddr response is reused before addrman is sampled again */
+static const int64_t AVG_ADDR_RESPONSE_CACHE_INTERVAL = 3 * 60 * 60;
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
 /** Maximum length of strSubVer in `version` message */
@@ -61,6 +66,14 @@ static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 static const int MAX_OUTBOUND_CONNECTIONS = 8;
 /** Maximum number of addnode outgoing nodes */
 static const int MAX_ADDNODE_CONNECTIONS = 8;
+/** Interval (in milliseconds) at which the socket handler checks for disconnected and inactive nodes */
+static const int64_t SOCKET_HOUSEKEEPING_INTERVAL = 100;
+/** Maximum number of readiness events taken from epoll per wait */
+static const int SOCKET_MAX_EVENTS = 256;
+/** -msghandlerthreads default */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** The maximum number of entries in mapAskFor */
@@ -79,6 +92,8 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Bytes of send credit per unit of class weight in a peer's send queue */
+static const size_t SEND_QUEUE_QUANTUM = 16 * 1024;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
@@ -112,6 +127,90 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/** An immutable chunk of bytes queued for sending; one chunk may be queued for many peers */
+typedef std::shared_ptr<const std::vector<unsigned char>> CSendBufferRef;
+
+/** Send queue classes, in the order they are served */
+enum SendPriority {
+    SEND_PRIORITY_BLOCK = 0, //!< cmpctblock and blocktxn, which hold up block propagation
+    SEND_PRIORITY_HEADERS,   //!< headers
+    SEND_PRIORITY_NORMAL,    //!< transactions, full blocks, getdata responses and everything else
+    SEND_PRIORITY_COUNT
+};
+
+/** Name of a send queue class, for statistics */
+const char* GetSendPriorityName(int nPriority);
+
+/**
+ * A message with its header already built. Header and payload are shared
+ * buffers, so a message relayed to many peers is serialized only once.
+ */
+struct CSharedNetMsg
+{
+    explicit CSharedNetMsg(CSerializedNetMsg&& msg);
+
+    CSendBufferRef header;
+    CSendBufferRef payload; //!< NULL if the message has no payload
+    std::string command;
+    SendPriority priority;
+};
+
+/**
+ * Per-peer queue of messages waiting to be sent, one FIFO per priority class.
+ *
+ * Whole messages are drained by deficit round robin: a class that becomes
+ * non-empty is granted its weight in SEND_QUEUE_QUANTUM bytes of credit, the
+ * highest class with credit left sends next, and every message is charged
+ * its size. Block messages thus overtake queued transactions, while a steady
+ * stream of them still leaves the lower classes a share of the link.
+ * Requires the owner's lock.
+ */
+class CSendQueue
+{
+public:
+    /** Time messages of one class spent queued until fully handed to the socket */
+    struct ClassStats {
+        uint64_t nMessages;
+        int64_t nWaitTotal; //!< microseconds
+        int64_t nWaitMax;   //!< microseconds
+    };
+    typedef std::pair<const unsigned char*, size_t> Buffer;
+
+private:
+    struct Entry {
+        CSendBufferRef header;
+        CSendBufferRef payload;
+        int64_t nTimeQueued;
+        size_t size() const { return header->size() + (payload ? payload->size() : 0); }
+    };
+
+    std::deque<Entry> vQueue[SEND_PRIORITY_COUNT];
+    int64_t nDeficit[SEND_PRIORITY_COUNT];
+    ClassStats stats[SEND_PRIORITY_COUNT];
+    //! Class of the message at the front of which nOffset bytes are sent, or -1
+    int nCurrent;
+    size_t nOffset;
+    size_t nSize;
+
+    /** Pick the class to send next, given how many messages of each are already taken; charges the deficit */
+    int Pick(const size_t* pnTaken, int64_t* pnDeficit) const;
+    static void AddBuffers(const Entry& entry, size_t nSkip, std::vector<Buffer>& vBuffers, size_t nMaxBuffers);
+
+public:
+    CSendQueue();
+
+    bool empty() const { return nSize == 0; }
+    /** Bytes queued and not yet sent */
+    size_t size() const { return nSize; }
+    const ClassStats& GetStats(int nPriority) const { return stats[nPriority]; }
+
+    void Push(SendPriority priority, const CSendBufferRef& header, const CSendBufferRef& payload, int64_t nNow);
+    /** Up to nMaxBuffers unsent buffers, in the order they will be sent */
+    void GetSendBuffers(std::vector<Buffer>& vBuffers, size_t nMaxBuffers) const;
+    /** Drop nBytes that were sent from the front of GetSendBuffers' order */
+    void Consume(size_t nBytes, int64_t nNow);
+};
+
 
 class CConnman
 {
@@ -138,6 +237,7 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        int nMessageHandlerThreads = 1;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -153,6 +253,7 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsg& msg);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -202,7 +303,7 @@ public:
     void MarkAddressGood(const CAddress& addr);
     void AddNewAddress(const CAddress& addr, const CAddress& addrFrom, int64_t nTimePenalty = 0);
     void AddNewAddresses(const std::vector<CAddress>& vAddr, const CAddress& addrFrom, int64_t nTimePenalty = 0);
-    std::vector<CAddress> GetAddresses();
+    std::vector<CAddress> GetAddresses(const CNode* pfrom);
     void AddressCurrentlyConnected(const CService& addr);
 
     // Denial-of-service detection/prevention
@@ -221,6 +322,8 @@ public:
     // new code.
     void Ban(const CNetAddr& netAddr, const BanReason& reason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
     void Ban(const CSubNet& subNet, const BanReason& reason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
+    //! Ban many subnets at once; returns how many were added or had their ban extended
+    size_t Ban(const std::vector<CSubNet>& vSubNets, const BanReason& reason, int64_t bantimeoffset = 0, bool sinceUnixEpoch = false);
     void ClearBanned(); // needed for unit testing
     bool IsBanned(CNetAddr ip);
     bool IsBanned(CSubNet subnet);
@@ -278,7 +381,12 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake every message handler thread */
     void WakeMessageHandler();
+    /** Wake the message handler thread that processes pnode's messages */
+    void WakeMessageHandler(const CNode* pnode);
+    /** Interrupt the socket handler's wait, e.g. after a node's receive side was unpaused */
+    void WakeSocketHandler();
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -290,8 +398,20 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void RegisterNodeSocket(CNode* pnode);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged();
+    void InactivityCheck(CNode* pnode);
+    bool ReceiveFromNode(CNode* pnode);
+    void SendToNode(CNode* pnode);
+    bool GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    void SocketHandler();
+#ifdef USE_EPOLL
+    void ThreadSocketHandlerEpoll();
+#endif
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -317,6 +437,12 @@ private:
     void SetBannedSetDirty(bool dirty=true);
     //!clean unused entries (if bantime has expired)
     void SweepBanned();
+    //!add or extend a ban in setBanned and its indexes, requires cs_setBanned
+    bool AddBanned(const CSubNet& subNet, const CBanEntry& banEntry);
+    //!rebuild the indexes of setBanned, requires cs_setBanned
+    void IndexBanned();
+    //!disconnect the nodes that are now banned
+    void DisconnectBanned();
     void DumpAddresses();
     void DumpData();
     void DumpBanlist();
@@ -342,7 +468,7 @@ private:
 
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
-    std::vector<CSubNet> vWhitelistedRange;
+    CSubNetTrie<bool> whitelistedRange;
     CCriticalSection cs_vWhitelistedRange;
 
     unsigned int nSendBufferMaxSize;
@@ -351,10 +477,22 @@ private:
     std::vector<ListenSocket> vhListenSocket;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
+    //! setBanned by subnet prefix, with each entry's nBanUntil
+    CSubNetTrie<int64_t> banTrie;
+    //! setBanned ordered by expiry, so that SweepBanned only visits expired entries
+    std::set<std::pair<int64_t, CSubNet> > setBanExpiry;
     CCriticalSection cs_setBanned;
     bool setBannedIsDirty;
     bool fAddressesInitialized;
     CAddrMan addrman;
+    struct CAddrResponseCache {
+        std::vector<CAddress> vAddr;
+        int64_t nExpiry;
+        CAddrResponseCache() : nExpiry(0) {}
+    };
+    //! getaddr responses by the network and local address they are asked through
+    std::map<uint64_t, CAddrResponseCache> mapAddrResponseCache;
+    CCriticalSection cs_mapAddrResponseCache;
     std::deque<std::string> vOneShots;
     CCriticalSection cs_vOneShots;
     std::vector<std::string> vAddedNodes;
@@ -363,6 +501,7 @@ private:
     std::list<CNode*> vNodesDisconnected;
     mutable CCriticalSection cs_vNodes;
     std::atomic<NodeId> nLastNodeId;
+    unsigned int nPrevNodeCount;
 
     /** Services this instance offers */
     ServiceFlags nLocalServices;
@@ -382,8 +521,13 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /**
+     * Peers are spread over the message handler threads by id, so all
+     * messages of one peer are processed by the same thread, in order.
+     */
+    int nMessageHandlerThreads;
+    /** flags for waking the message processor, one per thread. */
+    std::vector<bool> vfMsgProcWake;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -391,11 +535,18 @@ private:
 
     CThreadInterrupt interruptNet;
 
+#ifdef USE_POLL
+    /** Descriptors the socket handler waits on: an epoll instance (if available) and a wakeup eventfd or pipe */
+    int fdEpoll;
+    int fdWakeRead;
+    int fdWakeWrite;
+#endif
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -492,8 +643,10 @@ public:
     int nStartingHeight;
     uint64_t nSendBytes;
     mapMsgCmdSize mapSendBytesPerMsgCmd;
+    CSendQueue::ClassStats sendQueueStats[SEND_PRIORITY_COUNT];
     uint64_t nRecvBytes;
     mapMsgCmdSize mapRecvBytesPerMsgCmd;
+    uint64_t nRecvBufferSize;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -509,10 +662,11 @@ class CNetMessage {
 private:
     mutable CHash256 hasher;
     mutable uint256 data_hash;
+    size_t nBufferSize;             // capacity of the pooled buffer behind vRecv
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
@@ -521,13 +675,18 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
+        nBufferSize = 0;
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
+    ~CNetMessage();
+
+    // The payload buffer is returned to a shared pool on destruction
+    CNetMessage(const CNetMessage&) = delete;
+    CNetMessage& operator=(const CNetMessage&) = delete;
 
     bool complete() const
     {
@@ -538,9 +697,13 @@ public:
 
     const uint256& GetMessageHash() const;
 
+    size_t GetBufferSize() const
+    {
+        return nBufferSize;
+    }
+
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -558,10 +721,8 @@ public:
     std::atomic<ServiceFlags> nServices;
     ServiceFlags nServicesExpected;
     SOCKET hSocket;
-    size_t nSendSize; // total size of all vSendMsg entries
-    size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    CSendQueue vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -569,6 +730,8 @@ public:
     CCriticalSection cs_vProcessMsg;
     std::list<CNetMessage> vProcessMsg;
     size_t nProcessQueueSize;
+    // bytes of receive buffers held by incomplete and unprocessed messages
+    std::atomic<size_t> nRecvBufferSize;
 
     CCriticalSection cs_sendProcessing;
 
@@ -581,6 +744,8 @@ public:
     const int64_t nTimeConnected;
     std::atomic<int64_t> nTimeOffset;
     const CAddress addr;
+    // Local address the connection is bound to, if known
+    const CAddress addrBind;
     std::atomic<int> nVersion;
     // strSubVer is whatever byte array we read from the wire. However, this field is intended
     // to be printed out, displayed to humans in various forms and so on. So we sanitize it and
@@ -621,6 +786,8 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // vAddrToSend and addrKnown are also written by the threads processing other peers
+    CCriticalSection cs_vAddrToSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -671,7 +838,7 @@ public:
     CAmount lastSentFeeFilter;
     int64_t nextSendTimeFeeFilter;
 
-    CNode(NodeId id, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress &addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const std::string &addrNameIn = "", bool fInboundIn = false);
+    CNode(NodeId id, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress &addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const std::string &addrNameIn = "", bool fInboundIn = false, const CAddress &addrBindIn = CAddress());
     ~CNode();
 
 private:
@@ -685,6 +852,7 @@ private:
     const int nMyStartingHeight;
     int nSendVersion;
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+    bool fRecvReady; // Socket may have unread data (edge-triggered); used only by SocketHandler thread
 
     mutable CCriticalSection cs_addrName;
     std::string addrName;
@@ -743,6 +911,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -751,6 +920,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.rand32() % vAddrToSend.size()] = _addr;
@@ -111,6 +111,11 @@ class CSubNet
 
         std::string ToString() const;
         bool IsValid() const;
+        /** The (masked) network address */
+        const CNetAddr& GetNetwork() const { return network; }
+        /** Number of leading one bits of the netmask over the whole 128-bit address (an IPv4 /24 gives 120),
+         *  or -1 if the netmask is not of the form 1{n}0{128-n} */
+        int GetPrefixLength() const;
 
         friend bool operator==(const CSubNet& a, const CSubNet& b);
         friend bool operator!=(const CSubNet& a, const CSubNet& b);
@@ -10,6 +10,7 @@
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "headerscache.h"
 #include "init.h"
 #include "validation.h"
 #include "merkleblock.h"
@@ -23,6 +24,7 @@
 #include "random.h"
 #include "tinyformat.h"
 #include "txmempool.h"
+#include "txreconciliation.h"
 #include "uinterface.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -68,6 +70,9 @@ namespace {
     /** Number of nodes with fSyncStarted. */
     int nSyncStarted = 0;
 
+    /** Number of outbound reconciling peers we still flood transactions to. Protected by cs_main. */
+    int nReconFloodOutbound = 0;
+
     /**
      * Sources of received blocks, saved to be able to send them reject
      * messages or ban them when processing happens afterwards. Protected by
@@ -106,6 +111,7 @@ namespace {
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
+        int64_t nTimeRequested;                                  //!< When we asked for it (in microseconds).
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -118,11 +124,17 @@ namespace {
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** Sum of the measured block download rates of all peers, in blocks per minute. */
+    int64_t nBlockDownloadRate = 0;
+
     /** Relay map, protected by cs_main. */
     typedef std::map<uint256, CTransactionRef> MapRelay;
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** The active chain's serialized headers and recent "headers" responses, protected by cs_main. */
+    CHeadersCache headersCache;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -143,6 +155,10 @@ struct CBlockReject {
  * by CNode's own locks. This simplifies asynchronous operation, where
  * processing of incoming data is done after the ProcessMessage call returns,
  * and we're no longer holding the node's locks.
+ *
+ * Fields that are only written while processing the peer's own messages
+ * (such as the compact block negotiation flags) may also be read without
+ * cs_main by that processing, as a peer is handled by one thread at a time.
  */
 struct CNodeState {
     //! The peer's address
@@ -176,6 +192,14 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time this peer takes to deliver one requested block (in microseconds), or 0.
+    int64_t nBlockTimeAvg;
+    //! Moving average of this peer's block download throughput in bytes per second.
+    int64_t nBlockBytesPerSec;
+    //! This peer's share of nBlockDownloadRate.
+    int64_t nBlocksPerMinute;
+    //! When we last received a requested block from this peer (in microseconds).
+    int64_t nLastBlockReceived;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -197,6 +221,13 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Whether we offered transaction reconciliation, and the salt we sent
+    bool fReconOffered;
+    uint64_t nReconSalt;
+    //! Reconciliation state, once both sides have offered it
+    std::unique_ptr<CTxReconciliationState> recon;
+    //! Whether transactions are still flooded to this reconciling peer
+    bool fReconFlood;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -212,6 +243,10 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockTimeAvg = 0;
+        nBlockBytesPerSec = 0;
+        nBlocksPerMinute = 0;
+        nLastBlockReceived = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
@@ -219,18 +254,72 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        fReconOffered = false;
+        nReconSalt = 0;
+        fReconFlood = false;
     }
 };
 
-/** Map maintaining per-node state. Requires cs_main. */
-std::map<NodeId, CNodeState> mapNodeState;
+/**
+ * Map maintaining per-node state, split into shards with their own locks so
+ * that looking a node up does not need cs_main. Entries never move and are
+ * only erased by FinalizeNode once nothing references the node any more, so
+ * a returned CNodeState stays valid while its CNode is held.
+ */
+class CNodeStateMap
+{
+private:
+    static const unsigned int SHARDS = 16;
 
-// Requires cs_main.
+    struct Shard {
+        CCriticalSection cs;
+        std::map<NodeId, CNodeState> map;
+    };
+    Shard shards[SHARDS];
+
+    Shard& GetShard(NodeId nodeid) { return shards[(unsigned int)nodeid % SHARDS]; }
+
+public:
+    CNodeState* Find(NodeId nodeid)
+    {
+        Shard& shard = GetShard(nodeid);
+        LOCK(shard.cs);
+        std::map<NodeId, CNodeState>::iterator it = shard.map.find(nodeid);
+        if (it == shard.map.end())
+            return NULL;
+        return &it->second;
+    }
+
+    void Emplace(NodeId nodeid, const CAddress& addr, std::string addrName)
+    {
+        Shard& shard = GetShard(nodeid);
+        LOCK(shard.cs);
+        shard.map.emplace(std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
+    }
+
+    void Erase(NodeId nodeid)
+    {
+        Shard& shard = GetShard(nodeid);
+        LOCK(shard.cs);
+        shard.map.erase(nodeid);
+    }
+
+    bool Empty()
+    {
+        for (unsigned int i = 0; i < SHARDS; i++) {
+            LOCK(shards[i].cs);
+            if (!shards[i].map.empty())
+                return false;
+        }
+        return true;
+    }
+};
+
+CNodeStateMap mapNodeState;
+
+// The returned state's fields require cs_main, unless noted otherwise.
 CNodeState *State(NodeId pnode) {
-    std::map<NodeId, CNodeState>::iterator it = mapNodeState.find(pnode);
-    if (it == mapNodeState.end())
-        return NULL;
-    return &it->second;
+    return mapNodeState.Find(pnode);
 }
 
 void UpdatePreferredDownload(CNode* node, CNodeState* state)
@@ -267,10 +356,7 @@ void InitializeNode(CNode *pnode, CConnman& connman) {
     CAddress addr = pnode->addr;
     std::string addrName = pnode->GetAddrName();
     NodeId nodeid = pnode->GetId();
-    {
-        LOCK(cs_main);
-        mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
-    }
+    mapNodeState.Emplace(nodeid, addr, std::move(addrName));
     if(!pnode->fInbound)
         PushNodeVersion(pnode, connman, GetTime());
 }
@@ -294,14 +380,18 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
+    nBlockDownloadRate -= state->nBlocksPerMinute;
+    nReconFloodOutbound -= state->fReconFlood;
 
-    mapNodeState.erase(nodeid);
+    mapNodeState.Erase(nodeid);
 
-    if (mapNodeState.empty()) {
+    if (mapNodeState.Empty()) {
         // Do a consistency check after the last peer is removed.
         assert(mapBlocksInFlight.empty());
         assert(nPreferredDownload == 0);
         assert(nPeersWithValidatedDownloads == 0);
+        assert(nBlockDownloadRate == 0);
+        assert(nReconFloodOutbound == 0);
     }
 }
 
@@ -348,7 +438,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL), GetTimeMicros()});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -364,6 +454,20 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     return true;
 }
 
+// Requires cs_main.
+// Fold a requested block the peer just delivered into its measured download rate.
+void UpdatePeerBlockDownloadRate(NodeId nodeid, const uint256& hash, size_t nBlockSize) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    UpdateBlockDownloadRate(state->nBlockTimeAvg, state->nBlockBytesPerSec, state->nLastBlockReceived,
+                            itInFlight->second.second->nTimeRequested, nBlockSize, GetTimeMicros());
+    nBlockDownloadRate -= state->nBlocksPerMinute;
+    state->nBlocksPerMinute = 60 * 1000000 / state->nBlockTimeAvg;
+    nBlockDownloadRate += state->nBlocksPerMinute;
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -468,7 +572,8 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
+ *  at most count entries. If the download window is held up by a block in flight from a much slower
+ *  peer, that block is added too, so it is fetched from this peer in parallel. */
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
     if (count == 0)
         return;
@@ -499,12 +604,13 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
     std::vector<const CBlockIndex*> vToFetch;
     const CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than the download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow(nBlockDownloadRate, fPruneMode);
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    const CBlockIndex* pindexWaiting = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -537,6 +643,16 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
                     // We reached the end of the window.
+                    if (waitingfor != -1 && waitingfor != nodeid && vBlocks.size() < count) {
+                        const QueuedBlock& queued = *mapBlocksInFlight[pindexWaiting->GetBlockHash()].second;
+                        if (ShouldRerequestBlock(queued.partialBlock != nullptr, queued.nTimeRequested,
+                                                 State(waitingfor)->nBlockTimeAvg, state->nBlockTimeAvg, GetTimeMicros())) {
+                            // Rather than wait for the slow peer, fetch the block holding up the window from this one too.
+                            LogPrint("net", "Re-requesting block %s held up by peer=%d from peer=%d\n", pindexWaiting->GetBlockHash().ToHexString(), waitingfor, nodeid);
+                            vBlocks.push_back(pindexWaiting);
+                            return;
+                        }
+                    }
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
@@ -550,6 +666,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaiting = pindex;
             }
         }
     }
@@ -557,6 +674,49 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
 } // anon namespace
 
+void UpdateBlockDownloadRate(int64_t& nBlockTimeAvg, int64_t& nBlockBytesPerSec, int64_t& nLastBlockReceived,
+                             int64_t nTimeRequested, size_t nBlockSize, int64_t nNow) {
+    // The peer could only start on this block once we asked for it and the previous one was through.
+    int64_t nTime = std::max<int64_t>(nNow - std::max(nTimeRequested, nLastBlockReceived), 1);
+    int64_t nBytesPerSec = (int64_t)nBlockSize * 1000000 / nTime;
+    nLastBlockReceived = nNow;
+    if (nBlockTimeAvg == 0) {
+        nBlockTimeAvg = nTime;
+        nBlockBytesPerSec = nBytesPerSec;
+    } else {
+        // Weigh each new sample 1/8, like TCP's smoothed round trip time.
+        nBlockTimeAvg += (nTime - nBlockTimeAvg) / 8;
+        nBlockBytesPerSec += (nBytesPerSec - nBlockBytesPerSec) / 8;
+    }
+}
+
+int GetBlocksInTransitLimit(int64_t nBlockTimeAvg, int64_t nPingUsec) {
+    if (nBlockTimeAvg == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    if (nPingUsec == std::numeric_limits<int64_t>::max())
+        nPingUsec = 0;
+    int64_t nLimit = (nPingUsec + BLOCK_DOWNLOAD_QUEUE_TIME * 1000000LL) / nBlockTimeAvg + 1;
+    return std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nLimit, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+int GetBlockDownloadWindow(int64_t nDownloadRate, bool fPrune) {
+    // Pruning nodes keep the smallest window, as disordered blocks keep files from being pruned.
+    if (fPrune)
+        return BLOCK_DOWNLOAD_WINDOW;
+    int64_t nWindow = nDownloadRate * BLOCK_DOWNLOAD_WINDOW_TIME / 60;
+    return std::max<int64_t>(BLOCK_DOWNLOAD_WINDOW, std::min<int64_t>(nWindow, MAX_BLOCK_DOWNLOAD_WINDOW));
+}
+
+bool ShouldRerequestBlock(bool fPartialBlock, int64_t nTimeRequested, int64_t nFromBlockTimeAvg, int64_t nToBlockTimeAvg, int64_t nNow) {
+    // Compact block reconstructions stay with the peer that sent the cmpctblock.
+    if (fPartialBlock || nToBlockTimeAvg == 0)
+        return false;
+    if (nNow - nTimeRequested < BLOCK_REREQUEST_TIMEOUT * 1000000LL)
+        return false;
+    // Only go around peers that are unmeasured or at least twice as slow, so blocks don't bounce between similar peers.
+    return nFromBlockTimeAvg == 0 || nFromBlockTimeAvg > 2 * nToBlockTimeAvg;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -565,6 +725,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     stats.nMisbehavior = state->nMisbehavior;
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.nBlockTimeAvg = state->nBlockTimeAvg;
+    stats.nBlockBytesPerSec = state->nBlockBytesPerSec;
     BOOST_FOREACH(const QueuedBlock& queue, state->vBlocksInFlight) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
@@ -776,10 +938,17 @@ static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 static uint256 most_recent_block_hash;
+//! Whether most_recent_block has been connected as the chain tip
+static bool most_recent_block_connected = false;
+//! Serialized messages for most_recent_block, built on first use and shared by all peers
+static std::shared_ptr<const CSharedNetMsg> most_recent_block_msg;
+static std::shared_ptr<const CSharedNetMsg> most_recent_block_msg_no_witness;
+static std::shared_ptr<const CSharedNetMsg> most_recent_compact_block_msg;
 
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::shared_ptr<const CSharedNetMsg> pcmpctblockmsg = std::make_shared<const CSharedNetMsg>(msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
 
     LOCK(cs_main);
 
@@ -796,10 +965,13 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         most_recent_block_hash = hashBlock;
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
+        most_recent_block_connected = false;
+        most_recent_block_msg.reset();
+        most_recent_block_msg_no_witness.reset();
+        most_recent_compact_block_msg = pcmpctblockmsg;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    connman->ForEachNode([this, &pcmpctblockmsg, pindex, fWitnessEnabled, &hashBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -811,7 +983,7 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToHexString(), pnode->id);
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, *pcmpctblockmsg);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -821,6 +993,11 @@ void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CB
     const int nNewHeight = pindexNew->nHeight;
     connman->SetBestHeight(nNewHeight);
 
+    {
+        LOCK(cs_most_recent_block);
+        most_recent_block_connected = most_recent_block && most_recent_block_hash == pindexNew->GetBlockHash();
+    }
+
     if (!fInitialDownload) {
         // Find the hashes of all blocks that weren't previously in the best chain.
         std::vector<uint256> vHashes;
@@ -965,8 +1142,66 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * Serve a request for the block that was just connected from memory, without
+ * cs_main, so relaying a new tip does not wait for other peers' validation.
+ * Returns false if the request has to go through the regular path.
+ */
+bool static ProcessGetBlockFromCache(CNode* pfrom, const CInv& inv, const Consensus::Params& consensusParams, CConnman& connman)
+{
+    if (inv.type != MSG_BLOCK && inv.type != MSG_CMPCT_BLOCK && inv.type != MSG_WITNESS_BLOCK)
+        return false;
+    // Answering these needs the chain
+    if (inv.hash == pfrom->hashContinue || (connman.OutboundTargetReached(true) && !pfrom->fWhitelisted))
+        return false;
+
+    std::shared_ptr<const CBlock> pblock;
+    std::shared_ptr<const CSharedNetMsg> pmsg;
+    bool fPeerWantsWitness = inv.type == MSG_CMPCT_BLOCK && State(pfrom->GetId())->fWantsCmpctWitness;
+    // Same staleness rule as CanDirectFetch, for a block that is the tip
+    bool fSendCompact = false;
+    {
+        LOCK(cs_most_recent_block);
+        if (!most_recent_block_connected || most_recent_block_hash != inv.hash)
+            return false;
+        pblock = most_recent_block;
+        fSendCompact = inv.type == MSG_CMPCT_BLOCK && pblock->GetBlockTime() > GetAdjustedTime() - consensusParams.nPowTargetSpacing * 20;
+        if (fSendCompact && fPeerWantsWitness)
+            pmsg = most_recent_compact_block_msg;
+        else if (!fSendCompact && (inv.type == MSG_WITNESS_BLOCK || fPeerWantsWitness))
+            pmsg = most_recent_block_msg;
+        else if (!fSendCompact)
+            pmsg = most_recent_block_msg_no_witness;
+    }
+
+    if (!pmsg) {
+        // Build the message once; later requests for this block reuse it
+        const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+        if (fSendCompact) {
+            pmsg = std::make_shared<const CSharedNetMsg>(msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(*pblock, false)));
+        } else {
+            bool fWitness = inv.type == MSG_WITNESS_BLOCK || fPeerWantsWitness;
+            pmsg = std::make_shared<const CSharedNetMsg>(msgMaker.Make(fWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
+            LOCK(cs_most_recent_block);
+            if (most_recent_block_hash == inv.hash)
+                (fWitness ? most_recent_block_msg : most_recent_block_msg_no_witness) = pmsg;
+        }
+    }
+    connman.PushMessage(pfrom, *pmsg);
+
+    // Track requests for our stuff.
+    GetMainSignals().Inventory(inv.hash);
+    return true;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
+    // Like below, at most one block is sent per call
+    if (!pfrom->vRecvGetData.empty() && !pfrom->fPauseSend && ProcessGetBlockFromCache(pfrom, pfrom->vRecvGetData.front(), consensusParams, connman)) {
+        pfrom->vRecvGetData.pop_front();
+        return;
+    }
+
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
@@ -1035,11 +1270,29 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
+                    // Send block from disk. A full block is sent as the bytes stored,
+                    // which are its encoding with witnesses, and also without them
+                    // if segwit was not yet active for it to contain any.
+                    bool fSendRaw;
+                    if (inv.type == MSG_CMPCT_BLOCK)
+                        fSendRaw = !(CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) &&
+                            (State(pfrom->GetId())->fWantsCmpctWitness || !IsWitnessEnabled(mi->second->pprev, consensusParams));
+                    else
+                        fSendRaw = inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_BLOCK && !IsWitnessEnabled(mi->second->pprev, consensusParams));
+                    std::vector<unsigned char> vchBlock;
+                    if (fSendRaw && !ReadRawBlockFromDisk(vchBlock, mi->second, Params().MessageStart()))
+                        fSendRaw = false;
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (!fSendRaw && !ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    if (fSendRaw)
+                    {
+                        CSerializedNetMsg msg;
+                        msg.command = NetMsgType::BLOCK;
+                        msg.data = std::move(vchBlock);
+                        connman.PushMessage(pfrom, std::move(msg));
+                    }
+                    else if (inv.type == MSG_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
@@ -1167,6 +1420,49 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+// Keep an announced transaction available for getdata. Requires cs_main.
+void static AddToRelayMap(const uint256& hash, CTransactionRef&& tx, int64_t nNow)
+{
+    // Expire old relay messages
+    while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
+    {
+        mapRelay.erase(vRelayExpiration.front().second);
+        vRelayExpiration.pop_front();
+    }
+
+    auto ret = mapRelay.insert(std::make_pair(hash, std::move(tx)));
+    if (ret.second) {
+        vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
+    }
+}
+
+// Announce transactions settled by a reconciliation round. Requires cs_main.
+void static AnnounceReconciledTxs(CNode* pto, const std::vector<uint256>& vTxids, CConnman& connman)
+{
+    if (vTxids.empty())
+        return;
+    const CNetMsgMaker msgMaker(pto->GetSendVersion());
+    int64_t nNow = GetTimeMicros();
+    std::vector<CInv> vInv;
+    LOCK(pto->cs_inventory);
+    BOOST_FOREACH(const uint256& hash, vTxids) {
+        if (pto->filterInventoryKnown.contains(hash))
+            continue;
+        auto txinfo = mempool.info(hash);
+        if (!txinfo.tx)
+            continue;
+        AddToRelayMap(hash, std::move(txinfo.tx), nNow);
+        pto->filterInventoryKnown.insert(hash);
+        vInv.push_back(CInv(MSG_TX, hash));
+        if (vInv.size() == MAX_INV_SZ) {
+            connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+            vInv.clear();
+        }
+    }
+    if (!vInv.empty())
+        connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1272,6 +1568,18 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         if (pfrom->fInbound)
             PushNodeVersion(pfrom, connman, GetAdjustedTime());
 
+        // Offer transaction reconciliation; it must come before verack
+        if (GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION_ENABLE) && ::fRelayTxes && fRelay) {
+            uint64_t nReconSalt = GetRand(std::numeric_limits<uint64_t>::max());
+            {
+                LOCK(cs_main);
+                CNodeState* state = State(pfrom->GetId());
+                state->fReconOffered = true;
+                state->nReconSalt = nReconSalt;
+            }
+            connman.PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::SENDRECON, TXRECONCILIATION_VERSION, nReconSalt));
+        }
+
         connman.PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::VERACK));
 
         pfrom->nServices = nServices;
@@ -1481,6 +1789,87 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     }
 
 
+    else if (strCommand == NetMsgType::SENDRECON)
+    {
+        uint32_t nReconVersion = 0;
+        uint64_t nRemoteSalt = 0;
+        vRecv >> nReconVersion >> nRemoteSalt;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        // Only valid before verack, and only if we offered it too
+        if (pfrom->fSuccessfullyConnected || !state->fReconOffered || state->recon || nReconVersion < 1)
+            return true;
+        state->recon.reset(new CTxReconciliationState(!pfrom->fInbound, state->nReconSalt, nRemoteSalt));
+        // Keep flooding to a few outbound peers so transactions still spread quickly
+        if (!pfrom->fInbound && nReconFloodOutbound < MAX_RECON_FLOOD_OUTBOUND) {
+            state->fReconFlood = true;
+            nReconFloodOutbound++;
+        }
+        LogPrint("net", "reconciling transactions with peer=%d%s\n", pfrom->id, state->fReconFlood ? " (flooding too)" : "");
+    }
+
+    else if (strCommand == NetMsgType::REQRECON)
+    {
+        uint16_t nRemoteSetSize = 0;
+        uint16_t nQ = 0;
+        vRecv >> nRemoteSetSize >> nQ;
+        LOCK(cs_main);
+        CNodeState* state = State(pfrom->GetId());
+        if (!state->recon || state->recon->IsInitiator()) {
+            LogPrint("net", "unexpected reqrecon from peer=%d\n", pfrom->id);
+            return true;
+        }
+        std::vector<uint256> vAnnounce;
+        std::vector<uint32_t> vSketch = state->recon->RespondToRequest(GetTime(), nRemoteSetSize, nQ, vAnnounce);
+        AnnounceReconciledTxs(pfrom, vAnnounce, connman);
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SKETCH, vSketch));
+    }
+
+    else if (strCommand == NetMsgType::SKETCH)
+    {
+        std::vector<uint32_t> vSketch;
+        vRecv >> vSketch;
+        LOCK(cs_main);
+        if (vSketch.size() > MAX_SKETCH_CAPACITY)
+        {
+            Misbehaving(pfrom->GetId(), 20);
+            return error("message sketch size() = %u", vSketch.size());
+        }
+        CNodeState* state = State(pfrom->GetId());
+        if (!state->recon || !state->recon->IsInitiator() || !state->recon->IsRoundInProgress()) {
+            LogPrint("net", "unexpected sketch from peer=%d\n", pfrom->id);
+            return true;
+        }
+        std::vector<uint256> vAnnounce;
+        std::vector<uint32_t> vAsk;
+        bool fSuccess = state->recon->ProcessSketch(vSketch, vAnnounce, vAsk);
+        LogPrint("net", "reconciliation with peer=%d %s: announcing %u, asking for %u\n", pfrom->id, fSuccess ? "succeeded" : "failed", vAnnounce.size(), vAsk.size());
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::RECONCILDIFF, fSuccess, vAsk));
+        AnnounceReconciledTxs(pfrom, vAnnounce, connman);
+    }
+
+    else if (strCommand == NetMsgType::RECONCILDIFF)
+    {
+        bool fSuccess = false;
+        std::vector<uint32_t> vAsk;
+        vRecv >> fSuccess >> vAsk;
+        LOCK(cs_main);
+        if (vAsk.size() > MAX_SKETCH_CAPACITY)
+        {
+            Misbehaving(pfrom->GetId(), 20);
+            return error("message reconcildiff size() = %u", vAsk.size());
+        }
+        CNodeState* state = State(pfrom->GetId());
+        if (!state->recon || state->recon->IsInitiator()) {
+            LogPrint("net", "unexpected reconcildiff from peer=%d\n", pfrom->id);
+            return true;
+        }
+        std::vector<uint256> vAnnounce;
+        state->recon->ProcessDiff(fSuccess, vAsk, vAnnounce);
+        AnnounceReconciledTxs(pfrom, vAnnounce, connman);
+    }
+
+
     else if (strCommand == NetMsgType::INV)
     {
         std::vector<CInv> vInv;
@@ -1498,15 +1887,35 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         if (pfrom->fWhitelisted && GetBoolArg("-whitelistrelay", DEFAULT_WHITELISTRELAY))
             fBlocksOnly = false;
 
+        // Bookkeeping first, without cs_main; only invs we might fetch are
+        // checked against the chain and mempool below.
+        std::vector<CInv> vInvCheck;
+        vInvCheck.reserve(vInv.size());
+        BOOST_FOREACH(const CInv& inv, vInv)
+        {
+            if (inv.type != MSG_BLOCK) {
+                pfrom->AddInventoryKnown(inv);
+                if (fBlocksOnly) {
+                    LogPrint("net", "transaction (%s) inv sent in violation of protocol peer=%d\n", inv.hash.ToHexString(), pfrom->id);
+                    GetMainSignals().Inventory(inv.hash);
+                    continue;
+                }
+            }
+            vInvCheck.push_back(inv);
+        }
+        if (vInvCheck.empty())
+            return true;
+
         LOCK(cs_main);
 
         uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
+        CNodeState* nodestate = State(pfrom->GetId());
 
         std::vector<CInv> vToFetch;
 
-        for (unsigned int nInv = 0; nInv < vInv.size(); nInv++)
+        for (unsigned int nInv = 0; nInv < vInvCheck.size(); nInv++)
         {
-            CInv &inv = vInv[nInv];
+            CInv &inv = vInvCheck[nInv];
 
             if (interruptMsgProc)
                 return true;
@@ -1516,6 +1925,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
             if (inv.type == MSG_TX) {
                 inv.type |= nFetchFlags;
+                // The peer has it, so it need not be reconciled
+                if (nodestate->recon)
+                    nodestate->recon->RemoveFromSet(inv.hash);
             }
 
             if (inv.type == MSG_BLOCK) {
@@ -1532,10 +1944,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             }
             else
             {
-                pfrom->AddInventoryKnown(inv);
-                if (fBlocksOnly)
-                    LogPrint("net", "transaction (%s) inv sent in violation of protocol peer=%d\n", inv.hash.ToHexString(), pfrom->id);
-                else if (!fAlreadyHave && !fImporting && !fReindex && !IsInitialBlockDownload())
+                if (!fAlreadyHave && !fImporting && !fReindex && !IsInitialBlockDownload())
                     pfrom->AskFor(inv);
             }
 
@@ -1711,6 +2120,22 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 pindex = chainActive.Next(pindex);
         }
 
+        if (pindex && chainActive.Contains(pindex))
+        {
+            // Answer with a slice of the active chain's serialized headers,
+            // ending at hashStop if that is on the chain and not below pindex
+            headersCache.Sync(chainActive);
+            int nEnd = std::min(pindex->nHeight + (int)MAX_HEADERS_RESULTS, chainActive.Height() + 1);
+            BlockMap::iterator mi = hashStop.IsNull() ? mapBlockIndex.end() : mapBlockIndex.find(hashStop);
+            if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second) && mi->second->nHeight >= pindex->nHeight)
+                nEnd = std::min(nEnd, mi->second->nHeight + 1);
+            LogPrint("net", "getheaders %d to %s from peer=%d\n", pindex->nHeight, hashStop.IsNull() ? "end" : hashStop.ToHexString(), pfrom->id);
+            // See below for why pindexBestHeaderSent is reset
+            nodestate->pindexBestHeaderSent = chainActive[nEnd - 1];
+            connman.PushMessage(pfrom, *headersCache.GetHeadersMsg(pindex->nHeight, nEnd - pindex->nHeight));
+            return true;
+        }
+
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
         std::vector<CBlock> vHeaders;
         int nLimit = MAX_HEADERS_RESULTS;
@@ -1781,8 +2206,11 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 tx.GetHash().ToHexString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
+            // Collect the orphan transactions that (recursively) depend on this one
+            // and submit them as one batch; the batch orders parents before children.
+            std::vector<CTransactionRef> vOrphans;
+            std::vector<int64_t> vOrphanPeers; // NodeIds, in the form AcceptToMemoryPoolBatch takes sources
+            std::set<uint256> setOrphansQueued;
             while (!vWorkQueue.empty()) {
                 auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
                 vWorkQueue.pop_front();
@@ -1793,49 +2221,63 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                      ++mi)
                 {
                     const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
+                    const uint256& orphanHash = porphanTx->GetHash();
+                    if (!setOrphansQueued.insert(orphanHash).second)
+                        continue;
+                    vOrphans.push_back(porphanTx);
+                    vOrphanPeers.push_back((*mi)->second.fromPeer);
+                    for (unsigned int i = 0; i < porphanTx->vout.size(); i++) {
+                        vWorkQueue.emplace_back(orphanHash, i);
+                    }
+                }
+            }
 
+            if (!vOrphans.empty()) {
+                // Use dummy CValidationStates so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                // The orphans of a peer that gave us an invalid one are left untried
+                // (reported as missing inputs) and stay in the orphan pool.
+                std::vector<CValidationState> vStateDummy;
+                std::vector<bool> vMissingInputs2;
+                AcceptToMemoryPoolBatch(mempool, vStateDummy, vMissingInputs2, vOrphans, std::vector<int64_t>(), true, &lRemovedTxn,
+                                        0, &vOrphanPeers);
+
+                std::set<NodeId> setMisbehaving;
+                for (size_t i = 0; i < vOrphans.size(); i++) {
+                    const CTransaction& orphanTx = *vOrphans[i];
+                    const uint256& orphanHash = orphanTx.GetHash();
+                    const CValidationState& stateDummy = vStateDummy[i];
+                    NodeId fromPeer = vOrphanPeers[i];
 
-                    if (setMisbehaving.count(fromPeer))
+                    if (vMissingInputs2[i])
                         continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
+                    if (stateDummy.IsValid()) {
                         LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToHexString());
                         RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
                         vEraseQueue.push_back(orphanHash);
+                        continue;
                     }
-                    else if (!fMissingInputs2)
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0 && !setMisbehaving.count(fromPeer))
                     {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToHexString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToHexString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToHexString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToHexString());
+                    vEraseQueue.push_back(orphanHash);
+                    if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                        // Do not use rejection cache for witness transactions or
+                        // witness-stripped transactions, as they can have been malleated.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanHash);
                     }
-                    mempool.check(pcoinsTip);
                 }
+                mempool.check(pcoinsTip);
             }
 
             BOOST_FOREACH(uint256 hash, vEraseQueue)
@@ -2337,6 +2779,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        size_t nBlockSize = vRecv.size();
         vRecv >> *pblock;
 
         LogPrint("net", "received block %s peer=%d\n", pblock->GetHash().ToHexString(), pfrom->id);
@@ -2351,6 +2794,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            UpdatePeerBlockDownloadRate(pfrom->GetId(), hash, nBlockSize);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2383,8 +2827,11 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
-        std::vector<CAddress> vAddr = connman.GetAddresses();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
+        std::vector<CAddress> vAddr = connman.GetAddresses(pfrom);
         FastRandomContext insecure_rand;
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr, insecure_rand);
@@ -2627,6 +3074,7 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             return false;
 
         std::list<CNetMessage> msgs;
+        bool fUnpaused;
         {
             LOCK(pfrom->cs_vProcessMsg);
             if (pfrom->vProcessMsg.empty())
@@ -2634,9 +3082,15 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             // Just take one message
             msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
             pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
+            pfrom->nRecvBufferSize -= msgs.front().GetBufferSize();
+            bool fWasPaused = pfrom->fPauseRecv;
             pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman.GetReceiveFloodSize();
+            fUnpaused = fWasPaused && !pfrom->fPauseRecv;
             fMoreWork = !pfrom->vProcessMsg.empty();
         }
+        // The socket handler does not poll paused nodes; tell it to resume reading
+        if (fUnpaused)
+            connman.WakeSocketHandler();
         CNetMessage& msg(msgs.front());
 
         msg.SetVersion(pfrom->GetRecvVersion());
@@ -2773,6 +3227,37 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             }
         }
 
+        //
+        // Message: addr
+        //
+        int64_t nNow = GetTimeMicros();
+        if (pto->nNextAddrSend < nNow) {
+            pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_vAddrToSend);
+            std::vector<CAddress> vAddr;
+            vAddr.reserve(pto->vAddrToSend.size());
+            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+            {
+                if (!pto->addrKnown.contains(addr.GetKey()))
+                {
+                    pto->addrKnown.insert(addr.GetKey());
+                    vAddr.push_back(addr);
+                    // receiver rejects addr messages larger than 1000
+                    if (vAddr.size() >= 1000)
+                    {
+                        connman.PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
+                        vAddr.clear();
+                    }
+                }
+            }
+            pto->vAddrToSend.clear();
+            if (!vAddr.empty())
+                connman.PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
+            // we only send the big addr message once
+            if (pto->vAddrToSend.capacity() > 40)
+                pto->vAddrToSend.shrink_to_fit();
+        }
+
         TRY_LOCK(cs_main, lockMain); // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
         if (!lockMain)
             return true;
@@ -2802,40 +3287,11 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         }
 
         // Address refresh broadcast
-        int64_t nNow = GetTimeMicros();
         if (!IsInitialBlockDownload() && pto->nNextLocalAddrSend < nNow) {
             AdvertiseLocal(pto);
             pto->nNextLocalAddrSend = PoissonNextSend(nNow, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
         }
 
-        //
-        // Message: addr
-        //
-        if (pto->nNextAddrSend < nNow) {
-            pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
-            std::vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
-            {
-                if (!pto->addrKnown.contains(addr.GetKey()))
-                {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
-                    {
-                        connman.PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-                        vAddr.clear();
-                    }
-                }
-            }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                connman.PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
-            // we only send the big addr message once
-            if (pto->vAddrToSend.capacity() > 40)
-                pto->vAddrToSend.shrink_to_fit();
-        }
 
         // Start block sync
         if (pindexBestHeader == NULL)
@@ -3117,22 +3573,13 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         continue;
                     }
                     if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
+                    // Leave it to the next reconciliation round, unless the set is full
+                    if (state.recon && !state.fReconFlood && state.recon->AddToSet(hash))
+                        continue;
                     // Send
                     vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
-                    {
-                        // Expire old relay messages
-                        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
-                        {
-                            mapRelay.erase(vRelayExpiration.front().second);
-                            vRelayExpiration.pop_front();
-                        }
-
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
-                        if (ret.second) {
-                            vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
-                        }
-                    }
+                    AddToRelayMap(hash, std::move(txinfo.tx), nNow);
                     if (vInv.size() == MAX_INV_SZ) {
                         connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
                         vInv.clear();
@@ -3144,6 +3591,20 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         if (!vInv.empty())
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
 
+        //
+        // Message: reqrecon
+        //
+        if (state.recon) {
+            int64_t nNowSeconds = nNow / 1000000;
+            std::vector<uint256> vAnnounce;
+            state.recon->CheckTimeout(nNowSeconds, vAnnounce);
+            AnnounceReconciledTxs(pto, vAnnounce, connman);
+            if (state.recon->ShouldRequest(nNowSeconds)) {
+                uint16_t nSetSize = state.recon->StartRound(nNowSeconds);
+                connman.PushMessage(pto, msgMaker.Make(NetMsgType::REQRECON, nSetSize, DEFAULT_RECON_Q));
+            }
+        }
+
         // Detect whether we're stalling
         nNow = GetTimeMicros();
         if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
@@ -3173,10 +3634,11 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nMaxBlocksInFlight = GetBlocksInTransitLimit(state.nBlockTimeAvg, pto->nMinPingUsecTime);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nMaxBlocksInFlight) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), nMaxBlocksInFlight - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -39,9 +39,29 @@ struct CNodeStateStats {
     int nMisbehavior;
     int nSyncHeight;
     int nCommonHeight;
+    int64_t nBlockTimeAvg;
+    int64_t nBlockBytesPerSec;
     std::vector<int> vHeightInFlight;
 };
 
+/**
+ * Block download pacing. Times are in microseconds; a peer's block time is
+ * the moving average of the time it takes to deliver one requested block, 0
+ * until measured.
+ */
+/** Fold a block of nBlockSize bytes, requested at nTimeRequested and received at nNow, into a peer's averages */
+void UpdateBlockDownloadRate(int64_t& nBlockTimeAvg, int64_t& nBlockBytesPerSec, int64_t& nLastBlockReceived,
+                             int64_t nTimeRequested, size_t nBlockSize, int64_t nNow);
+/** Number of blocks to keep requested from a peer: enough to last its ping time plus
+ *  BLOCK_DOWNLOAD_QUEUE_TIME at its block time, or the fixed default until that is known. */
+int GetBlocksInTransitLimit(int64_t nBlockTimeAvg, int64_t nPingUsec);
+/** The block download window: BLOCK_DOWNLOAD_WINDOW_TIME worth of the combined rate of our
+ *  peers, in blocks per minute, within bounds. */
+int GetBlockDownloadWindow(int64_t nDownloadRate, bool fPrune);
+/** Whether a block that holds up the download window, requested at nTimeRequested from a
+ *  peer with block time nFromBlockTimeAvg, should be requested from one with nToBlockTimeAvg as well. */
+bool ShouldRerequestBlock(bool fPartialBlock, int64_t nTimeRequested, int64_t nFromBlockTimeAvg, int64_t nToBlockTimeAvg, int64_t nNow);
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
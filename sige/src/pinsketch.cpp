@@ -0,0 +1,281 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pinsketch.h"
+
+#include <assert.h>
+
+namespace {
+
+typedef std::vector<uint32_t> Poly; // coefficients, lowest degree first
+
+// GF(2^32) is taken modulo x^32 + x^7 + x^3 + x^2 + 1
+const uint32_t FIELD_MODULUS = 0x8D;
+
+// Reduction of the four bits shifted out of the top of an element
+const uint32_t REDUCE4[16] = {
+    0x000, 0x08d, 0x11a, 0x197, 0x234, 0x2b9, 0x32e, 0x3a3,
+    0x468, 0x4e5, 0x572, 0x5ff, 0x65c, 0x6d1, 0x746, 0x7cb
+};
+
+inline uint32_t MulX(uint32_t a)
+{
+    return (a << 1) ^ (FIELD_MODULUS & -(a >> 31));
+}
+
+/** Multiplication by a fixed field element, four bits at a time */
+class FieldMul
+{
+private:
+    uint32_t table[16];
+
+public:
+    explicit FieldMul(uint32_t a)
+    {
+        table[0] = 0;
+        table[1] = a;
+        for (int i = 2; i < 16; i += 2) {
+            table[i] = MulX(table[i / 2]);
+            table[i + 1] = table[i] ^ a;
+        }
+    }
+
+    uint32_t operator()(uint32_t b) const
+    {
+        uint32_t r = 0;
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            r = (r << 4) ^ REDUCE4[r >> 28];
+            r ^= table[(b >> shift) & 15];
+        }
+        return r;
+    }
+};
+
+inline uint32_t Mul(uint32_t a, uint32_t b)
+{
+    return FieldMul(a)(b);
+}
+
+uint32_t Inverse(uint32_t a)
+{
+    // a^(2^32 - 2)
+    assert(a != 0);
+    uint32_t r = 1;
+    for (uint32_t e = 0xFFFFFFFE; e; e >>= 1) {
+        if (e & 1)
+            r = Mul(r, a);
+        a = Mul(a, a);
+    }
+    return r;
+}
+
+void Trim(Poly& p)
+{
+    while (!p.empty() && p.back() == 0)
+        p.pop_back();
+}
+
+void MakeMonic(Poly& p)
+{
+    FieldMul inv(Inverse(p.back()));
+    for (size_t i = 0; i < p.size(); i++)
+        p[i] = inv(p[i]);
+}
+
+// p mod m, for monic m of degree at least 1
+void PolyMod(Poly& p, const Poly& m)
+{
+    size_t dm = m.size() - 1;
+    for (size_t i = p.size(); i-- > dm; ) {
+        if (p[i] == 0)
+            continue;
+        FieldMul coef(p[i]);
+        for (size_t j = 0; j < dm; j++)
+            p[i - dm + j] ^= coef(m[j]);
+        p[i] = 0;
+    }
+    Trim(p);
+}
+
+// f / g for monic g dividing f
+Poly PolyDivExact(Poly f, const Poly& g)
+{
+    size_t dg = g.size() - 1;
+    Poly q(f.size() - dg, 0);
+    for (size_t i = f.size(); i-- > dg; ) {
+        uint32_t c = f[i];
+        q[i - dg] = c;
+        if (c == 0)
+            continue;
+        FieldMul coef(c);
+        for (size_t j = 0; j <= dg; j++)
+            f[i - dg + j] ^= coef(g[j]);
+    }
+    return q;
+}
+
+// Monic gcd of a and b
+Poly PolyGCD(Poly a, Poly b)
+{
+    Trim(a);
+    Trim(b);
+    while (!b.empty()) {
+        MakeMonic(b);
+        PolyMod(a, b);
+        a.swap(b);
+    }
+    MakeMonic(a);
+    return a;
+}
+
+// p^2 mod f; squaring is linear in characteristic 2
+Poly PolySqrMod(const Poly& p, const Poly& f)
+{
+    Poly sq(p.empty() ? 0 : 2 * p.size() - 1, 0);
+    for (size_t i = 0; i < p.size(); i++)
+        sq[2 * i] = Mul(p[i], p[i]);
+    PolyMod(sq, f);
+    return sq;
+}
+
+// Whether monic f of degree at least 2 is a product of distinct linear factors,
+// i.e. x^(2^32) = x mod f
+bool SplitsDistinct(const Poly& f)
+{
+    Poly y(2, 0);
+    y[1] = 1;
+    for (int i = 0; i < 32; i++)
+        y = PolySqrMod(y, f);
+    return y.size() == 2 && y[0] == 0 && y[1] == 1;
+}
+
+// Berlekamp trace algorithm: split f by gcd(f, Tr(beta * x)) for varying beta
+bool FindRoots(const Poly& f, std::vector<uint32_t>& vRoots, uint32_t& nRand)
+{
+    size_t d = f.size() - 1;
+    if (d == 0)
+        return true;
+    if (d == 1) {
+        vRoots.push_back(f[0]);
+        return true;
+    }
+    for (int nAttempt = 0; nAttempt < 64; nAttempt++) {
+        nRand ^= nRand << 13;
+        nRand ^= nRand >> 17;
+        nRand ^= nRand << 5;
+        Poly y(2, 0);
+        y[1] = nRand;
+        Poly t(y);
+        for (int i = 1; i < 32; i++) {
+            y = PolySqrMod(y, f);
+            if (t.size() < y.size())
+                t.resize(y.size(), 0);
+            for (size_t j = 0; j < y.size(); j++)
+                t[j] ^= y[j];
+        }
+        Trim(t);
+        if (t.empty())
+            continue;
+        Poly g = PolyGCD(f, t);
+        if (g.size() == 1 || g.size() == f.size())
+            continue;
+        return FindRoots(g, vRoots, nRand) && FindRoots(PolyDivExact(f, g), vRoots, nRand);
+    }
+    return false;
+}
+
+} // namespace
+
+void CPinSketch::Add(uint32_t nElement)
+{
+    assert(nElement != 0);
+    FieldMul sqr(Mul(nElement, nElement));
+    uint32_t nPower = nElement;
+    for (size_t i = 0; i < vSyndromes.size(); i++) {
+        vSyndromes[i] ^= nPower;
+        nPower = sqr(nPower);
+    }
+}
+
+void CPinSketch::Merge(const CPinSketch& other)
+{
+    assert(other.vSyndromes.size() == vSyndromes.size());
+    for (size_t i = 0; i < vSyndromes.size(); i++)
+        vSyndromes[i] ^= other.vSyndromes[i];
+}
+
+bool CPinSketch::Decode(std::vector<uint32_t>& vElements) const
+{
+    vElements.clear();
+    const size_t nCapacity = vSyndromes.size();
+
+    // Power sums S_1 .. S_2c; the even ones follow from S_2k = S_k^2
+    std::vector<uint32_t> s(2 * nCapacity);
+    for (size_t i = 0; i < nCapacity; i++)
+        s[2 * i] = vSyndromes[i];
+    for (size_t k = 2; k <= 2 * nCapacity; k += 2)
+        s[k - 1] = Mul(s[k / 2 - 1], s[k / 2 - 1]);
+
+    // Berlekamp-Massey: shortest C with C(x) = prod(1 - e_i x)
+    Poly C(1, 1), B(1, 1);
+    size_t L = 0, m = 1;
+    uint32_t b = 1;
+    for (size_t n = 0; n < s.size(); n++) {
+        uint32_t d = s[n];
+        for (size_t i = 1; i <= L && i < C.size(); i++)
+            d ^= Mul(C[i], s[n - i]);
+        if (d == 0) {
+            m++;
+            continue;
+        }
+        FieldMul coef(Mul(d, Inverse(b)));
+        Poly T(C);
+        if (C.size() < B.size() + m)
+            C.resize(B.size() + m, 0);
+        for (size_t i = 0; i < B.size(); i++)
+            C[i + m] ^= coef(B[i]);
+        if (2 * L <= n) {
+            L = n + 1 - L;
+            B.swap(T);
+            b = d;
+            m = 1;
+        } else {
+            m++;
+        }
+    }
+    if (L == 0)
+        return true;
+    if (L > nCapacity)
+        return false;
+    C.resize(L + 1, 0);
+    if (C[L] == 0)
+        return false;
+
+    // The elements are the roots of the reversed polynomial
+    Poly f(L + 1);
+    for (size_t i = 0; i <= L; i++)
+        f[i] = C[L - i];
+    if (L >= 2 && !SplitsDistinct(f))
+        return false;
+    uint32_t nRand = vSyndromes[0] | 1;
+    if (!FindRoots(f, vElements, nRand) || vElements.size() != L) {
+        vElements.clear();
+        return false;
+    }
+
+    // Reject decodings that do not reproduce the sketch
+    CPinSketch check(nCapacity);
+    for (uint32_t nElement : vElements) {
+        if (nElement == 0) {
+            vElements.clear();
+            return false;
+        }
+        check.Add(nElement);
+    }
+    if (check.vSyndromes != vSyndromes) {
+        vElements.clear();
+        return false;
+    }
+    return true;
+}
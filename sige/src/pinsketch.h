@@ -0,0 +1,41 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __sig_pinsketch_h__
+#define __sig_pinsketch_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * PinSketch set sketch over GF(2^32).
+ *
+ * A sketch of capacity c holds the odd power sums x, x^3, ..., x^(2c-1) of
+ * the nonzero 32-bit elements added to it, so it costs 4 bytes per unit of
+ * capacity however large the set is. Adding an element twice removes it
+ * again, so merging the sketches of two sets gives the sketch of their
+ * symmetric difference, which decodes as long as it has at most c elements.
+ */
+class CPinSketch
+{
+private:
+    std::vector<uint32_t> vSyndromes;
+
+public:
+    explicit CPinSketch(size_t nCapacity) : vSyndromes(nCapacity, 0) {}
+    explicit CPinSketch(const std::vector<uint32_t>& vSyndromesIn) : vSyndromes(vSyndromesIn) {}
+
+    size_t GetCapacity() const { return vSyndromes.size(); }
+    const std::vector<uint32_t>& GetSyndromes() const { return vSyndromes; }
+
+    /** Add or remove an element; must not be zero */
+    void Add(uint32_t nElement);
+    /** Turn this into the sketch of the symmetric difference; capacities must match */
+    void Merge(const CPinSketch& other);
+    /** Recover the elements; returns false if there are more than the capacity */
+    bool Decode(std::vector<uint32_t>& vElements) const;
+};
+
+#endif  /* __sig_pinsketch_h__ */
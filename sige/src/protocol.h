@@ -218,6 +218,30 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * Contains a 4-byte version and an 8-byte salt.
+ * Sent before verack to offer transaction reconciliation; it is used when
+ * both sides send it.
+ */
+extern const char *SENDRECON;
+/**
+ * Contains the 2-byte size of the sender's reconciliation set and the 2-byte
+ * coefficient q. Sent by the outbound side to start a reconciliation round;
+ * the peer answers with "sketch".
+ */
+extern const char *REQRECON;
+/**
+ * Contains a PinSketch of the sender's reconciliation set, sent in response
+ * to "reqrecon". An empty sketch means the difference is too large to
+ * reconcile.
+ */
+extern const char *SKETCH;
+/**
+ * Contains a 1-byte success flag and the short IDs the sender is missing,
+ * closing a reconciliation round. On failure both sides announce their whole
+ * set by inv.
+ */
+extern const char *RECONCILDIFF;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -4,22 +4,34 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "consensus/merkle.h"
+#include "miner.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "validation.h"
 #include "httpserver.h"
+#include "httprpc.h"
+#include "jsonstream.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "uinterface.h"
+#include "util.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
 
 #include <include/univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+//! Seconds the REST block template is kept fresh after it was last asked for
+static const int64_t REST_TEMPLATE_IDLE_TIMEOUT = 60;
+//! Seconds to wait before building the REST block template again after a failure
+static const int64_t REST_TEMPLATE_RETRY_INTERVAL = 5;
 
 enum RetFormat {
     RF_UNDEF,
@@ -54,10 +66,52 @@ struct CCoin {
     }
 };
 
+/**
+ * Block template as served by /rest/blocktemplate: header fields, coinbase
+ * parameters, the merkle branch of the coinbase and the serialized
+ * transactions, so pool servers can skip the hex/JSON round trip of
+ * getblocktemplate.
+ */
+struct CRestBlockTemplate {
+    std::string strLongPollId;
+    int32_t nVersion;
+    uint256 hashPrevBlock;
+    uint32_t nTime;
+    uint32_t nMinTime;
+    uint32_t nBits;
+    int32_t nHeight;
+    CAmount nCoinbaseValue;
+    std::vector<unsigned char> vchCoinbaseCommitment;
+    std::vector<uint256> vMerkleBranch;
+    std::vector<CTransactionRef> vtx; // without the coinbase
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOpsCost;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(strLongPollId);
+        READWRITE(nVersion);
+        READWRITE(hashPrevBlock);
+        READWRITE(nTime);
+        READWRITE(nMinTime);
+        READWRITE(nBits);
+        READWRITE(nHeight);
+        READWRITE(nCoinbaseValue);
+        READWRITE(vchCoinbaseCommitment);
+        READWRITE(vMerkleBranch);
+        READWRITE(vtx);
+        READWRITE(vTxFees);
+        READWRITE(vTxSigOpsCost);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
-extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSONStream(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer);
 extern UniValue mempoolInfoToJSON();
-extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSONStream(CJSONStreamWriter& writer);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -224,11 +278,10 @@ static bool rest_block(HTTPRequest* req,
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        ssBlock << block;
         std::string binaryBlock = ssBlock.str();
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
@@ -236,6 +289,8 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_HEX: {
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
@@ -243,10 +298,10 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        std::string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        HTTPJSONReply reply(req);
+        CJSONStreamWriter writer(reply.Sink());
+        blockToJSONStream(block, pblockindex, showTxDetails, writer);
+        reply.End(writer);
         return true;
     }
 
@@ -332,11 +387,10 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        std::string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        HTTPJSONReply reply(req);
+        CJSONStreamWriter writer(reply.Sink());
+        mempoolToJSONStream(writer);
+        reply.End(writer);
         return true;
     }
     default: {
@@ -400,6 +454,219 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+// One serialized template shared by all /rest/blocktemplate clients. Requests
+// only read it: threadRestTemplate builds it, at most once per refresh and
+// only while clients ask for it, so REST callers can not make the node
+// assemble templates at will. cvRestTemplate is notified on a new template
+// and on a new tip.
+static CWaitableCriticalSection csRestTemplate;
+static CConditionVariable cvRestTemplate;
+static std::shared_ptr<const std::string> pRestTemplate;
+static uint256 hashRestTemplateTip;
+static unsigned int nRestTemplateTxUpdated;
+static int64_t nRestTemplateStart;
+static int64_t nRestTemplateLastRequest;
+//! Only used by UpdateRestBlockTemplate, so by threadRestTemplate
+static std::unique_ptr<BlockTemplateCache> pRestTemplateCache;
+static boost::thread threadRestTemplate;
+
+bool ParseRestLongPollId(const std::string& strId, uint256& hashTip, unsigned int& nTxUpdated)
+{
+    if (strId.size() <= 64 || !IsHex(strId.substr(0, 64)))
+        return false;
+    uint32_t n;
+    if (!ParseUInt32(strId.substr(64), &n))
+        return false;
+    hashTip.SetHex(strId.substr(0, 64));
+    nTxUpdated = n;
+    return true;
+}
+
+static uint256 GetTipHash()
+{
+    LOCK(cs_main);
+    return chainActive.Tip()->GetBlockHash();
+}
+
+std::shared_ptr<const std::string> GetRestBlockTemplate()
+{
+    uint256 hashTip = GetTipHash();
+    boost::unique_lock<boost::mutex> lock(csRestTemplate);
+    nRestTemplateLastRequest = GetTime();
+    if (!pRestTemplate || hashRestTemplateTip != hashTip) {
+        cvRestTemplate.notify_all();
+        return nullptr;
+    }
+    return pRestTemplate;
+}
+
+bool UpdateRestBlockTemplate()
+{
+    unsigned int nTxUpdated = mempool.GetTransactionsUpdated();
+    uint256 hashTip = GetTipHash();
+    {
+        boost::unique_lock<boost::mutex> lock(csRestTemplate);
+        if (pRestTemplate && hashTip == hashRestTemplateTip &&
+            (nTxUpdated == nRestTemplateTxUpdated || GetTime() - nRestTemplateStart <= 5))
+            return false;
+    }
+
+    if (!pRestTemplateCache)
+        pRestTemplateCache.reset(new BlockTemplateCache());
+    int64_t nStart = GetTime();
+    CScript scriptDummy = CScript() << OP_TRUE;
+    std::unique_ptr<CBlockTemplate> pblocktemplate = pRestTemplateCache->Get(Params(), scriptDummy);
+    if (!pblocktemplate)
+        return false;
+    const CBlock& block = pblocktemplate->block;
+
+    CRestBlockTemplate tmpl;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexPrev = mapBlockIndex.at(block.hashPrevBlock);
+        tmpl.nHeight = pindexPrev->nHeight + 1;
+        tmpl.nMinTime = pindexPrev->GetMedianTimePast() + 1;
+    }
+    tmpl.strLongPollId = block.hashPrevBlock.GetHex() + i64tostr(nTxUpdated);
+    tmpl.nVersion = block.nVersion;
+    tmpl.hashPrevBlock = block.hashPrevBlock;
+    tmpl.nTime = block.nTime;
+    tmpl.nBits = block.nBits;
+    tmpl.nCoinbaseValue = block.vtx[0]->vout[0].nValue;
+    tmpl.vchCoinbaseCommitment = pblocktemplate->vchCoinbaseCommitment;
+    tmpl.vMerkleBranch = BlockMerkleBranch(block, 0);
+    tmpl.vtx.assign(block.vtx.begin() + 1, block.vtx.end());
+    tmpl.vTxFees.assign(pblocktemplate->vTxFees.begin() + 1, pblocktemplate->vTxFees.end());
+    tmpl.vTxSigOpsCost.assign(pblocktemplate->vTxSigOpsCost.begin() + 1, pblocktemplate->vTxSigOpsCost.end());
+
+    CDataStream ssTemplate(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    ssTemplate << tmpl;
+
+    {
+        boost::unique_lock<boost::mutex> lock(csRestTemplate);
+        pRestTemplate = std::make_shared<const std::string>(ssTemplate.str());
+        hashRestTemplateTip = block.hashPrevBlock;
+        nRestTemplateTxUpdated = nTxUpdated;
+        nRestTemplateStart = nStart;
+    }
+    cvRestTemplate.notify_all();
+    return true;
+}
+
+static void RestTemplateNotifyBlockTip(bool fInitialDownload, const CBlockIndex* pindexNew)
+{
+    cvRestTemplate.notify_all();
+}
+
+static void ThreadRestTemplate()
+{
+    RenameThread("sigecoin-resttmpl");
+    int64_t nRetryTime = 0;
+    try {
+        while (true) {
+            bool fWanted;
+            {
+                boost::unique_lock<boost::mutex> lock(csRestTemplate);
+                cvRestTemplate.timed_wait(lock, boost::posix_time::seconds(1));
+                fWanted = GetTime() - nRestTemplateLastRequest <= REST_TEMPLATE_IDLE_TIMEOUT;
+            }
+            if (!fWanted || GetTime() < nRetryTime || IsInitialBlockDownload())
+                continue;
+            try {
+                UpdateRestBlockTemplate();
+            } catch (const std::exception& e) {
+                // CreateNewBlock throws if the template fails TestBlockValidity.
+                // Serve nothing rather than an outdated template until a build succeeds.
+                LogPrintf("%s: failed to build the REST block template: %s\n", __func__, e.what());
+                {
+                    boost::unique_lock<boost::mutex> lock(csRestTemplate);
+                    pRestTemplate.reset();
+                }
+                // Start over from a full build, not from what failed
+                pRestTemplateCache.reset();
+                nRetryTime = GetTime() + REST_TEMPLATE_RETRY_INTERVAL;
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+    }
+}
+
+static bool rest_blocktemplate(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    if (IsInitialBlockDownload())
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "Sigecoin is downloading blocks...");
+
+    // /rest/blocktemplate/<longpollid>: wait until there is a template on
+    // another tip, or a minute has passed and one with more transactions.
+    if (param.size() > 1 && param[0] == '/') {
+        std::string lpstr = param.substr(1);
+        uint256 hashWatchedChain;
+        unsigned int nTransactionsUpdatedLastLP;
+        if (!ParseRestLongPollId(lpstr, hashWatchedChain, nTransactionsUpdatedLastLP))
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid longpollid: " + lpstr);
+
+        // The wait holds this worker thread
+        CSemaphoreGrant grant;
+        if (!HoldHTTPWorker(grant))
+            return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "Too many long poll requests");
+
+        boost::system_time checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
+        boost::unique_lock<boost::mutex> lock(csRestTemplate);
+        while (IsRPCRunning()) {
+            if (pRestTemplate && hashRestTemplateTip != hashWatchedChain)
+                break;
+            if (boost::get_system_time() >= checktxtime) {
+                // Timeout: Check transactions for update
+                if (pRestTemplate && nRestTemplateTxUpdated != nTransactionsUpdatedLastLP)
+                    break;
+                checktxtime += boost::posix_time::seconds(10);
+            }
+            // Waiting clients keep the template thread refreshing
+            nRestTemplateLastRequest = GetTime();
+            cvRestTemplate.timed_wait(lock, std::min(checktxtime, boost::get_system_time() + boost::posix_time::seconds(1)));
+        }
+        if (!IsRPCRunning())
+            return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "Shutting down");
+    } else if (!param.empty()) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI: " + param);
+    }
+
+    std::shared_ptr<const std::string> pTemplate = GetRestBlockTemplate();
+    if (!pTemplate) {
+        req->WriteHeader("Retry-After", "1");
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "Block template not ready");
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, *pTemplate);
+        return true;
+    }
+
+    case RF_HEX: {
+        std::string strHex = HexStr(pTemplate->begin(), pTemplate->end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -611,21 +878,35 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/blocktemplate", rest_blocktemplate},
 };
 
 bool StartREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
         RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
+    uiInterface.NotifyBlockTip.connect(&RestTemplateNotifyBlockTip);
+    threadRestTemplate = boost::thread(&ThreadRestTemplate);
     return true;
 }
 
 void InterruptREST()
 {
+    threadRestTemplate.interrupt();
+    cvRestTemplate.notify_all();
 }
 
 void StopREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
         UnregisterHTTPHandler(uri_prefixes[i].prefix, false);
+
+    uiInterface.NotifyBlockTip.disconnect(&RestTemplateNotifyBlockTip);
+    if (threadRestTemplate.joinable()) {
+        threadRestTemplate.interrupt();
+        threadRestTemplate.join();
+    }
+    pRestTemplateCache.reset();
+    boost::unique_lock<boost::mutex> lock(csRestTemplate);
+    pRestTemplate.reset();
 }
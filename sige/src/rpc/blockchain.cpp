@@ -18,6 +18,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 #include "hash.h"
+#include "jsonstream.h"
 
 #include <stdint.h>
 
@@ -101,9 +102,9 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/** The fields of a block's JSON form that go before its "tx" array, and the ones after it */
+static void blockFieldsToJSON(const CBlock& block, const CBlockIndex* blockindex, UniValue& result, UniValue& tail)
 {
-    UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
@@ -117,6 +118,25 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    tail.push_back(Pair("time", block.GetBlockTime()));
+    tail.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
+    tail.push_back(Pair("nonce", (uint64_t)block.nNonce));
+    tail.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    tail.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+    tail.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+
+    if (blockindex->pprev)
+        tail.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        tail.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue result(UniValue::VOBJ);
+    UniValue tail(UniValue::VOBJ);
+    blockFieldsToJSON(block, blockindex, result, tail);
     UniValue txs(UniValue::VARR);
     for(const auto& tx : block.vtx)
     {
@@ -130,21 +150,42 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
             txs.push_back(tx->GetHash().GetHex());
     }
     result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
-
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    result.pushKVs(tail);
     return result;
 }
 
+/** Write what blockToJSON returns to a stream, one transaction at a time.
+ * Takes cs_main for the chain fields only, so call it without holding locks. */
+void blockToJSONStream(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer)
+{
+    UniValue head(UniValue::VOBJ);
+    UniValue tail(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        blockFieldsToJSON(block, blockindex, head, tail);
+    }
+    writer.BeginObject();
+    writer.Pairs(head);
+    writer.Key("tx");
+    writer.BeginArray();
+    for (const auto& tx : block.vtx)
+    {
+        if (txDetails)
+        {
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(*tx, uint256(), objTx);
+            writer.Value(objTx);
+        }
+        else
+            writer.Value(tx->GetHash().GetHex());
+        if (!writer.FlushIfFull())
+            return; // the client went away
+    }
+    writer.EndArray();
+    writer.Pairs(tail);
+    writer.EndObject();
+}
+
 UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -410,6 +451,41 @@ UniValue mempoolToJSON(bool fVerbose = false)
     }
 }
 
+/** Write what mempoolToJSON(true) returns to a stream. The entries are
+ * written a chunk at a time, taking mempool.cs for each chunk rather than
+ * for the whole time the client takes to read them; transactions that leave
+ * the pool in the meantime are skipped. */
+void mempoolToJSONStream(CJSONStreamWriter& writer)
+{
+    vector<uint256> vtxid;
+    {
+        LOCK(mempool.cs);
+        vtxid.reserve(mempool.mapTx.size());
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+            vtxid.push_back(e.GetTx().GetHash());
+    }
+
+    writer.BeginObject();
+    for (size_t i = 0; i < vtxid.size(); )
+    {
+        {
+            LOCK(mempool.cs);
+            for (; i < vtxid.size() && !writer.Full(); i++)
+            {
+                CTxMemPool::txiter it = mempool.mapTx.find(vtxid[i]);
+                if (it == mempool.mapTx.end())
+                    continue;
+                UniValue info(UniValue::VOBJ);
+                entryToJSON(info, *it);
+                writer.KeyValue(vtxid[i].ToHexString(), info);
+            }
+        }
+        if (!writer.FlushIfFull())
+            return; // the client went away
+    }
+    writer.EndObject();
+}
+
 UniValue getrawmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -441,6 +517,16 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     return mempoolToJSON(fVerbose);
 }
 
+bool getrawmempoolStream(const JSONRPCRequest& request, CJSONStreamWriter& writer)
+{
+    // Help and the plain list of ids are left to getrawmempool
+    if (request.fHelp || request.params.size() != 1 || !request.params[0].get_bool())
+        return false;
+
+    mempoolToJSONStream(writer);
+    return true;
+}
+
 UniValue getmempoolancestors(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2) {
@@ -686,6 +772,26 @@ UniValue getblockheader(const JSONRPCRequest& request)
     return blockheaderToJSON(pblockindex);
 }
 
+/** Look up a block by its hash and read it from disk, for getblock */
+static CBlockIndex* ReadBlockForRPC(const std::string& strHash, CBlock& block)
+{
+    AssertLockHeld(cs_main);
+
+    uint256 hash(uint256S(strHash));
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return pblockindex;
+}
+
 UniValue getblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
@@ -730,23 +836,13 @@ UniValue getblock(const JSONRPCRequest& request)
     LOCK(cs_main);
 
     std::string strHash = request.params[0].get_str();
-    uint256 hash(uint256S(strHash));
 
     bool fVerbose = true;
     if (request.params.size() > 1)
         fVerbose = request.params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    CBlockIndex* pblockindex = ReadBlockForRPC(strHash, block);
 
     if (!fVerbose)
     {
@@ -759,6 +855,26 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex);
 }
 
+bool getblockStream(const JSONRPCRequest& request, CJSONStreamWriter& writer)
+{
+    // Help and the hex encoded form are left to getblock
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        return false;
+
+    std::string strHash = request.params[0].get_str();
+    if (request.params.size() > 1 && !request.params[1].get_bool())
+        return false;
+
+    CBlock block;
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        pblockindex = ReadBlockForRPC(strHash, block);
+    }
+    blockToJSONStream(block, pblockindex, false, writer);
+    return true;
+}
+
 struct CCoinsStats
 {
     int nHeight;
@@ -1413,12 +1529,12 @@ UniValue reconsiderblock(const JSONRPCRequest& request)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         okSafe argNames
-  //  --------------------- ------------------------  -----------------------  ------ ----------
+{ //  category              name                      actor (function)         okSafe argNames                                 streamActor
+  //  --------------------- ------------------------  -----------------------  ------ --------------------------------------  -----------------------
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,  {} },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,  {} },
     { "blockchain",         "getblockcount",          &getblockcount,          true,  {} },
-    { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"} },
+    { "blockchain",         "getblock",               &getblock,               true,  {"blockhash","verbose"},                 &getblockStream },
     { "blockchain",         "getblockhash",           &getblockhash,           true,  {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         true,  {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           true,  {} },
@@ -1427,7 +1543,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true,  {"txid","verbose"} },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"},                             &getrawmempoolStream },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
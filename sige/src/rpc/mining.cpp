@@ -34,6 +34,17 @@
 
 using namespace std;
 
+/** getblocktemplate's template cache. Created on first use and destroyed by
+ *  StopMiningRPC when the RPC server stops, while the mempool whose signals
+ *  it listens to is still there. Guarded by cs_main. */
+static std::unique_ptr<BlockTemplateCache> pTemplateCache;
+
+void StopMiningRPC()
+{
+    LOCK(cs_main);
+    pTemplateCache.reset();
+}
+
 /**
  * Return average network hashes per second based on the last 'lookup' blocks,
  * or from the last difficulty change if 'lookup' is nonpositive.
@@ -100,7 +111,6 @@ UniValue getnetworkhashps(const JSONRPCRequest& request)
 
 UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript)
 {
-    static const int nInnerLoopCount = 0x10000;
     int nHeightStart = 0;
     int nHeightEnd = 0;
     int nHeight = 0;
@@ -111,7 +121,9 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
         nHeight = nHeightStart;
         nHeightEnd = nHeightStart+nGenerate;
     }
-    unsigned int nExtraNonce = 0;
+    int nThreads = GetArg("-genproclimit", DEFAULT_GENERATE_THREADS);
+    if (nThreads < 0)
+        nThreads = GetNumCores();
     UniValue blockHashes(UniValue::VARR);
     while (nHeight < nHeightEnd)
     {
@@ -119,20 +131,14 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
         if (!pblocktemplate.get())
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Couldn't create new block");
         CBlock *pblock = &pblocktemplate->block;
+        const CBlockIndex* pindexPrev;
         {
             LOCK(cs_main);
-            IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
+            pindexPrev = mapBlockIndex.at(pblock->hashPrevBlock);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetHash(), pblock->nBits, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
-        }
-        if (nMaxTries == 0) {
+        if (!GenerateBlockProof(*pblock, pindexPrev, nThreads, nMaxTries)) {
             break;
         }
-        if (pblock->nNonce == nInnerLoopCount) {
-            continue;
-        }
         std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
         if (!ProcessNewBlock(Params(), shared_pblock, true, NULL))
             throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
@@ -232,6 +238,7 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"difficulty\": xxx.xxxxx    (numeric) The current difficulty\n"
             "  \"errors\": \"...\"            (string) Current errors\n"
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
+            "  \"hashespersec\": nnn,       (numeric) The hash rate of the last generate call on this node\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
             "}\n"
@@ -251,6 +258,7 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
     obj.push_back(Pair("errors",           GetWarnings("statusbar")));
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
+    obj.push_back(Pair("hashespersec",     GetGenerateHashesPerSec()));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("chain",            NetworkType2String(Params().GetNetworkType())));
     return obj;
@@ -531,9 +539,15 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         CBlockIndex* pindexPrevNew = chainActive.Tip();
         nStart = GetTime();
 
-        // Create new block
+        // Create new block; a request still running after StopMiningRPC must
+        // not bring the cache back
+        if (!pTemplateCache) {
+            if (!IsRPCRunning())
+                throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+            pTemplateCache.reset(new BlockTemplateCache());
+        }
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+        pblocktemplate = pTemplateCache->Get(Params(), scriptDummy);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
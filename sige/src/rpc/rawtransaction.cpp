@@ -909,6 +909,85 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     return hashTx.GetHex();
 }
 
+UniValue sendrawtransactions(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw runtime_error(
+            "sendrawtransactions [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a set of raw transactions (serialized, hex-encoded) to local node and network in one go.\n"
+            "Transactions may spend outputs of each other and can be given in any order.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (array of json objects, in the order of the input)\n"
+            "  {\n"
+            "    \"txid\" : \"hex\",   (string) The transaction hash in hex\n"
+            "    \"accepted\" : true|false, (boolean) Whether the transaction is in the memory pool\n"
+            "    \"error\" : \"text\"  (string) Why the transaction was rejected (only if not accepted)\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex\\\",\\\"signedhex\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex\",\"signedhex\"]")
+        );
+
+    RPCTypeCheck(request.params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+
+    const UniValue& hexstrings = request.params[0].get_array();
+    std::vector<CTransactionRef> vtx;
+    vtx.reserve(hexstrings.size());
+    for (unsigned int i = 0; i < hexstrings.size(); i++) {
+        CMutableTransaction mtx;
+        if (!hexstrings[i].isStr() || !DecodeHexTx(mtx, hexstrings[i].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", i));
+        vtx.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    bool fLimitFree = false;
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (request.params.size() > 1 && request.params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    // push to local node and sync with wallets
+    std::vector<CValidationState> vState;
+    std::vector<bool> vMissingInputs;
+    AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), fLimitFree, NULL, nMaxRawTxFee);
+
+    UniValue result(UniValue::VARR);
+    std::vector<CInv> vInv;
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        const uint256& hashTx = vtx[i]->GetHash();
+        // Transactions already in the pool are relayed again, like sendrawtransaction does
+        bool fAccepted = mempool.exists(hashTx);
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("txid", hashTx.GetHex()));
+        entry.push_back(Pair("accepted", fAccepted));
+        if (fAccepted) {
+            vInv.push_back(CInv(MSG_TX, hashTx));
+        } else if (vMissingInputs[i]) {
+            entry.push_back(Pair("error", "Missing inputs"));
+        } else if (vState[i].IsInvalid()) {
+            entry.push_back(Pair("error", strprintf("%i: %s", vState[i].GetRejectCode(), vState[i].GetRejectReason())));
+        } else {
+            entry.push_back(Pair("error", vState[i].GetRejectReason()));
+        }
+        result.push_back(entry);
+    }
+
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    g_connman->ForEachNode([&vInv](CNode* pnode)
+    {
+        BOOST_FOREACH(const CInv& inv, vInv)
+            pnode->PushInventory(inv);
+    });
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -917,6 +996,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,  {"hexstring"} },
     { "rawtransactions",    "decodescript",           &decodescript,           true,  {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false, {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "sendrawtransactions",    &sendrawtransactions,    false, {"hexstrings","allowhighfees"} },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false, {"hexstring","prevtxs","privkeys","sighashtype"} }, /* uses wallet if enabled */
 
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,  {"txids", "blockhash"} },
@@ -85,6 +85,7 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"recvbuffer\": n,           (numeric) The bytes of receive buffers held for incomplete and unprocessed messages\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"timeoffset\": ttt,         (numeric) The time offset in seconds\n"
             "    \"pingtime\": n,             (numeric) ping time (if available)\n"
@@ -98,6 +99,8 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"banscore\": n,             (numeric) The ban score\n"
             "    \"synced_headers\": n,       (numeric) The last header we have in common with this peer\n"
             "    \"synced_blocks\": n,        (numeric) The last block we have in common with this peer\n"
+            "    \"blocktime\": n,            (numeric) Average seconds this peer takes to deliver a requested block (if measured)\n"
+            "    \"blockrate\": n,            (numeric) Average block download throughput from this peer in bytes per second (if measured)\n"
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
@@ -110,6 +113,14 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "    \"bytesrecv_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes received aggregated by message type\n"
             "       ...\n"
+            "    },\n"
+            "    \"sendwait_per_class\": {\n"
+            "       \"block\": {              (json object) Messages sent from a send queue class (block, headers or other)\n"
+            "         \"count\": n,           (numeric) Number of messages sent\n"
+            "         \"avgwait\": n,         (numeric) Average seconds they were queued until handed to the socket\n"
+            "         \"maxwait\": n          (numeric) Longest such wait in seconds\n"
+            "       },\n"
+            "       ...\n"
             "    }\n"
             "  }\n"
             "  ,...\n"
@@ -141,6 +152,7 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("recvbuffer", stats.nRecvBufferSize));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("timeoffset", stats.nTimeOffset));
         if (stats.dPingTime > 0.0)
@@ -161,6 +173,10 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             obj.push_back(Pair("banscore", statestats.nMisbehavior));
             obj.push_back(Pair("synced_headers", statestats.nSyncHeight));
             obj.push_back(Pair("synced_blocks", statestats.nCommonHeight));
+            if (statestats.nBlockTimeAvg > 0) {
+                obj.push_back(Pair("blocktime", ((double)statestats.nBlockTimeAvg) / 1e6));
+                obj.push_back(Pair("blockrate", statestats.nBlockBytesPerSec));
+            }
             UniValue heights(UniValue::VARR);
             BOOST_FOREACH(int height, statestats.vHeightInFlight) {
                 heights.push_back(height);
@@ -183,6 +199,17 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
         }
         obj.push_back(Pair("bytesrecv_per_msg", recvPerMsgCmd));
 
+        UniValue sendWaitPerClass(UniValue::VOBJ);
+        for (int i = 0; i < SEND_PRIORITY_COUNT; i++) {
+            const CSendQueue::ClassStats& classStats = stats.sendQueueStats[i];
+            UniValue wait(UniValue::VOBJ);
+            wait.push_back(Pair("count", classStats.nMessages));
+            wait.push_back(Pair("avgwait", classStats.nMessages ? ((double)classStats.nWaitTotal) / classStats.nMessages / 1e6 : 0.0));
+            wait.push_back(Pair("maxwait", ((double)classStats.nWaitMax) / 1e6));
+            sendWaitPerClass.push_back(Pair(GetSendPriorityName(i), wait));
+        }
+        obj.push_back(Pair("sendwait_per_class", sendWaitPerClass));
+
         ret.push_back(obj);
     }
 
@@ -531,6 +558,54 @@ UniValue setban(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+UniValue importbanlist(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw runtime_error(
+                            "importbanlist [\"subnet\",...] (bantime) (absolute)\n"
+                            "\nBans a list of IPs/Subnets at once, e.g. an imported abuse list.\n"
+                            "\nArguments:\n"
+                            "1. \"subnets\"      (array, required) The IPs/Subnets, each with an optional netmask as in setban\n"
+                            "2. \"bantime\"      (numeric, optional) time in seconds how long (or until when if [absolute] is set) the ips are banned (0 or empty means using the default time of 24h which can also be overwritten by the -bantime startup argument)\n"
+                            "3. \"absolute\"     (boolean, optional) If set, the bantime must be a absolute timestamp in seconds since epoch (Jan 1 1970 GMT)\n"
+                            "\nResult:\n"
+                            "n    (numeric) The number of IPs/Subnets newly banned or banned for longer\n"
+                            "\nExamples:\n"
+                            + HelpExampleCli("importbanlist", "\"[\\\"192.168.1.100\\\",\\\"10.0.0.0/8\\\"]\" 86400")
+                            + HelpExampleRpc("importbanlist", "[\"192.168.1.100\",\"10.0.0.0/8\"], 86400")
+                            );
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    const UniValue& subnets = request.params[0].get_array();
+    std::vector<CSubNet> vSubNets;
+    vSubNets.reserve(subnets.size());
+    for (unsigned int i = 0; i < subnets.size(); i++) {
+        const string& strSubNet = subnets[i].get_str();
+        CSubNet subNet;
+        if (strSubNet.find("/") != string::npos) {
+            LookupSubNet(strSubNet.c_str(), subNet);
+        } else {
+            CNetAddr resolved;
+            LookupHost(strSubNet.c_str(), resolved, false);
+            subNet = CSubNet(resolved);
+        }
+        if (!subNet.IsValid())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Error: Invalid IP/Subnet: " + strSubNet);
+        vSubNets.push_back(subNet);
+    }
+
+    int64_t banTime = 0; //use standard bantime if not specified
+    if (request.params.size() >= 2 && !request.params[1].isNull())
+        banTime = request.params[1].get_int64();
+
+    bool absolute = false;
+    if (request.params.size() == 3 && request.params[2].isTrue())
+        absolute = true;
+
+    return (uint64_t)g_connman->Ban(vSubNets, BanReasonManuallyAdded, banTime, absolute);
+}
+
 UniValue listbanned(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -614,6 +689,7 @@ static const CRPCCommand commands[] =
     { "network",            "getnettotals",           &getnettotals,           true,  {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  {} },
     { "network",            "setban",                 &setban,                 true,  {"subnet", "command", "bantime", "absolute"} },
+    { "network",            "importbanlist",          &importbanlist,          true,  {"subnets", "bantime", "absolute"} },
     { "network",            "listbanned",             &listbanned,             true,  {} },
     { "network",            "clearbanned",            &clearbanned,            true,  {} },
     { "network",            "setnetworkactive",       &setnetworkactive,       true,  {"state"} },
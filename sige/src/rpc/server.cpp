@@ -25,7 +25,11 @@
 #include <boost/thread.hpp>
 #include <boost/algorithm/string/case_conv.hpp> // for to_upper()
 
+#include <atomic>
+#include <condition_variable>
 #include <memory> // for unique_ptr
+#include <mutex>
+#include <set>
 #include <unordered_map>
 
 using namespace RPCServer;
@@ -314,6 +318,19 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::removeCommand(const std::string& name, const CRPCCommand* pcmd)
+{
+    if (IsRPCRunning())
+        return false;
+
+    map<string, const CRPCCommand*>::iterator it = mapCommands.find(name);
+    if (it == mapCommands.end() || it->second != pcmd)
+        return false;
+
+    mapCommands.erase(it);
+    return true;
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
@@ -416,13 +433,101 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/**
+ * Methods that only read state. A batch made of these alone may have its
+ * requests run concurrently and in any order without changing their results;
+ * any other batch runs in order, as its requests may depend on each other.
+ */
+static const std::set<std::string> setReadOnlyMethods = {
+    "decoderawtransaction", "decodescript", "estimatefee", "estimatepriority",
+    "estimatesmartfee", "estimatesmartpriority", "getbestblockhash", "getblock",
+    "getblockchaininfo", "getblockcount", "getblockhash", "getblockheader",
+    "getchaintips", "getconnectioncount", "getdifficulty", "getmempoolancestors",
+    "getmempooldescendants", "getmempoolentry", "getmempoolinfo", "getrawmempool",
+    "getrawtransaction", "gettxout", "gettxoutproof", "validateaddress",
+    "verifymessage", "verifytxoutproof",
+};
+
+static bool IsReadOnlyBatch(const UniValue& vReq)
+{
+    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++) {
+        if (!vReq[reqIdx].isObject())
+            return false;
+        const UniValue& method = find_value(vReq[reqIdx].get_obj(), "method");
+        if (!method.isStr() || !setReadOnlyMethods.count(method.get_str()))
+            return false;
+    }
+    return true;
+}
+
+/** A batch being run, shared with the threads helping to run it */
+class JSONRPCBatch
+{
+private:
+    const UniValue vReq;
+    std::vector<UniValue> vReply;
+    //! GetTimeMillis() after which requests are no longer started, 0 if none
+    const int64_t nDeadline;
+    //! Index of the next request to claim
+    std::atomic<unsigned int> nNext;
+    std::mutex cs;
+    std::condition_variable cond;
+    unsigned int nDone;
+
+public:
+    JSONRPCBatch(const UniValue& _vReq, int64_t _nDeadline) :
+        vReq(_vReq), vReply(_vReq.size()), nDeadline(_nDeadline), nNext(0), nDone(0)
+    {
+    }
+
+    /** Run requests until none is left to claim */
+    void Work()
+    {
+        for (unsigned int reqIdx = nNext++; reqIdx < vReq.size(); reqIdx = nNext++) {
+            if (nDeadline && GetTimeMillis() > nDeadline) {
+                UniValue id = vReq[reqIdx].isObject() ? find_value(vReq[reqIdx].get_obj(), "id") : NullUniValue;
+                vReply[reqIdx] = JSONRPCReplyObj(NullUniValue,
+                                                 JSONRPCError(RPC_MISC_ERROR, "Batch deadline exceeded"), id);
+            } else {
+                vReply[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            }
+            std::lock_guard<std::mutex> lock(cs);
+            if (++nDone == vReq.size())
+                cond.notify_all();
+        }
+    }
+
+    /** Wait for requests claimed by helpers, then collect the replies in order */
+    UniValue Finish()
+    {
+        {
+            std::unique_lock<std::mutex> lock(cs);
+            while (nDone < vReq.size())
+                cond.wait(lock);
+        }
+        UniValue ret(UniValue::VARR);
+        for (UniValue& reply : vReply)
+            ret.push_back(std::move(reply));
+        return ret;
+    }
+};
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCTaskDispatcher& dispatch, int nMaxHelpers, int64_t nTimeout)
 {
-    UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    std::shared_ptr<JSONRPCBatch> batch = std::make_shared<JSONRPCBatch>(vReq, nTimeout > 0 ? GetTimeMillis() + nTimeout : 0);
+
+    // Helpers claim requests the same way this thread does, so the batch
+    // completes here even if no helper gets to run before it is done
+    if (dispatch && vReq.size() > 1 && IsReadOnlyBatch(vReq)) {
+        int nHelpers = std::min<int>(nMaxHelpers, vReq.size() - 1);
+        for (int i = 0; i < nHelpers; i++) {
+            if (!dispatch([batch] { batch->Work(); }))
+                break;
+        }
+    }
+    batch->Work();
 
-    return ret.write() + "\n";
+    return batch->Finish().write() + "\n";
 }
 
 /**
@@ -500,6 +605,41 @@ UniValue CRPCTable::execute(const JSONRPCRequest &request) const
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+bool CRPCTable::executeStream(const JSONRPCRequest &request, CJSONStreamWriter& writer) const
+{
+    const CRPCCommand *pcmd = tableRPC[request.strMethod];
+    if (!pcmd || !pcmd->streamActor)
+        return false;
+
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    g_rpcSignals.PreCommand(*pcmd);
+
+    bool fStreamed;
+    try
+    {
+        // Execute, convert arguments to array if necessary
+        if (request.params.isObject()) {
+            fStreamed = pcmd->streamActor(transformNamedArguments(request, pcmd->argNames), writer);
+        } else {
+            fStreamed = pcmd->streamActor(request, writer);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+
+    if (fStreamed)
+        g_rpcSignals.PostCommand(*pcmd);
+    return fStreamed;
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
@@ -9,6 +9,7 @@
 #include "rpc/proto.h"
 #include "uint256.h"
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
@@ -20,6 +21,7 @@
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
 
+class CJSONStreamWriter;
 class CRPCCommand;
 
 namespace RPCServer
@@ -132,6 +134,10 @@ void RPCUnsetTimerInterface(RPCTimerInterface *iface);
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
 typedef UniValue(*rpcfn_type)(const JSONRPCRequest& jsonRequest);
+/** Writes a method's result to a stream while producing it. Returns false,
+ * without writing anything, for requests it leaves to the plain actor; errors
+ * in the request must be thrown before anything is written. */
+typedef bool(*rpcstreamfn_type)(const JSONRPCRequest& jsonRequest, CJSONStreamWriter& writer);
 
 class CRPCCommand
 {
@@ -141,6 +147,8 @@ public:
     rpcfn_type actor;
     bool okSafeMode;
     std::vector<std::string> argNames;
+    //! Optional streaming form of actor, for methods whose results get large
+    rpcstreamfn_type streamActor;
 };
 
 /**
@@ -163,6 +171,17 @@ public:
      */
     UniValue execute(const JSONRPCRequest &request) const;
 
+    /**
+     * Execute a method, writing its result to a stream as it is produced.
+     * @param request The JSONRPCRequest to execute
+     * @param writer The stream, positioned where the result goes
+     * @returns false, without writing anything, if the method has no
+     * streaming form for the request; use execute() then.
+     * @throws an exception (UniValue) when an error happens. Errors in the
+     * request are thrown before anything is written.
+     */
+    bool executeStream(const JSONRPCRequest &request, CJSONStreamWriter& writer) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -176,6 +195,12 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Removes a CRPCCommand from the dispatch table, if it is the one registered under name.
+     * Returns false if RPC server is already running or the command was not there.
+     */
+    bool removeCommand(const std::string& name, const CRPCCommand* pcmd);
 };
 
 extern CRPCTable tableRPC;
@@ -202,8 +227,20 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+/** Hands a task to another thread, returns false if it could not be queued */
+typedef std::function<bool(const std::function<void(void)>&)> RPCTaskDispatcher;
+/**
+ * Execute a batch of requests and return the serialized array of replies, in
+ * request order. A batch of read-only calls is also worked on by up to
+ * nMaxHelpers tasks handed to dispatch. Over HTTP those are queued on the
+ * -rpcworkqueue like any request, so callers keep nMaxHelpers within the
+ * queue's free depth. Requests not started within nTimeout milliseconds (if
+ * positive) fail with "Batch deadline exceeded".
+ */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCTaskDispatcher& dispatch = RPCTaskDispatcher(), int nMaxHelpers = 0, int64_t nTimeout = 0);
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
+/** Release getblocktemplate's template cache when the RPC server stops */
+void StopMiningRPC();
 
 // Retrieves any serialization flags requested in command line argument
 int RPCSerializationFlags();
@@ -0,0 +1,633 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+#include "base58.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "crypto/common.h"
+#include "miner.h"
+#include "netbase.h"
+#include "random.h"
+#include "scheduler.h"
+#include "script/standard.h"
+#include "sigaddress.h"
+#include "streams.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+#include "validationinterface.h"
+#include "version.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+#include <include/univalue.h>
+
+/** Maximum length of a request line; Stratum messages are far smaller */
+static const size_t MAX_STRATUM_LINE_LENGTH = 16384;
+/** Jobs kept around for late submissions while the tip is unchanged */
+static const size_t MAX_STRATUM_JOBS = 16;
+/** Shares remembered per job for duplicate detection; past that the job is stale */
+static const size_t MAX_STRATUM_SHARES_PER_JOB = 16384;
+
+/** Stratum error codes, as used by the common pool implementations */
+enum StratumErrorCode
+{
+    STRATUM_ERR_OTHER = 20,
+    STRATUM_ERR_JOB_NOT_FOUND = 21,
+    STRATUM_ERR_DUPLICATE_SHARE = 22,
+    STRATUM_ERR_LOW_DIFFICULTY = 23,
+    STRATUM_ERR_UNAUTHORIZED = 24,
+    STRATUM_ERR_NOT_SUBSCRIBED = 25,
+};
+
+bool BuildStratumJob(StratumJob& job, int nHeight)
+{
+    if (job.block.vtx.empty() || job.block.vtx[0]->vin.size() != 1)
+        return false;
+
+    // BIP34 height followed by a fixed-size push the miner fills in
+    CMutableTransaction coinbaseTx(*job.block.vtx[0]);
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << std::vector<unsigned char>(STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, 0);
+    const CScript& scriptSig = coinbaseTx.vin[0].scriptSig;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ss << coinbaseTx;
+
+    // nVersion, vin count, prevout, scriptSig length, then the script itself
+    const size_t nScriptEnd = 4 + 1 + 36 + GetSizeOfCompactSize(scriptSig.size()) + scriptSig.size();
+    const size_t nExtraNonceBegin = nScriptEnd - STRATUM_EXTRANONCE1_SIZE - STRATUM_EXTRANONCE2_SIZE;
+    if (ss.size() < nScriptEnd)
+        return false;
+    job.vchCoinbase1.assign(ss.begin(), ss.begin() + nExtraNonceBegin);
+    job.vchCoinbase2.assign(ss.begin() + nScriptEnd, ss.end());
+
+    job.nHeight = nHeight;
+    job.block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    job.block.hashMerkleRoot = BlockMerkleRoot(job.block);
+    job.vMerkleBranch = BlockMerkleBranch(job.block, 0);
+    return true;
+}
+
+bool AssembleStratumBlock(const StratumJob& job, const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce, CBlock& block)
+{
+    if (vchExtraNonce.size() != STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE)
+        return false;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ss.write((const char*)job.vchCoinbase1.data(), job.vchCoinbase1.size());
+    ss.write((const char*)vchExtraNonce.data(), vchExtraNonce.size());
+    ss.write((const char*)job.vchCoinbase2.data(), job.vchCoinbase2.size());
+
+    CMutableTransaction coinbaseTx;
+    try {
+        ss >> coinbaseTx;
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (!ss.empty() || coinbaseTx.vin.size() != 1)
+        return false;
+    // The witness reserved value is not part of what the miner sees
+    coinbaseTx.vin[0].scriptWitness = job.block.vtx[0]->vin[0].scriptWitness;
+
+    block = job.block;
+    block.vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    block.hashMerkleRoot = ComputeMerkleRootFromBranch(block.vtx[0]->GetHash(), job.vMerkleBranch, 0);
+    block.nTime = nTime;
+    block.nNonce = nNonce;
+    return true;
+}
+
+/** Stratum sends the previous block hash as eight byte-swapped 32 bit words */
+static std::string StratumPrevHash(const uint256& hash)
+{
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    for (size_t i = 0; i < vch.size(); i += 4)
+        std::reverse(vch.begin() + i, vch.begin() + i + 4);
+    return HexStr(vch);
+}
+
+static bool ParseStratumUInt32(const UniValue& value, uint32_t& n)
+{
+    if (!value.isStr() || value.get_str().size() != 8 || !IsHex(value.get_str()))
+        return false;
+    n = strtoul(value.get_str().c_str(), NULL, 16);
+    return true;
+}
+
+arith_uint256 StratumShareTarget(double dDifficulty)
+{
+    arith_uint256 bnDiff1;
+    bnDiff1.SetCompact(0x1d00ffff);
+    // Below 1/65536 the target would come close to overflowing
+    dDifficulty = std::max(dDifficulty, 1.0 / 65536);
+    // Divide in fixed point, by the difficulty scaled by 2^32 or, for
+    // difficulties of 2^32 and up, by as much as still fits 64 bits
+    int nExp;
+    frexp(dDifficulty, &nExp);
+    const int nShift = std::min(32, 64 - nExp);
+    const arith_uint256 bnDivisor((uint64_t)ldexp(dDifficulty, nShift));
+    if (nShift >= 0)
+        return (bnDiff1 << nShift) / bnDivisor;
+    return (bnDiff1 / bnDivisor) >> -nShift;
+}
+
+/** Submit a block a miner found; runs on the scheduler thread */
+static void SubmitStratumBlock(std::shared_ptr<const CBlock> pblock)
+{
+    bool fNewBlock = false;
+    if (!ProcessNewBlock(Params(), pblock, true, &fNewBlock))
+        LogPrintf("stratum: Block %s rejected\n", pblock->GetHash().GetHex());
+}
+
+/****** Connection and server ********/
+
+struct StratumClient
+{
+    struct bufferevent* bev;
+    std::string strPeer;
+    std::vector<unsigned char> vchExtraNonce1;
+    bool fSubscribed;
+    bool fAuthorized;
+};
+
+class StratumServer : public CValidationInterface
+{
+public:
+    StratumServer(struct event_base* base, CScheduler& scheduler, const CScript& scriptPayout, double dDifficulty);
+    ~StratumServer();
+
+    bool Listen(const CService& addrBind);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+
+private:
+    struct event_base* base;
+    struct evconnlistener* listener;
+    struct event* evNewTip;
+    struct event* evRefresh;
+    CScheduler& scheduler;
+
+    BlockTemplateCache templateCache;
+    CScript scriptPayout;
+    double dDifficulty;
+    arith_uint256 bnShareTarget;
+
+    // Everything below is only touched from the event loop thread
+    std::map<struct bufferevent*, StratumClient> mapClients;
+    std::map<std::string, std::shared_ptr<StratumJob> > mapJobs;
+    std::deque<std::string> vJobOrder;
+    std::shared_ptr<StratumJob> pcurrentJob;
+    unsigned int nTransactionsUpdatedLast;
+    uint32_t nExtraNonce1Next;
+    uint64_t nJobIdNext;
+
+    void UpdateJob(bool fForce);
+    void Send(StratumClient& client, const UniValue& obj);
+    void SendNotify(StratumClient& client, const StratumJob& job, bool fClean);
+    void Disconnect(StratumClient& client);
+    void HandleLine(StratumClient& client, const std::string& strLine);
+    UniValue HandleSubmit(StratumClient& client, const UniValue& params);
+
+    static void acceptcb(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* addr, int socklen, void* ctx);
+    static void readcb(struct bufferevent* bev, void* ctx);
+    static void eventcb(struct bufferevent* bev, short what, void* ctx);
+    static void newtipcb(evutil_socket_t fd, short what, void* ctx);
+    static void refreshcb(evutil_socket_t fd, short what, void* ctx);
+};
+
+static UniValue StratumError(int code, const std::string& message)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(code);
+    error.push_back(message);
+    error.push_back(NullUniValue);
+    return error;
+}
+
+StratumServer::StratumServer(struct event_base* _base, CScheduler& _scheduler, const CScript& _scriptPayout, double _dDifficulty):
+    base(_base), listener(0), scheduler(_scheduler), scriptPayout(_scriptPayout), dDifficulty(_dDifficulty),
+    bnShareTarget(StratumShareTarget(_dDifficulty)), nTransactionsUpdatedLast(0), nExtraNonce1Next(0), nJobIdNext(0)
+{
+    GetRandBytes((unsigned char*)&nExtraNonce1Next, sizeof(nExtraNonce1Next));
+    evNewTip = event_new(base, -1, 0, newtipcb, this);
+    evRefresh = event_new(base, -1, EV_PERSIST, refreshcb, this);
+    struct timeval tv = {GetArg("-stratumjobinterval", DEFAULT_STRATUM_JOB_INTERVAL), 0};
+    event_add(evRefresh, &tv);
+}
+
+StratumServer::~StratumServer()
+{
+    for (std::map<struct bufferevent*, StratumClient>::iterator it = mapClients.begin(); it != mapClients.end(); ++it)
+        bufferevent_free(it->first);
+    mapClients.clear();
+    if (listener)
+        evconnlistener_free(listener);
+    event_free(evNewTip);
+    event_free(evRefresh);
+}
+
+bool StratumServer::Listen(const CService& addrBind)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    if (!addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
+        LogPrintf("stratum: Cannot use bind address %s\n", addrBind.ToString());
+        return false;
+    }
+    listener = evconnlistener_new_bind(base, acceptcb, this, LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE, -1, (struct sockaddr*)&sockaddr, len);
+    if (!listener) {
+        LogPrintf("stratum: Unable to bind to %s\n", addrBind.ToString());
+        return false;
+    }
+    LogPrintf("stratum: Listening on %s\n", addrBind.ToString());
+    return true;
+}
+
+void StratumServer::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    // Called from the validation thread; rebuild the job on the event loop
+    if (!fInitialDownload)
+        event_active(evNewTip, 0, 0);
+}
+
+void StratumServer::UpdateJob(bool fForce)
+{
+    if (IsInitialBlockDownload())
+        return;
+    if (!fForce && pcurrentJob && mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast)
+        return;
+
+    std::shared_ptr<StratumJob> pjob = std::make_shared<StratumJob>();
+    int nHeight = 0;
+    try {
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        std::unique_ptr<CBlockTemplate> pblocktemplate = templateCache.Get(Params(), scriptPayout);
+        pjob->block = pblocktemplate->block;
+
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(pjob->block.hashPrevBlock);
+        if (mi == mapBlockIndex.end() || mi->second != chainActive.Tip())
+            return; // Tip moved while the template was built; another notification is queued
+        nHeight = mi->second->nHeight + 1;
+        pjob->nMinTime = mi->second->GetMedianTimePast() + 1;
+    } catch (const std::exception& e) {
+        LogPrintf("stratum: Unable to create block template: %s\n", e.what());
+        return;
+    }
+    if (!BuildStratumJob(*pjob, nHeight)) {
+        LogPrintf("stratum: Unable to build job from block template\n");
+        return;
+    }
+
+    const bool fClean = !pcurrentJob || pcurrentJob->block.hashPrevBlock != pjob->block.hashPrevBlock;
+    if (fClean) {
+        mapJobs.clear();
+        vJobOrder.clear();
+    }
+    pjob->strJobId = strprintf("%x", nJobIdNext++);
+    mapJobs[pjob->strJobId] = pjob;
+    vJobOrder.push_back(pjob->strJobId);
+    while (vJobOrder.size() > MAX_STRATUM_JOBS) {
+        mapJobs.erase(vJobOrder.front());
+        vJobOrder.pop_front();
+    }
+    pcurrentJob = pjob;
+
+    LogPrint("stratum", "stratum: New job %s at height %d with %u transactions\n", pjob->strJobId, nHeight, pjob->block.vtx.size());
+    for (std::map<struct bufferevent*, StratumClient>::iterator it = mapClients.begin(); it != mapClients.end(); ++it) {
+        if (it->second.fSubscribed)
+            SendNotify(it->second, *pjob, fClean);
+    }
+}
+
+void StratumServer::Send(StratumClient& client, const UniValue& obj)
+{
+    std::string str = obj.write() + "\n";
+    bufferevent_write(client.bev, str.data(), str.size());
+}
+
+void StratumServer::SendNotify(StratumClient& client, const StratumJob& job, bool fClean)
+{
+    UniValue branch(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, job.vMerkleBranch)
+        branch.push_back(HexStr(hash.begin(), hash.end()));
+
+    UniValue params(UniValue::VARR);
+    params.push_back(job.strJobId);
+    params.push_back(StratumPrevHash(job.block.hashPrevBlock));
+    params.push_back(HexStr(job.vchCoinbase1));
+    params.push_back(HexStr(job.vchCoinbase2));
+    params.push_back(branch);
+    params.push_back(strprintf("%08x", (uint32_t)job.block.nVersion));
+    params.push_back(strprintf("%08x", job.block.nBits));
+    params.push_back(strprintf("%08x", job.block.nTime));
+    params.push_back(fClean);
+
+    UniValue notify(UniValue::VOBJ);
+    notify.push_back(Pair("id", NullUniValue));
+    notify.push_back(Pair("method", "mining.notify"));
+    notify.push_back(Pair("params", params));
+    Send(client, notify);
+}
+
+void StratumServer::Disconnect(StratumClient& client)
+{
+    LogPrint("stratum", "stratum: Disconnecting %s\n", client.strPeer);
+    struct bufferevent* bev = client.bev;
+    mapClients.erase(bev);
+    bufferevent_free(bev);
+}
+
+UniValue StratumServer::HandleSubmit(StratumClient& client, const UniValue& params)
+{
+    // params: worker, job id, extranonce2, ntime, nonce
+    if (params.size() < 5 || !params[1].isStr() || !params[2].isStr())
+        return StratumError(STRATUM_ERR_OTHER, "Invalid parameters");
+
+    std::map<std::string, std::shared_ptr<StratumJob> >::iterator it = mapJobs.find(params[1].get_str());
+    if (it == mapJobs.end())
+        return StratumError(STRATUM_ERR_JOB_NOT_FOUND, "Job not found");
+    StratumJob& job = *it->second;
+
+    const std::string& strExtraNonce2 = params[2].get_str();
+    if (strExtraNonce2.size() != 2 * STRATUM_EXTRANONCE2_SIZE || !IsHex(strExtraNonce2))
+        return StratumError(STRATUM_ERR_OTHER, "Invalid extranonce2");
+    uint32_t nTime, nNonce;
+    if (!ParseStratumUInt32(params[3], nTime) || !ParseStratumUInt32(params[4], nNonce))
+        return StratumError(STRATUM_ERR_OTHER, "Invalid ntime or nonce");
+    if ((int64_t)nTime < job.nMinTime || (int64_t)nTime > GetAdjustedTime() + 2 * 60 * 60)
+        return StratumError(STRATUM_ERR_OTHER, "ntime out of range");
+
+    std::vector<unsigned char> vchExtraNonce(client.vchExtraNonce1);
+    std::vector<unsigned char> vchExtraNonce2 = ParseHex(strExtraNonce2);
+    vchExtraNonce.insert(vchExtraNonce.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    if (!AssembleStratumBlock(job, vchExtraNonce, nTime, nNonce, *pblock))
+        return StratumError(STRATUM_ERR_OTHER, "Invalid share");
+
+    // Only shares that meet the target are remembered, so junk can not fill the job
+    const uint256 hash = pblock->GetHash();
+    const arith_uint256 bnHash = UintToArith256(hash);
+    if (bnHash > bnShareTarget)
+        return StratumError(STRATUM_ERR_LOW_DIFFICULTY, "Low difficulty share");
+    if (job.setShares.count(hash))
+        return StratumError(STRATUM_ERR_DUPLICATE_SHARE, "Duplicate share");
+
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(pblock->nBits);
+    if (bnHash > bnTarget) {
+        if (job.setShares.size() >= MAX_STRATUM_SHARES_PER_JOB)
+            return StratumError(STRATUM_ERR_JOB_NOT_FOUND, "Stale job");
+        job.setShares.insert(hash);
+        LogPrint("stratum", "stratum: Share %s from %s for job %s\n", hash.GetHex(), client.strPeer, job.strJobId);
+        return UniValue(true);
+    }
+
+    // Validating the block can take a while, keep it off the connection thread
+    LogPrintf("stratum: Block %s found by %s at height %d\n", hash.GetHex(), client.strPeer, job.nHeight);
+    job.setShares.insert(hash);
+    scheduler.scheduleFromNow(boost::bind(&SubmitStratumBlock, std::shared_ptr<const CBlock>(pblock)), 0);
+    return UniValue(true);
+}
+
+void StratumServer::HandleLine(StratumClient& client, const std::string& strLine)
+{
+    UniValue request;
+    if (!request.read(strLine) || !request.isObject()) {
+        LogPrint("stratum", "stratum: Malformed request from %s\n", client.strPeer);
+        Disconnect(client);
+        return;
+    }
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr()) {
+        Disconnect(client);
+        return;
+    }
+    const UniValue emptyParams(UniValue::VARR);
+    const UniValue& args = params.isArray() ? params : emptyParams;
+
+    UniValue result = NullUniValue;
+    UniValue error = NullUniValue;
+    bool fSendJob = false;
+    const std::string& strMethod = method.get_str();
+    if (strMethod == "mining.subscribe") {
+        UniValue subscription(UniValue::VARR);
+        UniValue notify(UniValue::VARR);
+        notify.push_back("mining.notify");
+        notify.push_back(HexStr(client.vchExtraNonce1));
+        subscription.push_back(notify);
+        result = UniValue(UniValue::VARR);
+        result.push_back(subscription);
+        result.push_back(HexStr(client.vchExtraNonce1));
+        result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+        fSendJob = !client.fSubscribed;
+        client.fSubscribed = true;
+    } else if (strMethod == "mining.authorize") {
+        if (args.size() > 0 && args[0].isStr())
+            LogPrint("stratum", "stratum: %s authorized as %s\n", client.strPeer, args[0].get_str());
+        client.fAuthorized = true;
+        result = UniValue(true);
+    } else if (strMethod == "mining.extranonce.subscribe") {
+        result = UniValue(true);
+    } else if (strMethod == "mining.submit") {
+        if (!client.fSubscribed)
+            error = StratumError(STRATUM_ERR_NOT_SUBSCRIBED, "Not subscribed");
+        else if (!client.fAuthorized)
+            error = StratumError(STRATUM_ERR_UNAUTHORIZED, "Unauthorized worker");
+        else {
+            UniValue ret = HandleSubmit(client, args);
+            if (ret.isArray())
+                error = ret;
+            else
+                result = ret;
+        }
+    } else {
+        error = StratumError(STRATUM_ERR_OTHER, "Method not found");
+    }
+
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", error));
+    Send(client, reply);
+
+    if (fSendJob) {
+        UniValue difficulty(UniValue::VARR);
+        difficulty.push_back(dDifficulty);
+        UniValue setDifficulty(UniValue::VOBJ);
+        setDifficulty.push_back(Pair("id", NullUniValue));
+        setDifficulty.push_back(Pair("method", "mining.set_difficulty"));
+        setDifficulty.push_back(Pair("params", difficulty));
+        Send(client, setDifficulty);
+
+        if (pcurrentJob)
+            SendNotify(client, *pcurrentJob, true);
+        else
+            UpdateJob(true); // Notifies every subscribed client, this one included
+    }
+}
+
+void StratumServer::acceptcb(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* addr, int socklen, void* ctx)
+{
+    StratumServer* self = (StratumServer*)ctx;
+    struct bufferevent* bev = bufferevent_socket_new(self->base, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+
+    CService peer;
+    peer.SetSockAddr(addr);
+    StratumClient& client = self->mapClients[bev];
+    client.bev = bev;
+    client.strPeer = peer.ToString();
+    client.vchExtraNonce1.resize(STRATUM_EXTRANONCE1_SIZE);
+    WriteBE32(client.vchExtraNonce1.data(), self->nExtraNonce1Next++);
+    client.fSubscribed = false;
+    client.fAuthorized = false;
+    LogPrint("stratum", "stratum: Accepted connection from %s\n", client.strPeer);
+
+    bufferevent_setcb(bev, readcb, NULL, eventcb, self);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+}
+
+void StratumServer::readcb(struct bufferevent* bev, void* ctx)
+{
+    StratumServer* self = (StratumServer*)ctx;
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char* line;
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_ANY)) != NULL) {
+        std::string s(line, n_read_out);
+        free(line);
+        std::map<struct bufferevent*, StratumClient>::iterator it = self->mapClients.find(bev);
+        if (it == self->mapClients.end())
+            return;
+        if (!s.empty())
+            self->HandleLine(it->second, s);
+    }
+    std::map<struct bufferevent*, StratumClient>::iterator it = self->mapClients.find(bev);
+    if (it != self->mapClients.end() && evbuffer_get_length(input) > MAX_STRATUM_LINE_LENGTH) {
+        LogPrint("stratum", "stratum: Line too long from %s\n", it->second.strPeer);
+        self->Disconnect(it->second);
+    }
+}
+
+void StratumServer::eventcb(struct bufferevent* bev, short what, void* ctx)
+{
+    StratumServer* self = (StratumServer*)ctx;
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+        std::map<struct bufferevent*, StratumClient>::iterator it = self->mapClients.find(bev);
+        if (it != self->mapClients.end())
+            self->Disconnect(it->second);
+    }
+}
+
+void StratumServer::newtipcb(evutil_socket_t fd, short what, void* ctx)
+{
+    ((StratumServer*)ctx)->UpdateJob(true);
+}
+
+void StratumServer::refreshcb(evutil_socket_t fd, short what, void* ctx)
+{
+    ((StratumServer*)ctx)->UpdateJob(false);
+}
+
+/****** Thread ********/
+static struct event_base* stratumBase = 0;
+static StratumServer* stratumServer = 0;
+static boost::thread stratumThread;
+
+static void StratumThread()
+{
+    event_base_dispatch(stratumBase);
+}
+
+bool StartStratumServer(CScheduler& scheduler)
+{
+    assert(!stratumBase);
+
+    CSigAddress address(base58string(GetArg("-stratumaddress", "")));
+    if (!address.IsValid()) {
+        LogPrintf("stratum: -stratumaddress must be set to a valid payout address\n");
+        return false;
+    }
+    double dDifficulty;
+    if (!ParseDouble(GetArg("-stratumdifficulty", DEFAULT_STRATUM_DIFFICULTY), &dDifficulty) || dDifficulty <= 0) {
+        LogPrintf("stratum: Invalid -stratumdifficulty\n");
+        return false;
+    }
+    CService addrBind;
+    const int nPort = GetArg("-stratumport", DEFAULT_STRATUM_PORT);
+    if (!Lookup(GetArg("-stratumbind", DEFAULT_STRATUM_BIND).c_str(), addrBind, nPort, false)) {
+        LogPrintf("stratum: Invalid -stratumbind address\n");
+        return false;
+    }
+
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    stratumBase = event_base_new();
+    if (!stratumBase) {
+        LogPrintf("stratum: Unable to create event_base\n");
+        return false;
+    }
+    stratumServer = new StratumServer(stratumBase, scheduler, GetScriptForDestination(address.Get()), dDifficulty);
+    if (!stratumServer->Listen(addrBind)) {
+        delete stratumServer;
+        stratumServer = 0;
+        event_base_free(stratumBase);
+        stratumBase = 0;
+        return false;
+    }
+    RegisterValidationInterface(stratumServer);
+
+    stratumThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "stratum", &StratumThread));
+    return true;
+}
+
+void InterruptStratumServer()
+{
+    if (stratumBase) {
+        LogPrintf("stratum: Thread interrupt\n");
+        event_base_loopbreak(stratumBase);
+    }
+}
+
+void StopStratumServer()
+{
+    if (stratumBase) {
+        UnregisterValidationInterface(stratumServer);
+        stratumThread.join();
+        delete stratumServer;
+        stratumServer = 0;
+        event_base_free(stratumBase);
+        stratumBase = 0;
+    }
+}
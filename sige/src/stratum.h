@@ -0,0 +1,58 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __sig_stratum_h__
+#define __sig_stratum_h__
+/**
+ * Built-in Stratum v1 work server. Miners connect over a plain TCP line
+ * protocol and receive jobs built from the node's own block templates, so no
+ * external pool software has to poll getblocktemplate.
+ */
+
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+class CScheduler;
+
+static const bool DEFAULT_STRATUM_ENABLE = false;
+static const std::string DEFAULT_STRATUM_BIND = "127.0.0.1";
+static const unsigned short DEFAULT_STRATUM_PORT = 3333;
+static const std::string DEFAULT_STRATUM_DIFFICULTY = "1";
+/** Seconds between job refreshes that pick up new mempool transactions */
+static const int64_t DEFAULT_STRATUM_JOB_INTERVAL = 30;
+/** Size in bytes of the per-connection and miner-chosen parts of the extranonce */
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+
+/** A block template prepared for Stratum: the coinbase is split around the extranonce. */
+struct StratumJob
+{
+    std::string strJobId;
+    int nHeight;
+    int64_t nMinTime;
+    CBlock block;                            //!< Template; coinbase carries a zeroed extranonce
+    std::vector<unsigned char> vchCoinbase1; //!< Non-witness coinbase bytes before the extranonce
+    std::vector<unsigned char> vchCoinbase2; //!< Non-witness coinbase bytes after the extranonce
+    std::vector<uint256> vMerkleBranch;      //!< Path from the coinbase txid to the merkle root
+    std::set<uint256> setShares;             //!< Header hashes of the shares accepted against this job
+};
+
+/** Rewrite the coinbase of job.block for height nHeight and fill in the coinbase split and merkle branch */
+bool BuildStratumJob(StratumJob& job, int nHeight);
+/** Rebuild a full block from a job and the values a miner submitted */
+bool AssembleStratumBlock(const StratumJob& job, const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce, CBlock& block);
+
+/** Share target for a pool difficulty, relative to the difficulty 1 target */
+arith_uint256 StratumShareTarget(double dDifficulty);
+
+/** Found blocks are handed to scheduler, off the connection thread */
+bool StartStratumServer(CScheduler& scheduler);
+void InterruptStratumServer();
+void StopStratumServer();
+
+#endif  /* __sig_stratum_h__ */
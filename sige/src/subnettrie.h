@@ -0,0 +1,254 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __sig_subnettrie_h__
+#define __sig_subnettrie_h__
+
+#include "netaddress.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Map from subnets to values that finds the subnets containing an address in
+ * time proportional to the address length, however many subnets it holds.
+ *
+ * Subnets whose netmask is a prefix live in a path-compressed binary trie over
+ * the 128-bit address, in which IPv4 and onion addresses are embedded the way
+ * CNetAddr stores them. The rare subnet with a non-contiguous netmask is kept
+ * in a list that every lookup scans.
+ */
+template <typename T>
+class CSubNetTrie
+{
+private:
+    typedef unsigned char Key[16];
+
+    struct Node {
+        Key key; //!< The prefix, zero past nBits
+        int nBits;
+        bool fHasValue;
+        T value;
+        std::unique_ptr<Node> child[2];
+
+        Node(const Key keyIn, int nBitsIn) : nBits(nBitsIn), fHasValue(false), value()
+        {
+            SetPrefix(key, keyIn, nBits);
+        }
+    };
+
+    std::unique_ptr<Node> root;
+    std::vector<std::pair<CSubNet, T> > vOther;
+    size_t nSize;
+
+    static int GetBit(const Key key, int n)
+    {
+        return (key[n >> 3] >> (7 - (n & 7))) & 1;
+    }
+
+    static void SetPrefix(Key dst, const Key src, int nBits)
+    {
+        memset(dst, 0, sizeof(Key));
+        memcpy(dst, src, nBits >> 3);
+        if (nBits & 7)
+            dst[nBits >> 3] = src[nBits >> 3] & (0xff << (8 - (nBits & 7)));
+    }
+
+    static void GetKey(const CNetAddr& addr, Key key)
+    {
+        for (int i = 0; i < 16; i++)
+            key[i] = addr.GetByte(15 - i);
+    }
+
+    /** Number of leading bits a and b share, up to nMax */
+    static int CommonBits(const Key a, const Key b, int nMax)
+    {
+        for (int i = 0; i < 16 && i * 8 < nMax; i++) {
+            unsigned char x = a[i] ^ b[i];
+            if (x) {
+                int n = i * 8;
+                while (!(x & 0x80)) {
+                    x <<= 1;
+                    n++;
+                }
+                return std::min(n, nMax);
+            }
+        }
+        return nMax;
+    }
+
+    bool EraseFrom(std::unique_ptr<Node>& slot, const Key key, int nBits)
+    {
+        Node* node = slot.get();
+        if (!node || node->nBits > nBits || CommonBits(node->key, key, node->nBits) < node->nBits)
+            return false;
+        bool fErased;
+        if (node->nBits == nBits) {
+            fErased = node->fHasValue;
+            node->fHasValue = false;
+            node->value = T();
+        } else {
+            fErased = EraseFrom(node->child[GetBit(key, node->nBits)], key, nBits);
+        }
+        if (fErased && !node->fHasValue) {
+            // Drop nodes that no longer hold a value or branch
+            if (!node->child[0])
+                slot = std::move(node->child[1]);
+            else if (!node->child[1])
+                slot = std::move(node->child[0]);
+        }
+        return fErased;
+    }
+
+    static int GetPrefixLength(const CSubNet& subnet)
+    {
+        return subnet.IsValid() ? subnet.GetPrefixLength() : -1;
+    }
+
+public:
+    CSubNetTrie() : nSize(0) {}
+
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    void clear()
+    {
+        root.reset();
+        vOther.clear();
+        nSize = 0;
+    }
+
+    /** Add a subnet or replace its value; returns whether it is new */
+    bool Insert(const CSubNet& subnet, const T& value)
+    {
+        int nBits = GetPrefixLength(subnet);
+        if (nBits < 0) {
+            for (size_t i = 0; i < vOther.size(); i++) {
+                if (vOther[i].first == subnet) {
+                    vOther[i].second = value;
+                    return false;
+                }
+            }
+            vOther.push_back(std::make_pair(subnet, value));
+            nSize++;
+            return true;
+        }
+
+        Key key;
+        GetKey(subnet.GetNetwork(), key);
+        std::unique_ptr<Node>* slot = &root;
+        while (true) {
+            Node* node = slot->get();
+            if (!node) {
+                slot->reset(new Node(key, nBits));
+                (*slot)->fHasValue = true;
+                (*slot)->value = value;
+                nSize++;
+                return true;
+            }
+            int nCommon = CommonBits(node->key, key, std::min(node->nBits, nBits));
+            if (nCommon < node->nBits) {
+                // The subnet leaves this node's prefix early: split it
+                std::unique_ptr<Node> split(new Node(key, nCommon));
+                int nOld = GetBit(node->key, nCommon);
+                split->child[nOld] = std::move(*slot);
+                Node* target = split.get();
+                if (nCommon < nBits) {
+                    split->child[1 - nOld].reset(new Node(key, nBits));
+                    target = split->child[1 - nOld].get();
+                }
+                target->fHasValue = true;
+                target->value = value;
+                *slot = std::move(split);
+                nSize++;
+                return true;
+            }
+            if (node->nBits == nBits) {
+                bool fNew = !node->fHasValue;
+                node->fHasValue = true;
+                node->value = value;
+                nSize += fNew;
+                return fNew;
+            }
+            slot = &node->child[GetBit(key, node->nBits)];
+        }
+    }
+
+    /** Remove a subnet; returns whether it was present */
+    bool Erase(const CSubNet& subnet)
+    {
+        int nBits = GetPrefixLength(subnet);
+        if (nBits < 0) {
+            for (size_t i = 0; i < vOther.size(); i++) {
+                if (vOther[i].first == subnet) {
+                    vOther.erase(vOther.begin() + i);
+                    nSize--;
+                    return true;
+                }
+            }
+            return false;
+        }
+        Key key;
+        GetKey(subnet.GetNetwork(), key);
+        if (!EraseFrom(root, key, nBits))
+            return false;
+        nSize--;
+        return true;
+    }
+
+    /** The value stored for exactly this subnet, or NULL */
+    const T* Find(const CSubNet& subnet) const
+    {
+        int nBits = GetPrefixLength(subnet);
+        if (nBits < 0) {
+            for (size_t i = 0; i < vOther.size(); i++)
+                if (vOther[i].first == subnet)
+                    return &vOther[i].second;
+            return NULL;
+        }
+        Key key;
+        GetKey(subnet.GetNetwork(), key);
+        for (const Node* node = root.get(); node && node->nBits <= nBits; node = node->child[GetBit(key, node->nBits)].get()) {
+            if (CommonBits(node->key, key, node->nBits) < node->nBits)
+                break;
+            if (node->nBits == nBits)
+                return node->fHasValue ? &node->value : NULL;
+        }
+        return NULL;
+    }
+
+    /** Whether pred holds for the value of any subnet containing addr */
+    template <typename Pred>
+    bool MatchAny(const CNetAddr& addr, Pred pred) const
+    {
+        if (!addr.IsValid())
+            return false;
+        Key key;
+        GetKey(addr, key);
+        for (const Node* node = root.get(); node; node = node->child[GetBit(key, node->nBits)].get()) {
+            if (CommonBits(node->key, key, node->nBits) < node->nBits)
+                break;
+            if (node->fHasValue && pred(node->value))
+                return true;
+            if (node->nBits == 128)
+                break;
+        }
+        for (size_t i = 0; i < vOther.size(); i++)
+            if (vOther[i].first.Match(addr) && pred(vOther[i].second))
+                return true;
+        return false;
+    }
+
+    /** Whether any subnet contains addr */
+    bool Match(const CNetAddr& addr) const
+    {
+        return MatchAny(addr, [](const T&) { return true; });
+    }
+};
+
+#endif  /* __sig_subnettrie_h__ */
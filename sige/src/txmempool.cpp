@@ -17,12 +17,14 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <algorithm>
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
                                  CAmount _inChainInputValue,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
-    tx(_tx), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority), entryHeight(_entryHeight),
-    inChainInputValue(_inChainInputValue),
+    tx(_tx), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority),
+    inChainInputValue(_inChainInputValue), entryHeight(_entryHeight),
     spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
 {
     nTxWeight = GetTransactionWeight(*tx);
@@ -41,6 +43,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nEpoch = 0;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -80,39 +84,47 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
-
-    while (!stageEntries.empty()) {
-        const txiter cit = *stageEntries.begin();
-        setAllDescendants.insert(cit);
-        stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
-        BOOST_FOREACH(const txiter childEntry, setChildren) {
-            cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
-            if (cacheIt != cachedDescendants.end()) {
-                // We've already calculated this one, just add the entries for this set
-                // but don't traverse again.
-                BOOST_FOREACH(const txiter cacheEntry, cacheIt->second) {
-                    setAllDescendants.insert(cacheEntry);
+    std::vector<txiter> vecAllDescendants;
+    {
+        const EpochGuard epoch(*this);
+        std::vector<txiter> stageEntries;
+        BOOST_FOREACH(const txiter childEntry, GetMemPoolChildren(updateIt)) {
+            if (!visited(childEntry))
+                stageEntries.push_back(childEntry);
+        }
+
+        while (!stageEntries.empty()) {
+            const txiter cit = stageEntries.back();
+            vecAllDescendants.push_back(cit);
+            stageEntries.pop_back();
+            const vecEntries &setChildren = GetMemPoolChildren(cit);
+            BOOST_FOREACH(const txiter childEntry, setChildren) {
+                cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
+                if (cacheIt != cachedDescendants.end()) {
+                    // We've already calculated this one, just add the entries for this set
+                    // but don't traverse again.
+                    BOOST_FOREACH(const txiter cacheEntry, cacheIt->second) {
+                        if (!visited(cacheEntry))
+                            vecAllDescendants.push_back(cacheEntry);
+                    }
+                } else if (!visited(childEntry)) {
+                    // Schedule for later processing
+                    stageEntries.push_back(childEntry);
                 }
-            } else if (!setAllDescendants.count(childEntry)) {
-                // Schedule for later processing
-                stageEntries.insert(childEntry);
             }
         }
     }
-    // setAllDescendants now contains all in-mempool descendants of updateIt.
+    // vecAllDescendants now contains all in-mempool descendants of updateIt.
     // Update and add to cached descendant map
     int64_t modifySize = 0;
     CAmount modifyFee = 0;
     int64_t modifyCount = 0;
-    BOOST_FOREACH(txiter cit, setAllDescendants) {
+    BOOST_FOREACH(txiter cit, vecAllDescendants) {
         if (!setExclude.count(cit->GetTx().GetHash())) {
             modifySize += cit->GetTxSize();
             modifyFee += cit->GetModifiedFee();
             modifyCount++;
-            cachedDescendants[updateIt].insert(cit);
+            cachedDescendants[updateIt].push_back(cit);
             // Update ancestor state for each descendant
             mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCost()));
         }
@@ -171,8 +183,9 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
     LOCK(cs);
+    const EpochGuard epoch(*this);
 
-    setEntries parentHashes;
+    std::vector<txiter> parentHashes;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -181,8 +194,8 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
+            if (piter != mapTx.end() && !visited(piter)) {
+                parentHashes.push_back(piter);
                 if (parentHashes.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
@@ -193,16 +206,19 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        BOOST_FOREACH(const txiter &piter, GetMemPoolParents(it)) {
+            if (!visited(piter))
+                parentHashes.push_back(piter);
+        }
     }
 
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
     while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+        txiter stageit = parentHashes.back();
 
         setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+        parentHashes.pop_back();
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -216,11 +232,11 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
+        const vecEntries & setMemPoolParents = GetMemPoolParents(stageit);
         BOOST_FOREACH(const txiter &phash, setMemPoolParents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (!visited(phash)) {
+                parentHashes.push_back(phash);
             }
             if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
@@ -232,9 +248,98 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
     return true;
 }
 
+bool CTxMemPool::CheckPackageLimits(const std::vector<CTransactionRef> &package, const std::vector<int64_t> &vSize, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString) const
+{
+    LOCK(cs);
+    assert(vSize.size() == package.size());
+
+    std::map<uint256, size_t> mapPackage;
+    for (size_t i = 0; i < package.size(); i++)
+        mapPackage.insert(std::make_pair(package[i]->GetHash(), i));
+
+    // Each member's ancestors in the package and in the mempool; parents come
+    // first, so a member's sets are the union of its parents' plus the parents
+    std::vector<std::set<size_t> > vPackageAncestors(package.size());
+    std::vector<setEntries> vMemPoolAncestors(package.size());
+    // What the package adds to each ancestor's descendant count and size
+    std::vector<std::pair<uint64_t, uint64_t> > vPackageDescendants(package.size());
+    std::map<txiter, std::pair<uint64_t, uint64_t>, CompareIteratorByHash> mapMemPoolDescendants;
+
+    for (size_t i = 0; i < package.size(); i++) {
+        std::set<size_t> &setPackageAncestors = vPackageAncestors[i];
+        setEntries &setMemPoolAncestors = vMemPoolAncestors[i];
+        std::vector<txiter> vStage;
+        BOOST_FOREACH(const CTxIn &txin, package[i]->vin) {
+            std::map<uint256, size_t>::const_iterator itPackage = mapPackage.find(txin.prevout.hash);
+            if (itPackage != mapPackage.end() && itPackage->second < i) {
+                if (setPackageAncestors.insert(itPackage->second).second) {
+                    const std::set<size_t> &setParentAncestors = vPackageAncestors[itPackage->second];
+                    setPackageAncestors.insert(setParentAncestors.begin(), setParentAncestors.end());
+                    const setEntries &setParentMemPoolAncestors = vMemPoolAncestors[itPackage->second];
+                    setMemPoolAncestors.insert(setParentMemPoolAncestors.begin(), setParentMemPoolAncestors.end());
+                }
+                continue;
+            }
+            txiter piter = mapTx.find(txin.prevout.hash);
+            if (piter != mapTx.end() && setMemPoolAncestors.insert(piter).second)
+                vStage.push_back(piter);
+        }
+        while (!vStage.empty() && setPackageAncestors.size() + setMemPoolAncestors.size() < limitAncestorCount) {
+            txiter stageit = vStage.back();
+            vStage.pop_back();
+            BOOST_FOREACH(const txiter &phash, GetMemPoolParents(stageit)) {
+                if (setMemPoolAncestors.insert(phash).second)
+                    vStage.push_back(phash);
+            }
+        }
+
+        if (setPackageAncestors.size() + setMemPoolAncestors.size() + 1 > limitAncestorCount) {
+            errString = strprintf("too many unconfirmed ancestors for tx %s [limit: %u]", package[i]->GetHash().ToHexString(), limitAncestorCount);
+            return false;
+        }
+        uint64_t totalSizeWithAncestors = vSize[i];
+        BOOST_FOREACH(size_t j, setPackageAncestors) {
+            totalSizeWithAncestors += vSize[j];
+            vPackageDescendants[j].first++;
+            vPackageDescendants[j].second += vSize[i];
+        }
+        BOOST_FOREACH(const txiter &ancestorit, setMemPoolAncestors) {
+            totalSizeWithAncestors += ancestorit->GetTxSize();
+            std::pair<uint64_t, uint64_t> &descendants = mapMemPoolDescendants[ancestorit];
+            descendants.first++;
+            descendants.second += vSize[i];
+        }
+        if (totalSizeWithAncestors > limitAncestorSize) {
+            errString = strprintf("exceeds ancestor size limit for tx %s [limit: %u]", package[i]->GetHash().ToHexString(), limitAncestorSize);
+            return false;
+        }
+    }
+
+    for (std::map<txiter, std::pair<uint64_t, uint64_t>, CompareIteratorByHash>::const_iterator it = mapMemPoolDescendants.begin(); it != mapMemPoolDescendants.end(); ++it) {
+        if (it->first->GetCountWithDescendants() + it->second.first > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", it->first->GetTx().GetHash().ToHexString(), limitDescendantCount);
+            return false;
+        } else if (it->first->GetSizeWithDescendants() + it->second.second > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", it->first->GetTx().GetHash().ToHexString(), limitDescendantSize);
+            return false;
+        }
+    }
+    for (size_t j = 0; j < package.size(); j++) {
+        if (1 + vPackageDescendants[j].first > limitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", package[j]->GetHash().ToHexString(), limitDescendantCount);
+            return false;
+        } else if (vSize[j] + vPackageDescendants[j].second > limitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", package[j]->GetHash().ToHexString(), limitDescendantSize);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const vecEntries &parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
     BOOST_FOREACH(txiter piter, parentIters) {
         UpdateChild(piter, it, add);
@@ -263,7 +368,7 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
+    const vecEntries &setMemPoolChildren = GetMemPoolChildren(it);
     BOOST_FOREACH(txiter updateIt, setMemPoolChildren) {
         UpdateParent(updateIt, it, false);
     }
@@ -281,15 +386,16 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // Here we only update statistics and not data in mapLinks (which
         // we need to preserve until we're finished with all operations that
         // need to traverse the mempool).
+        std::vector<txiter> vecDescendants;
         BOOST_FOREACH(txiter removeIt, entriesToRemove) {
-            setEntries setDescendants;
-            CalculateDescendants(removeIt, setDescendants);
-            setDescendants.erase(removeIt); // don't update state for self
+            vecDescendants.clear();
+            CalculateDescendants(removeIt, vecDescendants);
             int64_t modifySize = -((int64_t)removeIt->GetTxSize());
             CAmount modifyFee = -removeIt->GetModifiedFee();
             int modifySigOps = -removeIt->GetSigOpCost();
-            BOOST_FOREACH(txiter dit, setDescendants) {
-                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
+            // vecDescendants[0] is removeIt itself; don't update state for self
+            for (size_t i = 1; i < vecDescendants.size(); i++) {
+                mapTx.modify(vecDescendants[i], update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
             }
         }
     }
@@ -348,7 +454,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nEpoch(0), fHasEpochGuard(false)
 {
     _clear(); //lock free clear
 
@@ -482,27 +588,66 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
 {
-    setEntries stage;
-    if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+    const EpochGuard epoch(*this);
+    std::vector<txiter> stage;
+    if (setDescendants.count(entryit) == 0 && !visited(entryit)) {
+        stage.push_back(entryit);
     }
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
     // already been walked, or will be walked in this iteration).
     while (!stage.empty()) {
-        txiter it = *stage.begin();
+        txiter it = stage.back();
         setDescendants.insert(it);
-        stage.erase(it);
+        stage.pop_back();
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
+        const vecEntries &setChildren = GetMemPoolChildren(it);
         BOOST_FOREACH(const txiter &childiter, setChildren) {
-            if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+            if (!setDescendants.count(childiter) && !visited(childiter)) {
+                stage.push_back(childiter);
             }
         }
     }
 }
 
+void CTxMemPool::CalculateDescendants(txiter entryit, std::vector<txiter> &vecDescendants) const
+{
+    const EpochGuard epoch(*this);
+    WalkDescendants(entryit, vecDescendants);
+}
+
+void CTxMemPool::WalkDescendants(txiter entryit, std::vector<txiter> &vecDescendants) const
+{
+    if (visited(entryit))
+        return;
+    // Entries past nPos double as the stage: their children still need to be
+    // walked.
+    size_t nPos = vecDescendants.size();
+    vecDescendants.push_back(entryit);
+    while (nPos < vecDescendants.size()) {
+        const vecEntries &setChildren = GetMemPoolChildren(vecDescendants[nPos++]);
+        BOOST_FOREACH(const txiter &childiter, setChildren) {
+            if (!visited(childiter))
+                vecDescendants.push_back(childiter);
+        }
+    }
+}
+
+CTxMemPool::EpochGuard::EpochGuard(const CTxMemPool& in) : pool(in)
+{
+    assert(!pool.fHasEpochGuard);
+    ++pool.nEpoch;
+    pool.fHasEpochGuard = true;
+}
+
+CTxMemPool::EpochGuard::~EpochGuard()
+{
+    // Bump again so entries marked during this walk are never mistaken for
+    // visited by the next one.
+    ++pool.nEpoch;
+    pool.fHasEpochGuard = false;
+}
+
 void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReason reason)
 {
     // Remove transaction from memory pool
@@ -526,10 +671,14 @@ void CTxMemPool::removeRecursive(const CTransaction &origTx, MemPoolRemovalReaso
                 txToRemove.insert(nextit);
             }
         }
-        setEntries setAllRemoves;
-        BOOST_FOREACH(txiter it, txToRemove) {
-            CalculateDescendants(it, setAllRemoves);
+        std::vector<txiter> vecAllRemoves;
+        {
+            const EpochGuard epoch(*this);
+            BOOST_FOREACH(txiter it, txToRemove) {
+                WalkDescendants(it, vecAllRemoves);
+            }
         }
+        setEntries setAllRemoves(vecAllRemoves.begin(), vecAllRemoves.end());
 
         RemoveStaged(setAllRemoves, false, reason);
     }
@@ -565,10 +714,14 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
             mapTx.modify(it, update_lock_points(lp));
         }
     }
-    setEntries setAllRemoves;
-    for (txiter it : txToRemove) {
-        CalculateDescendants(it, setAllRemoves);
+    std::vector<txiter> vecAllRemoves;
+    {
+        const EpochGuard epoch(*this);
+        for (txiter it : txToRemove) {
+            WalkDescendants(it, vecAllRemoves);
+        }
     }
+    setEntries setAllRemoves(vecAllRemoves.begin(), vecAllRemoves.end());
     RemoveStaged(setAllRemoves, false, MemPoolRemovalReason::REORG);
 }
 
@@ -693,7 +846,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        const vecEntries &parents = GetMemPoolParents(it);
+        assert(setParentCheck.size() == parents.size() && std::equal(setParentCheck.begin(), setParentCheck.end(), parents.begin()));
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -726,7 +880,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        const vecEntries &children = GetMemPoolChildren(it);
+        assert(setChildrenCheck.size() == children.size() && std::equal(setChildrenCheck.begin(), setChildrenCheck.end(), children.begin()));
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -987,7 +1142,11 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    // Each mapTx node holds the entry plus two pointers for the hashed index
+    // and three for each of the four ordered indices. The hashed index's
+    // bucket array never shrinks, so rather than its actual size we count the
+    // one bucket per entry it needs at full load; otherwise TrimToSize could
+    // evict everything after a spike without reaching its target.
     return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
@@ -1007,10 +1166,14 @@ int CTxMemPool::Expire(int64_t time) {
         toremove.insert(mapTx.project<0>(it));
         it++;
     }
-    setEntries stage;
-    BOOST_FOREACH(txiter removeit, toremove) {
-        CalculateDescendants(removeit, stage);
+    std::vector<txiter> vecStage;
+    {
+        const EpochGuard epoch(*this);
+        BOOST_FOREACH(txiter removeit, toremove) {
+            WalkDescendants(removeit, vecStage);
+        }
     }
+    setEntries stage(vecStage.begin(), vecStage.end());
     RemoveStaged(stage, false, MemPoolRemovalReason::EXPIRY);
     return stage.size();
 }
@@ -1025,27 +1188,32 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, validFeeEstimate);
 }
 
-void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+void CTxMemPool::UpdateLink(vecEntries &links, txiter link, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
+    cachedInnerUsage -= memusage::DynamicUsage(links);
+    vecEntries::iterator pos = std::lower_bound(links.begin(), links.end(), link, CompareIteratorByHash());
+    bool fFound = pos != links.end() && *pos == link;
+    if (add && !fFound) {
+        links.insert(pos, link);
+    } else if (!add && fFound) {
+        links.erase(pos);
+        if (links.empty())
+            vecEntries().swap(links);
     }
+    cachedInnerUsage += memusage::DynamicUsage(links);
+}
+
+void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
+{
+    UpdateLink(mapLinks[entry].children, child, add);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    UpdateLink(mapLinks[entry].parents, parent, add);
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPool::vecEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
@@ -1053,7 +1221,7 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
     return it->second.parents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPool::vecEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
     txlinksMap::const_iterator it = mapLinks.find(entry);
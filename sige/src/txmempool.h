@@ -5,6 +5,7 @@
 #ifndef __sig_txmempool_h__
 #define __sig_txmempool_h__
 
+#include <assert.h>
 #include <memory>
 #include <set>
 #include <map>
@@ -88,9 +89,9 @@ private:
     size_t nUsageSize;         //!< ... and total memory usage
     int64_t nTime;             //!< Local time when entering the mempool
     double entryPriority;      //!< Priority when entering the mempool
-    unsigned int entryHeight;  //!< Chain height when entering the mempool
     CAmount inChainInputValue; //!< Sum of all txin values that are already in blockchain
-    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
+    unsigned int entryHeight;  //!< Chain height when entering the mempool
+    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase (packed next to entryHeight)
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
@@ -157,6 +158,7 @@ public:
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
     mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t nEpoch; //!< Last mempool traversal that visited this entry, see CTxMemPool::EpochGuard
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -441,6 +443,9 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    mutable uint64_t nEpoch;     //!< Current graph traversal, entries with a smaller nEpoch are unvisited
+    mutable bool fHasEpochGuard; //!< Whether a traversal is currently in progress
+
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -491,20 +496,27 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    /** Direct parents or children of an entry, sorted by CompareIteratorByHash.
+     *  Most entries have only a handful of links, so a vector costs one small
+     *  allocation where a std::set costs a node per link. */
+    typedef std::vector<txiter> vecEntries;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const vecEntries & GetMemPoolParents(txiter entry) const;
+    const vecEntries & GetMemPoolChildren(txiter entry) const;
 private:
-    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+    typedef std::map<txiter, std::vector<txiter>, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        vecEntries parents;
+        vecEntries children;
     };
 
     typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
     txlinksMap mapLinks;
 
+    /** Insert or remove link in a sorted parent/child vector, keeping
+     *  cachedInnerUsage in step with the vector's capacity. */
+    void UpdateLink(vecEntries &links, txiter link, bool add);
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
@@ -591,11 +603,55 @@ public:
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
+    /** Check a package of related transactions, none of them in the mempool
+     *  yet and parents ahead of their children, against the limits of
+     *  CalculateMemPoolAncestors() as they would stand once every member is
+     *  added: each member's ancestors, in the mempool and in the package, and
+     *  the descendants each of those would end up with. vSize holds each
+     *  member's virtual size as its mempool entry would count it, sigop cost
+     *  included. A package that passes can be added member by member in order
+     *  without hitting a limit, as long as nothing else enters or leaves the
+     *  mempool in between. */
+    bool CheckPackageLimits(const std::vector<CTransactionRef> &package, const std::vector<int64_t> &vSize, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString) const;
+
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
     void CalculateDescendants(txiter it, setEntries &setDescendants);
 
+    /** Append it and all of its in-mempool descendants to vecDescendants.
+     *  Uses epoch markers instead of a set, so callers walking many chains
+     *  can reuse a single vector. */
+    void CalculateDescendants(txiter it, std::vector<txiter> &vecDescendants) const;
+
+    /** Marks a single walk over the mempool graph.
+     *  While a guard is alive visited() tells whether an entry has already
+     *  been seen, which lets traversals skip std::set bookkeeping. Guards
+     *  must not be nested; cs must be held for the lifetime of the guard. */
+    class EpochGuard
+    {
+    public:
+        EpochGuard(const CTxMemPool& in);
+        ~EpochGuard();
+
+    private:
+        const CTxMemPool& pool;
+
+        EpochGuard(const EpochGuard&);
+        EpochGuard& operator=(const EpochGuard&);
+    };
+
+    /** Returns true if it was already visited in the current epoch, marks it
+     *  visited otherwise. Requires an EpochGuard. */
+    bool visited(txiter it) const
+    {
+        assert(fHasEpochGuard);
+        if (it->nEpoch >= nEpoch)
+            return true;
+        it->nEpoch = nEpoch;
+        return false;
+    }
+
     /** The minimum fee to get into the mempool, which may itself not be enough
       *  for larger-sized transactions.
       *  The incrementalRelayFee policy variable is used to bound the time it
@@ -682,6 +738,9 @@ private:
     void UpdateForDescendants(txiter updateIt,
             cacheMap &cachedDescendants,
             const std::set<uint256> &setExclude);
+    /** Append entryit and its unvisited descendants to vecDescendants within
+     *  the current epoch. */
+    void WalkDescendants(txiter entryit, std::vector<txiter> &vecDescendants) const;
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
     void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
     /** Set ancestor state for an entry */
@@ -0,0 +1,176 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txreconciliation.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "pinsketch.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+static const char RECON_SALT_TAG[] = "Tx Relay Salting";
+
+size_t EstimateSketchCapacity(size_t nLocalSetSize, size_t nRemoteSetSize, uint16_t nQ)
+{
+    size_t nDiff = std::max(nLocalSetSize, nRemoteSetSize) - std::min(nLocalSetSize, nRemoteSetSize);
+    size_t nCapacity = nDiff + std::min(nLocalSetSize, nRemoteSetSize) * nQ / RECON_Q_PRECISION + 1;
+    return std::max(nCapacity, MIN_SKETCH_CAPACITY);
+}
+
+CTxReconciliationState::CTxReconciliationState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt) :
+        fInitiator(fInitiatorIn), fRoundInProgress(false), nRoundStart(0), nNextRequest(0), nSetStart(0)
+{
+    // Both sides derive the same key by hashing the salts in a fixed order
+    unsigned char salts[16];
+    WriteLE64(salts, std::min(nLocalSalt, nRemoteSalt));
+    WriteLE64(salts + 8, std::max(nLocalSalt, nRemoteSalt));
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write((const unsigned char*)RECON_SALT_TAG, strlen(RECON_SALT_TAG)).Write(salts, sizeof(salts)).Finalize(hash);
+    k0 = ReadLE64(hash);
+    k1 = ReadLE64(hash + 8);
+}
+
+uint32_t CTxReconciliationState::ComputeShortID(const uint256& txid) const
+{
+    // Sketch elements must be nonzero
+    return 1 + (uint32_t)(SipHashUint256(k0, k1, txid) % 0xFFFFFFFF);
+}
+
+bool CTxReconciliationState::AddToSet(const uint256& txid)
+{
+    const uint32_t nShortID = ComputeShortID(txid);
+    std::map<uint32_t, uint256>::const_iterator it = mapSet.find(nShortID);
+    if (it != mapSet.end())
+        return it->second == txid; // On a collision the first one stays, the peer could only get one
+    if (mapSet.size() >= MAX_RECON_SET_SIZE)
+        return false;
+    mapSet[nShortID] = txid;
+    return true;
+}
+
+void CTxReconciliationState::RemoveFromSet(const uint256& txid)
+{
+    std::map<uint32_t, uint256>::iterator it = mapSet.find(ComputeShortID(txid));
+    if (it != mapSet.end() && it->second == txid)
+        mapSet.erase(it);
+}
+
+void CTxReconciliationState::Freeze(int64_t nNow, std::vector<uint256>& vAnnounce)
+{
+    if (fRoundInProgress)
+        AnnounceSnapshot(vAnnounce);
+    mapSnapshot.swap(mapSet);
+    mapSet.clear();
+    nSetStart = 0;
+    fRoundInProgress = true;
+    nRoundStart = nNow;
+}
+
+void CTxReconciliationState::AnnounceSnapshot(std::vector<uint256>& vAnnounce) const
+{
+    for (std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.begin(); it != mapSnapshot.end(); ++it)
+        vAnnounce.push_back(it->second);
+}
+
+void CTxReconciliationState::EndRound()
+{
+    mapSnapshot.clear();
+    fRoundInProgress = false;
+}
+
+bool CTxReconciliationState::ShouldRequest(int64_t nNow) const
+{
+    return fInitiator && !fRoundInProgress && nNow >= nNextRequest;
+}
+
+uint16_t CTxReconciliationState::StartRound(int64_t nNow)
+{
+    assert(fInitiator && !fRoundInProgress);
+    std::vector<uint256> vUnused;
+    Freeze(nNow, vUnused);
+    nNextRequest = nNow + RECON_REQUEST_INTERVAL;
+    return mapSnapshot.size();
+}
+
+bool CTxReconciliationState::ProcessSketch(const std::vector<uint32_t>& vSketch, std::vector<uint256>& vAnnounce, std::vector<uint32_t>& vAsk)
+{
+    assert(fInitiator && fRoundInProgress);
+    std::vector<uint32_t> vDiff;
+    bool fSuccess = false;
+    if (!vSketch.empty() && vSketch.size() <= MAX_SKETCH_CAPACITY) {
+        CPinSketch sketch(vSketch);
+        CPinSketch local(vSketch.size());
+        for (std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.begin(); it != mapSnapshot.end(); ++it)
+            local.Add(it->first);
+        sketch.Merge(local);
+        fSuccess = sketch.Decode(vDiff);
+    }
+
+    if (!fSuccess) {
+        AnnounceSnapshot(vAnnounce);
+    } else {
+        for (uint32_t nShortID : vDiff) {
+            std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.find(nShortID);
+            if (it != mapSnapshot.end())
+                vAnnounce.push_back(it->second);
+            else
+                vAsk.push_back(nShortID);
+        }
+    }
+    EndRound();
+    return fSuccess;
+}
+
+std::vector<uint32_t> CTxReconciliationState::RespondToRequest(int64_t nNow, uint16_t nRemoteSetSize, uint16_t nQ, std::vector<uint256>& vAnnounce)
+{
+    assert(!fInitiator);
+    Freeze(nNow, vAnnounce);
+    size_t nCapacity = EstimateSketchCapacity(mapSnapshot.size(), nRemoteSetSize, nQ);
+    if (nCapacity > MAX_SKETCH_CAPACITY)
+        return std::vector<uint32_t>();
+    CPinSketch sketch(nCapacity);
+    for (std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.begin(); it != mapSnapshot.end(); ++it)
+        sketch.Add(it->first);
+    return sketch.GetSyndromes();
+}
+
+void CTxReconciliationState::ProcessDiff(bool fSuccess, const std::vector<uint32_t>& vAsk, std::vector<uint256>& vAnnounce)
+{
+    assert(!fInitiator);
+    if (!fRoundInProgress)
+        return;
+    if (!fSuccess) {
+        AnnounceSnapshot(vAnnounce);
+    } else {
+        for (uint32_t nShortID : vAsk) {
+            std::map<uint32_t, uint256>::const_iterator it = mapSnapshot.find(nShortID);
+            if (it != mapSnapshot.end())
+                vAnnounce.push_back(it->second);
+        }
+    }
+    EndRound();
+}
+
+void CTxReconciliationState::CheckTimeout(int64_t nNow, std::vector<uint256>& vAnnounce)
+{
+    if (fRoundInProgress && nNow > nRoundStart + RECON_ROUND_TIMEOUT) {
+        AnnounceSnapshot(vAnnounce);
+        EndRound();
+    }
+    if (fInitiator || mapSet.empty())
+        return;
+    if (!nSetStart) {
+        nSetStart = nNow;
+    } else if (nNow > nSetStart + RECON_ROUND_TIMEOUT) {
+        // The peer stopped reconciling, or never started
+        for (std::map<uint32_t, uint256>::const_iterator it = mapSet.begin(); it != mapSet.end(); ++it)
+            vAnnounce.push_back(it->second);
+        mapSet.clear();
+        nSetStart = 0;
+    }
+}
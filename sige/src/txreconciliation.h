@@ -0,0 +1,122 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __sig_txreconciliation_h__
+#define __sig_txreconciliation_h__
+
+#include "uint256.h"
+
+#include <map>
+#include <vector>
+
+/** Default for -txreconciliation */
+static const bool DEFAULT_TXRECONCILIATION_ENABLE = false;
+/** Version of the reconciliation protocol sent in "sendrecon" */
+static const uint32_t TXRECONCILIATION_VERSION = 1;
+/** Seconds between the reconciliation rounds we start with each outbound peer */
+static const int64_t RECON_REQUEST_INTERVAL = 8;
+/**
+ * Seconds after which an unfinished round is abandoned and its set announced
+ * by inv; also how long a responder keeps transactions for a peer that does
+ * not ask for them
+ */
+static const int64_t RECON_ROUND_TIMEOUT = 60;
+/** Largest sketch we build or accept; decoding cost grows quadratically */
+static const size_t MAX_SKETCH_CAPACITY = 128;
+/**
+ * Smallest sketch we build. An overfull sketch of capacity c decodes to a
+ * wrong set with probability about 1/c!, and a few spare syndromes cost far
+ * less than the invs they replace.
+ */
+static const size_t MIN_SKETCH_CAPACITY = 8;
+/** Past this many pending transactions, further ones are flooded to the peer instead */
+static const size_t MAX_RECON_SET_SIZE = 2000;
+/** Number of outbound reconciling peers we still flood to, for fast propagation */
+static const int MAX_RECON_FLOOD_OUTBOUND = 2;
+/** Fixed-point precision of the q coefficient sent in "reqrecon" */
+static const uint16_t RECON_Q_PRECISION = (1 << 15) - 1;
+/** Our q: the expected set difference as a fraction of the smaller set */
+static const uint16_t DEFAULT_RECON_Q = RECON_Q_PRECISION / 4;
+
+/** Sketch capacity for reconciling sets of the given sizes, with a safety margin */
+size_t EstimateSketchCapacity(size_t nLocalSetSize, size_t nRemoteSetSize, uint16_t nQ);
+
+/**
+ * Transaction reconciliation state for one peer, modelled on Erlay (BIP 330).
+ *
+ * Transactions we would announce to the peer are collected in a set instead
+ * of being sent by inv. Every RECON_REQUEST_INTERVAL the outbound side (the
+ * initiator) sends its set size; the other side freezes its set and answers
+ * with a PinSketch of it. The initiator merges that with a sketch of its own
+ * frozen set, decodes the difference, announces what the peer lacks and asks
+ * for the short IDs it lacks. A round costs a few bytes per differing
+ * transaction instead of an inv per transaction in each direction.
+ */
+class CTxReconciliationState
+{
+private:
+    //! SipHash key for short IDs, derived from both sides' salts
+    uint64_t k0, k1;
+    //! Whether we start rounds (outbound connection) or answer them
+    bool fInitiator;
+    //! Transactions collected for the next round, by short ID
+    std::map<uint32_t, uint256> mapSet;
+    //! The set frozen for the round in progress
+    std::map<uint32_t, uint256> mapSnapshot;
+    bool fRoundInProgress;
+    int64_t nRoundStart;
+    int64_t nNextRequest;
+    //! Responder: when CheckTimeout first saw mapSet non-empty, or 0
+    int64_t nSetStart;
+
+    //! Freeze the current set for a new round, announcing any abandoned one
+    void Freeze(int64_t nNow, std::vector<uint256>& vAnnounce);
+    void AnnounceSnapshot(std::vector<uint256>& vAnnounce) const;
+    void EndRound();
+
+public:
+    CTxReconciliationState(bool fInitiatorIn, uint64_t nLocalSalt, uint64_t nRemoteSalt);
+
+    bool IsInitiator() const { return fInitiator; }
+    size_t GetSetSize() const { return mapSet.size(); }
+    bool IsRoundInProgress() const { return fRoundInProgress; }
+    uint32_t ComputeShortID(const uint256& txid) const;
+
+    /**
+     * Queue a transaction for reconciliation. False if it should be flooded
+     * instead: the set is full, or another transaction has its short ID.
+     */
+    bool AddToSet(const uint256& txid);
+    /** Drop a transaction the peer turned out to have already */
+    void RemoveFromSet(const uint256& txid);
+
+    /** Initiator: whether it is time to start a round */
+    bool ShouldRequest(int64_t nNow) const;
+    /** Initiator: freeze our set and return its size for "reqrecon" */
+    uint16_t StartRound(int64_t nNow);
+    /**
+     * Initiator: reconcile against the peer's sketch. On success vAnnounce
+     * holds our transactions the peer lacks and vAsk the short IDs we lack;
+     * on failure vAnnounce holds our whole frozen set.
+     */
+    bool ProcessSketch(const std::vector<uint32_t>& vSketch, std::vector<uint256>& vAnnounce, std::vector<uint32_t>& vAsk);
+
+    /**
+     * Responder: freeze our set and return a sketch of it for the peer, or
+     * an empty sketch if the difference is too large to reconcile. A round
+     * the peer abandoned is announced through vAnnounce first.
+     */
+    std::vector<uint32_t> RespondToRequest(int64_t nNow, uint16_t nRemoteSetSize, uint16_t nQ, std::vector<uint256>& vAnnounce);
+    /** Responder: close the round; vAnnounce gets what the peer asked for, or everything on failure */
+    void ProcessDiff(bool fSuccess, const std::vector<uint32_t>& vAsk, std::vector<uint256>& vAnnounce);
+
+    /**
+     * Abandon a round the peer has not completed in time, announcing our
+     * frozen set instead. A responder whose peer has not asked for its set
+     * in that time announces the set as well.
+     */
+    void CheckTimeout(int64_t nNow, std::vector<uint256>& vAnnounce);
+};
+
+#endif  /* __sig_txreconciliation_h__ */
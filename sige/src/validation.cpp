@@ -36,6 +36,8 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <deque>
+#include <limits>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -57,6 +59,7 @@ CBlockIndex *pindexBestHeader = NULL;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+std::atomic<uint64_t> nMempoolParallelScriptChecks(0);
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
@@ -484,6 +487,42 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 
 
 
+/**
+ * Whether two inputs of tx spend the same outpoint. Larger transactions are
+ * bucketed in an open-addressed table keyed by a salted hash, which stays
+ * linear in the number of inputs without a std::set node per input.
+ */
+static bool HasDuplicateInputs(const CTransaction& tx)
+{
+    static const uint64_t k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    static const uint64_t k1 = GetRand(std::numeric_limits<uint64_t>::max());
+
+    const size_t nInputs = tx.vin.size();
+    if (nInputs <= 8) {
+        for (size_t i = 1; i < nInputs; i++)
+            for (size_t j = 0; j < i; j++)
+                if (tx.vin[i].prevout == tx.vin[j].prevout)
+                    return true;
+        return false;
+    }
+
+    size_t nBuckets = 16;
+    while (nBuckets < 2 * nInputs)
+        nBuckets <<= 1;
+    std::vector<uint32_t> vBuckets(nBuckets, 0); // Input index + 1, 0 if empty
+    for (size_t i = 0; i < nInputs; i++) {
+        const COutPoint& prevout = tx.vin[i].prevout;
+        size_t nBucket = (SipHashUint256(k0, k1, prevout.hash) + prevout.n * UINT64_C(0x9e3779b97f4a7c15)) & (nBuckets - 1);
+        while (vBuckets[nBucket]) {
+            if (tx.vin[vBuckets[nBucket] - 1].prevout == prevout)
+                return true;
+            nBucket = (nBucket + 1) & (nBuckets - 1);
+        }
+        vBuckets[nBucket] = i + 1;
+    }
+    return false;
+}
+
 bool CheckTransaction(const CTransaction& tx, CValidationState &state, bool fCheckDuplicateInputs)
 {
     // Basic checks that don't depend on any context
@@ -508,15 +547,9 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state, bool fChe
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-txouttotal-toolarge");
     }
 
-    // Check for duplicate inputs - note that this check is slow so we skip it in CheckBlock
-    if (fCheckDuplicateInputs) {
-        std::set<COutPoint> vInOutPoints;
-        for (const auto& txin : tx.vin)
-        {
-            if (!vInOutPoints.insert(txin.prevout).second)
-                return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
-        }
-    }
+    // Check for duplicate inputs
+    if (fCheckDuplicateInputs && HasDuplicateInputs(tx))
+        return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
 
     if (tx.IsCoinBase())
     {
@@ -565,6 +598,31 @@ static bool IsCurrentForFeeEstimation()
     return true;
 }
 
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+/**
+ * CheckInputs for a mempool candidate. The script checks of transactions with
+ * many inputs are handed to the script-checking threads instead of running
+ * serially on the calling thread. If any of them fails, the serial path is
+ * re-run so that state carries the usual reject reason and DoS score.
+ * The queue is shared with ConnectBlock; both run under cs_main.
+ */
+static bool CheckInputsForMempool(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags, PrecomputedTransactionData& txdata)
+{
+    AssertLockHeld(cs_main);
+    if (nScriptCheckThreads && tx.vin.size() >= MEMPOOL_PARALLEL_SCRIPTCHECK_MIN_INPUTS) {
+        std::vector<CScriptCheck> vChecks;
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        if (!CheckInputs(tx, state, view, true, flags, true, txdata, &vChecks))
+            return false;
+        control.Add(vChecks);
+        nMempoolParallelScriptChecks++;
+        if (control.Wait())
+            return true;
+    }
+    return CheckInputs(tx, state, view, true, flags, true, txdata);
+}
+
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                               bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache)
@@ -575,8 +633,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
-    if (!CheckTransaction(tx, state))
-        return false; // state filled in by CheckTransaction
+    // CheckTransaction has been run by the caller
 
     // Coinbase is only valid in a block, not as a loose transaction
     if (tx.IsCoinBase())
@@ -944,7 +1001,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        if (!CheckInputsForMempool(tx, state, view, scriptVerifyFlags, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
@@ -966,7 +1023,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
+        if (!CheckInputsForMempool(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS, txdata))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToHexString(), FormatStateMessage(state));
@@ -1002,8 +1059,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         }
     }
 
-    GetMainSignals().SyncTransaction(tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
-
+    // The caller fires SyncTransaction, once the pool is trimmed
     return true;
 }
 
@@ -1011,9 +1067,16 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                         bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+    if (!CheckTransaction(*tx, state))
+        return false; // state filled in by CheckTransaction
+
     std::vector<uint256> vHashTxToUncache;
     bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
-    if (!res) {
+    if (res) {
+        GetMainSignals().SyncTransaction(*tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+    } else {
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
     }
@@ -1030,6 +1093,254 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee);
 }
 
+/**
+ * Run the script checks of the batch members in vTry on the script-checking
+ * threads, all in one go, whatever each member's input count. The signatures
+ * of members that pass are then in the signature cache by the time
+ * AcceptToMemoryPoolWorker checks them one by one under cs_main. Failures
+ * are left for the worker to report. vOrder has parents ahead of their
+ * children; coins fetched into pcoinsTip for member i are added to
+ * vHashTxnToUncache[i].
+ */
+static void PrecheckBatchScripts(const CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, const std::vector<size_t>& vOrder,
+                                 const std::vector<bool>& vTry, std::vector<std::vector<uint256> >& vHashTxnToUncache)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads)
+        return;
+
+    unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!Params().RequireStandard())
+        scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+
+    // The checks point into these until control is done with them
+    std::deque<PrecomputedTransactionData> dequeTxData;
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    {
+        LOCK(pool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        view.SetBackend(viewMemPool);
+        // Bring the best block into scope, CheckInputs needs the spend height
+        view.GetBestBlock();
+        BOOST_FOREACH(size_t i, vOrder) {
+            if (!vTry[i])
+                continue;
+            const CTransaction& tx = *vtx[i];
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                    vHashTxnToUncache[i].push_back(txin.prevout.hash);
+            }
+            if (view.HaveInputs(tx)) {
+                dequeTxData.emplace_back(tx);
+                std::vector<CScriptCheck> vChecks;
+                CValidationState stateDummy;
+                if (CheckInputs(tx, stateDummy, view, true, scriptVerifyFlags, true, dequeTxData.back(), &vChecks))
+                    control.Add(vChecks);
+            }
+            // Later members may spend this one
+            view.ModifyCoins(tx.GetHash())->FromTx(tx, MEMPOOL_HEIGHT);
+        }
+    }
+    control.Wait();
+}
+
+/** Representative of the package batch member i belongs to, see AcceptToMemoryPoolBatch */
+static size_t FindBatchPackage(std::vector<size_t>& vPackageOf, size_t i)
+{
+    while (vPackageOf[i] != i)
+        i = vPackageOf[i] = vPackageOf[vPackageOf[i]];
+    return i;
+}
+
+/**
+ * The virtual size each member of a package would have as a mempool entry,
+ * sigop cost included as in AcceptToMemoryPoolWorker. Parents must come before
+ * their children. A member whose inputs can't all be found is counted without
+ * sigops; it fails with missing inputs when it is tried.
+ */
+static std::vector<int64_t> GetPackageTxSizes(const CTxMemPool& pool, const std::vector<CTransactionRef>& vPackage, std::vector<uint256>& vHashTxnToUncache)
+{
+    AssertLockHeld(cs_main);
+    std::vector<int64_t> vSize;
+    vSize.reserve(vPackage.size());
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    LOCK(pool.cs);
+    CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+    view.SetBackend(viewMemPool);
+    BOOST_FOREACH(const CTransactionRef& ptx, vPackage) {
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin) {
+            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                vHashTxnToUncache.push_back(txin.prevout.hash);
+        }
+        int64_t nSigOpsCost = 0;
+        if (view.HaveInputs(*ptx))
+            nSigOpsCost = GetTransactionSigOpCost(*ptx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+        vSize.push_back(GetVirtualTransactionSize(*ptx, nSigOpsCost));
+        // Later members may spend this one
+        view.ModifyCoins(ptx->GetHash())->FromTx(*ptx, MEMPOOL_HEIGHT);
+    }
+    return vSize;
+}
+
+unsigned int AcceptToMemoryPoolBatch(CTxMemPool& pool, std::vector<CValidationState>& vState, std::vector<bool>& vMissingInputs,
+                        const std::vector<CTransactionRef>& vtx, const std::vector<int64_t>& vAcceptTime, bool fLimitFree,
+                        std::list<CTransactionRef>* plTxnReplaced, const CAmount nAbsurdFee,
+                        const std::vector<int64_t>* pvSource)
+{
+    const size_t nTx = vtx.size();
+    assert(vAcceptTime.empty() || vAcceptTime.size() == nTx);
+    vState.assign(nTx, CValidationState());
+    vMissingInputs.assign(nTx, false);
+
+    // Context-free checks need no lock; weed out malformed members before
+    // anything else waits on cs_main.
+    std::map<uint256, size_t> mapBatch;
+    for (size_t i = 0; i < nTx; i++) {
+        if (CheckTransaction(*vtx[i], vState[i]))
+            mapBatch.insert(std::make_pair(vtx[i]->GetHash(), i));
+    }
+
+    // Order the candidates so that in-batch parents are handled before their
+    // children; otherwise a child submitted first would fail with missing inputs.
+    std::vector<std::vector<size_t> > vChildren(nTx);
+    std::vector<unsigned int> vParentsLeft(nTx, 0);
+    std::deque<size_t> queueReady;
+    for (size_t i = 0; i < nTx; i++) {
+        if (!vState[i].IsValid())
+            continue;
+        std::set<size_t> setParents;
+        BOOST_FOREACH(const CTxIn& txin, vtx[i]->vin) {
+            std::map<uint256, size_t>::const_iterator it = mapBatch.find(txin.prevout.hash);
+            if (it != mapBatch.end() && it->second != i)
+                setParents.insert(it->second);
+        }
+        BOOST_FOREACH(size_t parent, setParents)
+            vChildren[parent].push_back(i);
+        vParentsLeft[i] = setParents.size();
+        if (setParents.empty())
+            queueReady.push_back(i);
+    }
+    std::vector<size_t> vOrder;
+    vOrder.reserve(mapBatch.size());
+    while (!queueReady.empty()) {
+        size_t i = queueReady.front();
+        queueReady.pop_front();
+        vOrder.push_back(i);
+        BOOST_FOREACH(size_t child, vChildren[i]) {
+            if (--vParentsLeft[child] == 0)
+                queueReady.push_back(child);
+        }
+    }
+
+    // Split the ordered candidates into packages of in-batch relatives, each
+    // kept in order
+    std::vector<size_t> vPackageOf(nTx);
+    for (size_t i = 0; i < nTx; i++)
+        vPackageOf[i] = i;
+    BOOST_FOREACH(size_t i, vOrder) {
+        BOOST_FOREACH(size_t child, vChildren[i])
+            vPackageOf[FindBatchPackage(vPackageOf, child)] = FindBatchPackage(vPackageOf, i);
+    }
+    std::map<size_t, std::vector<size_t> > mapPackages;
+    BOOST_FOREACH(size_t i, vOrder)
+        mapPackages[FindBatchPackage(vPackageOf, i)].push_back(i);
+
+    unsigned int nAccepted = 0;
+    {
+        LOCK(cs_main);
+        const int64_t nNow = GetTime();
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+
+        // A package goes in whole or not at all as far as the chain limits are
+        // concerned: check it as one before any of its members is accepted, so
+        // that a parent is not added only for its children to hit a limit.
+        std::vector<bool> vTry(nTx, false);
+        for (std::map<size_t, std::vector<size_t> >::const_iterator it = mapPackages.begin(); it != mapPackages.end(); ++it) {
+            std::vector<CTransactionRef> vPackage;
+            BOOST_FOREACH(size_t i, it->second) {
+                if (!pool.exists(vtx[i]->GetHash()))
+                    vPackage.push_back(vtx[i]);
+            }
+            std::string errString;
+            if (vPackage.size() > 1) {
+                std::vector<uint256> vHashTxnToUncache;
+                std::vector<int64_t> vSize = GetPackageTxSizes(pool, vPackage, vHashTxnToUncache);
+                if (!pool.CheckPackageLimits(vPackage, vSize, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+                    BOOST_FOREACH(size_t i, it->second)
+                        vState[i].DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-chain", false, errString);
+                    BOOST_FOREACH(const uint256& hashTx, vHashTxnToUncache)
+                        pcoinsTip->Uncache(hashTx);
+                    continue;
+                }
+            }
+            BOOST_FOREACH(size_t i, it->second)
+                vTry[i] = true;
+        }
+
+        std::set<int64_t> setMisbehaving;
+        for (size_t i = 0; pvSource && i < nTx; i++) {
+            int nDoS = 0;
+            if (vState[i].IsInvalid(nDoS) && nDoS > 0)
+                setMisbehaving.insert((*pvSource)[i]);
+        }
+        std::vector<std::vector<uint256> > vHashTxToUncache(nTx);
+        PrecheckBatchScripts(pool, vtx, vOrder, vTry, vHashTxToUncache);
+        BOOST_FOREACH(size_t i, vOrder) {
+            if (!vTry[i])
+                continue;
+            // Whatever else a source that gave us an invalid member sent is left untried
+            if (pvSource && setMisbehaving.count((*pvSource)[i])) {
+                vMissingInputs[i] = true;
+                BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache[i])
+                    pcoinsTip->Uncache(hashTx);
+                continue;
+            }
+            // The size limit is enforced once for the whole batch below
+            bool fMissingInputs = false;
+            if (AcceptToMemoryPoolWorker(pool, vState[i], vtx[i], fLimitFree, &fMissingInputs, vAcceptTime.empty() ? nNow : vAcceptTime[i],
+                                         plTxnReplaced, true, nAbsurdFee, vHashTxToUncache[i])) {
+                ++nAccepted;
+            } else {
+                vMissingInputs[i] = fMissingInputs;
+                BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache[i])
+                    pcoinsTip->Uncache(hashTx);
+                int nDoS = 0;
+                if (pvSource && vState[i].IsInvalid(nDoS) && nDoS > 0)
+                    setMisbehaving.insert((*pvSource)[i]);
+            }
+        }
+
+        if (nAccepted) {
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            BOOST_FOREACH(size_t i, vOrder) {
+                if (vState[i].IsValid() && !vMissingInputs[i] && !pool.exists(vtx[i]->GetHash())) {
+                    vState[i].DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+                    BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache[i])
+                        pcoinsTip->Uncache(hashTx);
+                    --nAccepted;
+                }
+            }
+            // Only what survived the trim is announced
+            BOOST_FOREACH(size_t i, vOrder) {
+                if (vState[i].IsValid() && !vMissingInputs[i])
+                    GetMainSignals().SyncTransaction(*vtx[i], NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+            }
+        }
+
+        CValidationState stateDummy;
+        FlushStateToDisk(stateDummy, FLUSH_STATE_PERIODIC);
+    }
+
+    LogPrint("mempool", "%s: accepted %u of %u transactions\n", __func__, nAccepted, (unsigned int)nTx);
+    return nAccepted;
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1158,6 +1469,40 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Start at the magic and size that WriteBlockToDisk puts before the block
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+    pos.nPos -= CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+        if (memcmp(blockStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+            return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize < 80 + 1 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: Invalid block size %u at %s", __func__, nSize, pos.ToString());
+        vchBlock.resize(nSize);
+        filein.read((char*)vchBlock.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    // The header must hash to the block the index describes
+    if (Hash(vchBlock.begin(), vchBlock.begin() + 80) != pindex->GetBlockHash())
+        return error("%s: Header doesn't match index for %s at %s", __func__, pindex->ToString(), pos.ToString());
+
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1670,13 +2015,51 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
 void ThreadScriptCheck() {
     RenameThread("sigecoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+/** Closure for the context-free checks of one transaction in CheckBlock */
+class CBlockTxCheck
+{
+private:
+    const CTransaction *ptx;
+    unsigned int *pnSigOps;
+
+public:
+    CBlockTxCheck(): ptx(NULL), pnSigOps(NULL) {}
+    CBlockTxCheck(const CTransaction& txIn, unsigned int* pnSigOpsIn): ptx(&txIn), pnSigOps(pnSigOpsIn) {}
+
+    bool operator()() {
+        CValidationState state;
+        if (!CheckTransaction(*ptx, state, false))
+            return false;
+        *pnSigOps = GetLegacySigOpCount(*ptx);
+        return true;
+    }
+
+    void swap(CBlockTxCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(pnSigOps, check.pnSigOps);
+    }
+};
+
+/**
+ * CheckBlock runs outside cs_main as well, so unlike scriptcheckqueue this
+ * queue has its own threads and is claimed with cs_blockcheckqueue. A caller
+ * that finds it busy checks its transactions serially. Its threads sleep
+ * unless a block is being checked, which is when the script-checking ones
+ * are idle, so the two pools do not compete for cores.
+ */
+static CCheckQueue<CBlockTxCheck> blockcheckqueue(16);
+static CCriticalSection cs_blockcheckqueue;
+
+void ThreadBlockCheck() {
+    RenameThread("sigecoin-blockch");
+    blockcheckqueue.Thread();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2841,6 +3224,21 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
         return false;
 
+    // Hand the per-transaction checks to the block-checking threads first,
+    // so they run while the merkle root is computed. Results are only looked
+    // at after the merkle and size checks, keeping the order of rejections.
+    std::vector<unsigned int> vSigOps(block.vtx.size(), 0);
+    TRY_LOCK(cs_blockcheckqueue, lockCheckQueue);
+    const bool fParallel = lockCheckQueue && nScriptCheckThreads && block.vtx.size() >= BLOCK_PARALLEL_CHECK_MIN_TXS;
+    CCheckQueueControl<CBlockTxCheck> control(fParallel ? &blockcheckqueue : NULL);
+    if (fParallel) {
+        std::vector<CBlockTxCheck> vChecks;
+        vChecks.reserve(block.vtx.size());
+        for (size_t i = 0; i < block.vtx.size(); i++)
+            vChecks.push_back(CBlockTxCheck(*block.vtx[i], &vSigOps[i]));
+        control.Add(vChecks);
+    }
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
@@ -2872,16 +3270,22 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
         if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
-    // Check transactions
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, false))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToHexString(), state.GetDebugMessage()));
+    // Check transactions. If a parallel check failed, the serial pass finds
+    // the first failing transaction and fills in state.
+    if (!fParallel || !control.Wait()) {
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = *block.vtx[i];
+            if (!CheckTransaction(tx, state, false))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToHexString(), state.GetDebugMessage()));
+            vSigOps[i] = GetLegacySigOpCount(tx);
+        }
+    }
 
     unsigned int nSigOps = 0;
-    for (const auto& tx : block.vtx)
+    for (size_t i = 0; i < vSigOps.size(); i++)
     {
-        nSigOps += GetLegacySigOpCount(*tx);
+        nSigOps += vSigOps[i];
     }
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
@@ -4167,12 +4571,29 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+//! mempool.dat as written before it carried a checksum
+static const uint64_t MEMPOOL_DUMP_VERSION_NO_CHECKSUM = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+
+/** Double-SHA256 of the next nSize bytes of file, read a chunk at a time */
+static uint256 HashFileData(CAutoFile& file, uint64_t nSize)
+{
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    std::vector<char> vchChunk(std::min<uint64_t>(nSize, 1 << 16));
+    while (nSize > 0) {
+        size_t nChunk = std::min<uint64_t>(nSize, vchChunk.size());
+        file.read(vchChunk.data(), nChunk);
+        hasher.write(vchChunk.data(), nChunk);
+        nSize -= nChunk;
+    }
+    return hasher.GetHash();
+}
 
 bool LoadMempool(void)
 {
     int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
-    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "r");
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    FILE* filestr = fopen(pathMempool.string().c_str(), "rb");
     CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
     if (file.IsNull()) {
         LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
@@ -4183,16 +4604,45 @@ bool LoadMempool(void)
     int64_t skipped = 0;
     int64_t failed = 0;
     int64_t nNow = GetTime();
+    int64_t nStart = GetTimeMicros();
 
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+        if (version == MEMPOOL_DUMP_VERSION_NO_CHECKSUM) {
+            // Left by an earlier release; the entries are the same, there is
+            // just no checksum to verify
+            LogPrintf("Loading mempool file without a checksum (version %u)\n", version);
+        } else if (version != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("Mempool file has unknown version %u, not loaded. Continuing anyway.\n", version);
             return false;
+        } else {
+            // Verify the checksum in a first pass over the file, so that nothing
+            // from a corrupted dump is accepted and the dump is never held in
+            // memory as a whole; the second pass reads it entry by entry.
+            uint64_t fileSize = boost::filesystem::file_size(pathMempool);
+            if (fileSize < sizeof(version) + sizeof(uint256))
+                throw std::runtime_error("file too short");
+            if (fseek(file.Get(), 0, SEEK_SET))
+                throw std::runtime_error("seek failed");
+            uint256 hashData = HashFileData(file, fileSize - sizeof(uint256));
+            uint256 hashIn;
+            file >> hashIn;
+            if (hashIn != hashData) {
+                LogPrintf("Mempool file checksum mismatch, data corrupted. Continuing anyway.\n");
+                return false;
+            }
+            if (fseek(file.Get(), sizeof(version), SEEK_SET))
+                throw std::runtime_error("seek failed");
         }
+
         uint64_t num;
         file >> num;
         double prioritydummy = 0;
+        std::vector<CTransactionRef> vtx;
+        std::vector<int64_t> vTime;
+        std::vector<CValidationState> vState;
+        std::vector<bool> vMissingInputs;
         while (num--) {
             CTransactionRef tx;
             int64_t nTime;
@@ -4205,18 +4655,19 @@ bool LoadMempool(void)
             if (amountdelta) {
                 mempool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToHexString(), prioritydummy, amountdelta);
             }
-            CValidationState state;
             if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    ++failed;
-                }
+                vtx.push_back(tx);
+                vTime.push_back(nTime);
             } else {
                 ++skipped;
             }
+            if (vtx.size() >= MEMPOOL_LOAD_BATCH_SIZE || (num == 0 && !vtx.empty())) {
+                unsigned int nAccepted = AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, vTime, true);
+                count += nAccepted;
+                failed += vtx.size() - nAccepted;
+                vtx.clear();
+                vTime.clear();
+            }
             if (ShutdownRequested())
                 return false;
         }
@@ -4231,7 +4682,7 @@ bool LoadMempool(void)
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired (%.2fs)\n", count, failed, skipped, (GetTimeMicros() - nStart) * 0.000001);
     return true;
 }
 
@@ -4247,13 +4698,16 @@ void DumpMempool(void)
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second.second;
         }
+        // Sorted by ancestor count, so parents always precede their children
         vinfo = mempool.infoAll();
     }
 
     int64_t mid = GetTimeMicros();
 
     try {
-        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "w");
+        // Opened for reading too: the checksum is computed over what was
+        // written, by reading it back a chunk at a time
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb+");
         if (!filestr) {
             return;
         }
@@ -4272,6 +4726,15 @@ void DumpMempool(void)
         }
 
         file << mapDeltas;
+
+        long nDataSize = ftell(file.Get());
+        if (nDataSize < 0 || fseek(file.Get(), 0, SEEK_SET))
+            throw std::runtime_error("seek failed");
+        uint256 hash = HashFileData(file, nDataSize);
+        if (fseek(file.Get(), nDataSize, SEEK_SET))
+            throw std::runtime_error("seek failed");
+        file << hash;
+
         FileCommit(file.Get());
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
@@ -66,6 +66,8 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
+/** Number of mempool.dat transactions accepted per cs_main acquisition when loading */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 1000;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -77,8 +79,19 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Minimum number of inputs for a mempool candidate's script checks to be spread over the script-checking threads */
+static const unsigned int MEMPOOL_PARALLEL_SCRIPTCHECK_MIN_INPUTS = 8;
+/** Minimum number of transactions for CheckBlock to spread its per-transaction checks over the block-checking threads */
+static const unsigned int BLOCK_PARALLEL_CHECK_MIN_TXS = 16;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks in transit from a single peer once its download rate has been measured. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** Seconds of a peer's measured block download rate that we keep requested from it, on top of its ping time. */
+static const unsigned int BLOCK_DOWNLOAD_QUEUE_TIME = 4;
+/** Seconds a block must have been in transit from a much slower peer before we request it from a faster one too. */
+static const unsigned int BLOCK_REREQUEST_TIMEOUT = 1;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -91,9 +104,13 @@ static const int MAX_CMPCTBLOCK_DEPTH = 5;
 static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
- *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
- *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
+ *  degree of disordering of blocks on disk (which make reindexing and pruning harder). This is the
+ *  smallest window; it widens with the combined download rate of our peers unless we prune. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Largest the block download window grows to. */
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 4096;
+/** Seconds of the combined block download rate of all peers that the download window should cover. */
+static const unsigned int BLOCK_DOWNLOAD_WINDOW_TIME = 60;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -163,6 +180,8 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+/** Number of times a mempool candidate's script checks were run on the script-checking threads */
+extern std::atomic<uint64_t> nMempoolParallelScriptChecks;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -260,6 +279,8 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the block checking thread */
+void ThreadBlockCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -321,6 +342,24 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** (try to) add a batch of transactions to memory pool under a single cs_main acquisition.
+ * Context-free checks run for the whole batch before the lock is taken, in-batch
+ * parents are processed before their children whatever their order in vtx, and the
+ * pool is trimmed once for the batch before any transaction is announced, and the
+ * coins cache is flushed once. In-batch relatives form a package that is checked
+ * against the ancestor and descendant limits as a whole before any of it is accepted.
+ * vAcceptTime is either empty (use the current time) or holds one time per transaction.
+ * vState and vMissingInputs are filled in the order of vtx; transaction i was accepted
+ * if vState[i] is valid and vMissingInputs[i] is false.
+ * pvSource optionally holds where each transaction came from (the peer that sent
+ * it); once one of them is found invalid with a DoS score, the source's members that
+ * were not tried yet are left untried and reported like transactions with missing inputs.
+ * Returns the number of accepted transactions. **/
+unsigned int AcceptToMemoryPoolBatch(CTxMemPool& pool, std::vector<CValidationState>& vState, std::vector<bool>& vMissingInputs,
+                        const std::vector<CTransactionRef>& vtx, const std::vector<int64_t>& vAcceptTime, bool fLimitFree,
+                        std::list<CTransactionRef>* plTxnReplaced = NULL, const CAmount nAbsurdFee=0,
+                        const std::vector<int64_t>* pvSource = NULL);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -464,6 +503,8 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block's serialization as stored, which is its network encoding with witnesses, checking it against the index */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
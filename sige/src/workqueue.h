@@ -0,0 +1,214 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef __sig_work_queue_h__
+#define __sig_work_queue_h__
+
+#include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Work queue for distributing work over multiple threads.
+ * Work items are simply callable objects.
+ *
+ * Every worker thread owns a lane with its own lock, and producers spread
+ * items over the lanes round robin, so neither producers nor workers all
+ * serialize on one mutex. A worker whose lane runs dry takes the oldest item
+ * from the other lanes before it goes to sleep, so an item queued behind a
+ * long running request (a long poll, say) is still picked up by an idle
+ * worker.
+ */
+template <typename WorkItem>
+class WorkQueue
+{
+private:
+    struct Lane
+    {
+        std::mutex cs;
+        std::condition_variable cond;
+        std::deque<std::unique_ptr<WorkItem>> queue;
+        //! Set while the lane's worker waits for work, cleared by whoever wakes it
+        bool fSleeping;
+
+        Lane() : fSleeping(false) {}
+    };
+
+    std::vector<std::unique_ptr<Lane>> lanes;
+    size_t maxDepth;
+    //! Items reserved against maxDepth, including ones being enqueued
+    std::atomic<size_t> nReserved;
+    //! Items sitting in the lanes; only changed with the lane's lock held
+    std::atomic<size_t> nQueued;
+    //! Workers that announced they are about to sleep
+    std::atomic<int> nSleeping;
+    std::atomic<size_t> nNextLane;
+    std::atomic<bool> running;
+
+    /** Protects numThreads */
+    std::mutex csThreads;
+    std::condition_variable condThreads;
+    int numThreads;
+
+    /** RAII object to keep track of number of running worker threads */
+    class ThreadCounter
+    {
+    public:
+        WorkQueue &wq;
+        ThreadCounter(WorkQueue &w): wq(w)
+        {
+            std::lock_guard<std::mutex> lock(wq.csThreads);
+            wq.numThreads += 1;
+        }
+        ~ThreadCounter()
+        {
+            std::lock_guard<std::mutex> lock(wq.csThreads);
+            wq.numThreads -= 1;
+            wq.condThreads.notify_all();
+        }
+    };
+
+    /** Take the oldest item from a lane */
+    bool PopFrom(Lane& lane, std::unique_ptr<WorkItem>& item)
+    {
+        std::lock_guard<std::mutex> lock(lane.cs);
+        if (lane.queue.empty())
+            return false;
+        item = std::move(lane.queue.front());
+        lane.queue.pop_front();
+        nQueued--;
+        nReserved--;
+        return true;
+    }
+
+    /** Take an item from our own lane, or else from any other */
+    bool Pop(size_t nLane, std::unique_ptr<WorkItem>& item)
+    {
+        for (size_t i = 0; i < lanes.size() && nQueued > 0; i++) {
+            if (PopFrom(*lanes[(nLane + i) % lanes.size()], item))
+                return true;
+        }
+        return false;
+    }
+
+    /** Wake a sleeping worker, trying the lane that got the item first */
+    void WakeOne(size_t nLane)
+    {
+        for (size_t i = 0; i < lanes.size() && nSleeping > 0; i++) {
+            Lane& lane = *lanes[(nLane + i) % lanes.size()];
+            std::lock_guard<std::mutex> lock(lane.cs);
+            if (lane.fSleeping) {
+                lane.fSleeping = false;
+                nSleeping--;
+                lane.cond.notify_one();
+                return;
+            }
+        }
+    }
+
+public:
+    WorkQueue(size_t _maxDepth, int nLanes) : maxDepth(_maxDepth),
+                                              nReserved(0),
+                                              nQueued(0),
+                                              nSleeping(0),
+                                              nNextLane(0),
+                                              running(true),
+                                              numThreads(0)
+    {
+        assert(nLanes > 0);
+        for (int i = 0; i < nLanes; i++)
+            lanes.emplace_back(new Lane());
+    }
+    /** Precondition: worker threads have all stopped
+     * (call WaitExit)
+     */
+    ~WorkQueue()
+    {
+    }
+    /** Number of lanes, one for each worker thread to run */
+    size_t Lanes() const { return lanes.size(); }
+    /** Number of items that can be enqueued before the queue is full */
+    size_t FreeDepth() const
+    {
+        size_t nUsed = nReserved;
+        return nUsed < maxDepth ? maxDepth - nUsed : 0;
+    }
+    /** Enqueue a work item */
+    bool Enqueue(WorkItem* item)
+    {
+        if (nReserved.fetch_add(1) >= maxDepth) {
+            nReserved--;
+            return false;
+        }
+        size_t nLane = nNextLane.fetch_add(1) % lanes.size();
+        {
+            Lane& lane = *lanes[nLane];
+            std::lock_guard<std::mutex> lock(lane.cs);
+            lane.queue.emplace_back(std::unique_ptr<WorkItem>(item));
+            nQueued++;
+        }
+        // A worker announces itself in nSleeping before its last look at
+        // nQueued, so either it sees this item or we see it
+        if (nSleeping > 0)
+            WakeOne(nLane);
+        return true;
+    }
+    /** Thread function, run by one thread for each lane */
+    void Run(size_t nLane)
+    {
+        assert(nLane < lanes.size());
+        ThreadCounter count(*this);
+        Lane& lane = *lanes[nLane];
+        while (running) {
+            std::unique_ptr<WorkItem> i;
+            bool fFound = Pop(nLane, i);
+            if (!fFound) {
+                // Give producers a moment before paying for a sleep and a wakeup
+                std::this_thread::yield();
+                fFound = Pop(nLane, i);
+            }
+            if (fFound) {
+                (*i)();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(lane.cs);
+            lane.fSleeping = true;
+            nSleeping++;
+            while (running && lane.fSleeping && nQueued == 0)
+                lane.cond.wait(lock);
+            if (lane.fSleeping) {
+                lane.fSleeping = false;
+                nSleeping--;
+            }
+        }
+    }
+    /** Interrupt and exit loops */
+    void Interrupt()
+    {
+        running = false;
+        for (const std::unique_ptr<Lane>& lane : lanes) {
+            std::lock_guard<std::mutex> lock(lane->cs);
+            lane->cond.notify_all();
+        }
+    }
+    /** Wait for worker threads to exit */
+    void WaitExit()
+    {
+        std::unique_lock<std::mutex> lock(csThreads);
+        while (numThreads > 0)
+            condThreads.wait(lock);
+    }
+
+    /** Return current depth of queue */
+    size_t Depth()
+    {
+        return nQueued;
+    }
+};
+
+#endif  /* __sig_work_queue_h__ */
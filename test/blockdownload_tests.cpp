@@ -0,0 +1,110 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netprocessing.h"
+#include "validation.h"
+
+#include "test/test_sigecoin.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(block_download_rate)
+{
+    static const struct {
+        int64_t nBlockTimeAvg, nBlockBytesPerSec, nLastBlockReceived;
+        int64_t nTimeRequested;
+        size_t nBlockSize;
+        int64_t nNow;
+        int64_t nExpectedTimeAvg, nExpectedBytesPerSec;
+    } tests[] = {
+        // The first sample is taken as it is
+        {0, 0, 0, 1000000, 1000000, 1500000, 500000, 2000000},
+        // Timed from the previous block when that came in after the request
+        {500000, 2000000, 2000000, 1000000, 500000, 2250000, 468750, 2000000},
+        // Later samples weigh 1/8
+        {400000, 1000000, 0, 0, 800000, 1200000, 500000, 958334},
+        // A block can not take less than a microsecond
+        {0, 0, 0, 5, 100, 5, 1, 100000000},
+    };
+    for (const auto& test : tests) {
+        int64_t nBlockTimeAvg = test.nBlockTimeAvg;
+        int64_t nBlockBytesPerSec = test.nBlockBytesPerSec;
+        int64_t nLastBlockReceived = test.nLastBlockReceived;
+        UpdateBlockDownloadRate(nBlockTimeAvg, nBlockBytesPerSec, nLastBlockReceived, test.nTimeRequested, test.nBlockSize, test.nNow);
+        BOOST_CHECK_EQUAL(nBlockTimeAvg, test.nExpectedTimeAvg);
+        BOOST_CHECK_EQUAL(nBlockBytesPerSec, test.nExpectedBytesPerSec);
+        BOOST_CHECK_EQUAL(nLastBlockReceived, test.nNow);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blocks_in_transit_limit)
+{
+    static const struct {
+        int64_t nBlockTimeAvg, nPingUsec;
+        int nExpected;
+    } tests[] = {
+        // Unmeasured peers get the fixed default
+        {0, 0, MAX_BLOCKS_IN_TRANSIT_PER_PEER},
+        {0, 100000, MAX_BLOCKS_IN_TRANSIT_PER_PEER},
+        // BLOCK_DOWNLOAD_QUEUE_TIME worth, plus one
+        {1000000, 0, 5},
+        {100000, 0, 41},
+        // ... plus the ping time, if there is one
+        {500000, 1000000, 11},
+        {1000000, std::numeric_limits<int64_t>::max(), 5},
+        // Within bounds
+        {10000, 0, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER},
+        {10000000, 0, MIN_BLOCKS_IN_TRANSIT_PER_PEER},
+    };
+    for (const auto& test : tests)
+        BOOST_CHECK_EQUAL(GetBlocksInTransitLimit(test.nBlockTimeAvg, test.nPingUsec), test.nExpected);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    static const struct {
+        int64_t nDownloadRate;
+        bool fPrune;
+        int nExpected;
+    } tests[] = {
+        {0, false, BLOCK_DOWNLOAD_WINDOW},
+        {2000, false, 2000},
+        {10000, false, MAX_BLOCK_DOWNLOAD_WINDOW},
+        // Pruning nodes keep the smallest window
+        {0, true, BLOCK_DOWNLOAD_WINDOW},
+        {2000, true, BLOCK_DOWNLOAD_WINDOW},
+    };
+    for (const auto& test : tests)
+        BOOST_CHECK_EQUAL(GetBlockDownloadWindow(test.nDownloadRate, test.fPrune), test.nExpected);
+}
+
+BOOST_AUTO_TEST_CASE(block_rerequest)
+{
+    static const struct {
+        bool fPartialBlock;
+        int64_t nTimeRequested, nFromBlockTimeAvg, nToBlockTimeAvg, nNow;
+        bool fExpected;
+    } tests[] = {
+        {false, 0, 2000000, 500000, 2000000, true},
+        // Unmeasured senders are gone around, unmeasured receivers not used
+        {false, 0, 0, 500000, 2000000, true},
+        {false, 0, 2000000, 0, 2000000, false},
+        // Compact block reconstructions stay where they are
+        {true, 0, 2000000, 500000, 2000000, false},
+        // Not before BLOCK_REREQUEST_TIMEOUT
+        {false, 1000001, 2000000, 500000, 2000000, false},
+        {false, 1000000, 2000000, 500000, 2000000, true},
+        // Only from peers at least twice as fast
+        {false, 0, 1000000, 500000, 2000000, false},
+        {false, 0, 1000001, 500000, 2000000, true},
+    };
+    for (const auto& test : tests)
+        BOOST_CHECK_EQUAL(ShouldRerequestBlock(test.fPartialBlock, test.nTimeRequested, test.nFromBlockTimeAvg, test.nToBlockTimeAvg, test.nNow), test.fExpected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
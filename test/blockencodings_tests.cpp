@@ -314,6 +314,54 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ShortIDFilterCollisionTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+
+    // A mempool txn outside the block whose short ID has the low bits of a
+    // block txn's, so the filter (1024 bits for a block this small) lets it
+    // through and only the short ID map turns it away
+    const uint64_t blockShortID = shortIDs.GetShortID(block.vtx[1]->GetWitnessHash());
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 43;
+    bool fFound = false;
+    for (int i = 0; i < 1000000 && !fFound; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        const uint64_t shortid = shortIDs.GetShortID(CTransaction(tx).GetWitnessHash());
+        fFound = (shortid & 1023) == (blockShortID & 1023) && shortid != blockShortID;
+    }
+    BOOST_REQUIRE(fFound);
+    CTransactionRef falsePositive = MakeTransactionRef(tx);
+    pool.addUnchecked(falsePositive->GetHash(), entry.FromTx(*falsePositive));
+    pool.addUnchecked(block.vtx[1]->GetHash(), entry.FromTx(*block.vtx[1]));
+    pool.addUnchecked(block.vtx[2]->GetHash(), entry.FromTx(*block.vtx[2]));
+
+    // Another txn whose short ID collides with the second block txn's
+    tx.vin[0].prevout.hash = GetRandHash();
+    std::vector<std::pair<uint256, CTransactionRef>> extra_colliding;
+    extra_colliding.push_back(std::make_pair(block.vtx[2]->GetWitnessHash(), MakeTransactionRef(tx)));
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs, extra_colliding) == READ_STATUS_OK);
+    BOOST_CHECK( partialBlock.IsTxAvailable(0));
+    BOOST_CHECK( partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+
+    // The colliding txn is requested, and the block comes out whole
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[2]}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    bool mutated;
+    BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block2, &mutated).ToString());
+    BOOST_CHECK(!mutated);
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = GetRandHash();
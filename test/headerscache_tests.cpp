@@ -0,0 +1,123 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "headerscache.h"
+#include "streams.h"
+#include "version.h"
+
+#include "test/test_sigecoin.h"
+#include "test/test_random.h"
+
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/** A branch of block indexes with random headers, on top of pprev */
+class TestBranch
+{
+public:
+    std::vector<std::unique_ptr<CBlockIndex> > vIndex;
+    std::vector<std::unique_ptr<uint256> > vHash;
+
+    TestBranch(CBlockIndex* pprev, int nBlocks)
+    {
+        for (int i = 0; i < nBlocks; i++) {
+            CBlockHeader header;
+            header.nVersion = 4;
+            header.hashPrevBlock = pprev ? pprev->GetBlockHash() : uint256();
+            header.hashMerkleRoot = GetRandHash();
+            header.nTime = insecure_rand();
+            header.nBits = 0x207fffff;
+            header.nNonce = insecure_rand();
+            vHash.emplace_back(new uint256(header.GetHash()));
+            vIndex.emplace_back(new CBlockIndex(header));
+            CBlockIndex* pindex = vIndex.back().get();
+            pindex->phashBlock = vHash.back().get();
+            pindex->pprev = pprev;
+            pindex->nHeight = pprev ? pprev->nHeight + 1 : 0;
+            pprev = pindex;
+        }
+    }
+
+    CBlockIndex* Tip() { return vIndex.back().get(); }
+};
+
+static std::vector<unsigned char> ExpectedPayload(const CChain& chain, int nHeight, int nCount)
+{
+    std::vector<CBlock> vHeaders;
+    for (int i = nHeight; i < nHeight + nCount; i++)
+        vHeaders.push_back(chain[i]->GetBlockHeader());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vHeaders;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+BOOST_FIXTURE_TEST_SUITE(headerscache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(headerscache_slices)
+{
+    TestBranch branch(NULL, 100);
+    CChain chain;
+    chain.SetTip(branch.Tip());
+
+    CHeadersCache cache;
+    BOOST_CHECK_EQUAL(cache.Height(), -1);
+    cache.Sync(chain);
+    BOOST_CHECK_EQUAL(cache.Height(), 99);
+
+    std::shared_ptr<const CSharedNetMsg> msg = cache.GetHeadersMsg(10, 50);
+    BOOST_CHECK_EQUAL(msg->command, NetMsgType::HEADERS);
+    BOOST_CHECK(*msg->payload == ExpectedPayload(chain, 10, 50));
+    BOOST_CHECK(*cache.GetHeadersMsg(0, 100)->payload == ExpectedPayload(chain, 0, 100));
+    BOOST_CHECK(*cache.GetHeadersMsg(100, 0)->payload == ExpectedPayload(chain, 100, 0));
+
+    // The same range is served from the response cache
+    BOOST_CHECK(cache.GetHeadersMsg(10, 50) == msg);
+
+    // Old responses are evicted once the cache is full
+    for (size_t i = 0; i < MAX_HEADERS_RESPONSE_CACHE; i++)
+        cache.GetHeadersMsg(i, 1);
+    BOOST_CHECK(cache.GetHeadersMsg(10, 50) != msg);
+}
+
+BOOST_AUTO_TEST_CASE(headerscache_reorg)
+{
+    TestBranch branch(NULL, 100);
+    CChain chain;
+    chain.SetTip(branch.Tip());
+
+    CHeadersCache cache;
+    cache.Sync(chain);
+    std::shared_ptr<const CSharedNetMsg> msgBelow = cache.GetHeadersMsg(0, 60);
+    std::shared_ptr<const CSharedNetMsg> msgAcross = cache.GetHeadersMsg(50, 50);
+
+    // Growing the chain keeps every response
+    TestBranch extension(branch.Tip(), 10);
+    chain.SetTip(extension.Tip());
+    cache.Sync(chain);
+    BOOST_CHECK_EQUAL(cache.Height(), 109);
+    BOOST_CHECK(*cache.GetHeadersMsg(95, 15)->payload == ExpectedPayload(chain, 95, 15));
+    BOOST_CHECK(cache.GetHeadersMsg(50, 50) == msgAcross);
+
+    // A shorter fork off height 79 drops the responses reaching past it
+    TestBranch fork(branch.vIndex[79].get(), 5);
+    chain.SetTip(fork.Tip());
+    cache.Sync(chain);
+    BOOST_CHECK_EQUAL(cache.Height(), 84);
+    BOOST_CHECK(cache.GetHeadersMsg(0, 60) == msgBelow);
+    std::shared_ptr<const CSharedNetMsg> msgFork = cache.GetHeadersMsg(50, 35);
+    BOOST_CHECK(*msgFork->payload == ExpectedPayload(chain, 50, 35));
+
+    // Back to the longer branch
+    chain.SetTip(extension.Tip());
+    cache.Sync(chain);
+    BOOST_CHECK_EQUAL(cache.Height(), 109);
+    BOOST_CHECK(*cache.GetHeadersMsg(0, 110)->payload == ExpectedPayload(chain, 0, 110));
+    BOOST_CHECK(*cache.GetHeadersMsg(50, 35)->payload == ExpectedPayload(chain, 50, 35));
+    BOOST_CHECK(cache.GetHeadersMsg(50, 35) != msgFork);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,170 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "jsonstream.h"
+
+#include "chainparams.h"
+#include "rpc/server.h"
+#include "txmempool.h"
+#include "validation.h"
+
+#include "test/test_sigecoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <include/univalue.h>
+
+#include <string>
+#include <vector>
+
+/** Collects what a writer hands to its sink */
+struct StreamOutput
+{
+    std::string strOutput;
+    size_t nChunks;
+    bool fAccept;
+
+    StreamOutput() : nChunks(0), fAccept(true) {}
+
+    CJSONStreamWriter::Sink Sink()
+    {
+        return [this](const std::string& strChunk) {
+            strOutput += strChunk;
+            nChunks++;
+            return fAccept;
+        };
+    }
+};
+
+/** Stream a method's result and check it against the plain actor's */
+static void CheckStreamedRPC(const std::string& strMethod, const UniValue& params)
+{
+    JSONRPCRequest request;
+    request.strMethod = strMethod;
+    request.params = params;
+
+    StreamOutput output;
+    CJSONStreamWriter writer(output.Sink(), 100);
+    BOOST_CHECK(tableRPC.executeStream(request, writer));
+    BOOST_CHECK(writer.Complete());
+    BOOST_CHECK_EQUAL(output.strOutput + writer.TakeBuffer(), tableRPC.execute(request).write());
+}
+
+BOOST_FIXTURE_TEST_SUITE(jsonstream_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(jsonstream_write)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("escaped \"key\"\n", "tab\there"));
+    inner.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    inner.push_back(Pair("null", NullUniValue));
+
+    UniValue expected(UniValue::VOBJ);
+    expected.push_back(Pair("number", 1.5));
+    expected.push_back(Pair("inner", inner));
+    UniValue list(UniValue::VARR);
+    for (int i = 0; i < 20; i++)
+        list.push_back(inner);
+    list.push_back(UniValue(UniValue::VOBJ));
+    list.push_back(false);
+    expected.push_back(Pair("list", list));
+
+    // Piece by piece, chunk sizes from tiny to larger than the document
+    for (size_t nChunkSize : std::vector<size_t>{1, 7, 64, 1 << 20}) {
+        StreamOutput output;
+        CJSONStreamWriter writer(output.Sink(), nChunkSize);
+        writer.BeginObject();
+        writer.KeyValue("number", 1.5);
+        writer.Key("inner");
+        writer.Value(inner);
+        writer.Key("list");
+        writer.BeginArray();
+        for (int i = 0; i < 20; i++) {
+            writer.BeginObject();
+            writer.Pairs(inner);
+            writer.EndObject();
+            BOOST_CHECK(writer.FlushIfFull());
+            BOOST_CHECK(!writer.Full());
+        }
+        writer.BeginObject();
+        writer.EndObject();
+        writer.Value(false);
+        writer.EndArray();
+        BOOST_CHECK(!writer.Complete());
+        writer.EndObject();
+        BOOST_CHECK(writer.Complete());
+
+        BOOST_CHECK_EQUAL(writer.Flushed(), output.nChunks > 0);
+        BOOST_CHECK_EQUAL(output.strOutput + writer.TakeBuffer(), expected.write());
+        BOOST_CHECK(writer.TakeBuffer().empty());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_sink_refuses)
+{
+    StreamOutput output;
+    output.fAccept = false;
+    CJSONStreamWriter writer(output.Sink(), 4);
+    writer.BeginArray();
+    writer.Value("first");
+    BOOST_CHECK(!writer.FlushIfFull());
+    writer.Value("second");
+    BOOST_CHECK(!writer.FlushIfFull());
+    BOOST_CHECK(!writer.Flush());
+
+    // Nothing more is handed to a sink once it refused output
+    BOOST_CHECK_EQUAL(output.nChunks, 1);
+    BOOST_CHECK_EQUAL(output.strOutput, "[\"first\"");
+}
+
+BOOST_AUTO_TEST_CASE(jsonstream_rpc)
+{
+    SetRPCWarmupFinished();
+
+    UniValue params(UniValue::VARR);
+    params.push_back(Params().GenesisBlock().GetHash().GetHex());
+    CheckStreamedRPC("getblock", params);
+
+    // The hex encoded block is left to the plain actor, and so are methods without a streaming form
+    params.push_back(false);
+    JSONRPCRequest request;
+    request.strMethod = "getblock";
+    request.params = params;
+    StreamOutput output;
+    CJSONStreamWriter writer(output.Sink(), 1);
+    BOOST_CHECK(!tableRPC.executeStream(request, writer));
+    request.strMethod = "getblockcount";
+    request.params = UniValue(UniValue::VARR);
+    BOOST_CHECK(!tableRPC.executeStream(request, writer));
+    BOOST_CHECK(writer.TakeBuffer().empty());
+
+    // Errors in the request are thrown before anything is written
+    request.strMethod = "getblock";
+    request.params.push_back(uint256().GetHex());
+    BOOST_CHECK_THROW(tableRPC.executeStream(request, writer), UniValue);
+    BOOST_CHECK(writer.TakeBuffer().empty());
+    BOOST_CHECK_EQUAL(output.nChunks, 0);
+
+    // A chain of mempool transactions, so entries have dependencies
+    TestMemPoolEntryHelper entry;
+    uint256 hashPrev = GetRandHash();
+    for (int i = 0; i < 10; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = hashPrev;
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 10000 - i;
+        hashPrev = tx.GetHash();
+        mempool.addUnchecked(hashPrev, entry.Fee(1000).FromTx(tx));
+    }
+    UniValue verbose(UniValue::VARR);
+    verbose.push_back(true);
+    CheckStreamedRPC("getrawmempool", verbose);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #include "chainparams.h"
 #include "validation.h"
 #include "net.h"
+#include "streams.h"
 
 #include "test/test_sigecoin.h"
 
@@ -73,4 +74,26 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block, TestChain100Setup)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight += 10) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, chainActive[nHeight], consensusParams));
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+
+        // The stored bytes are the block's network encoding
+        std::vector<unsigned char> vchBlock;
+        BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, chainActive[nHeight], Params().MessageStart()));
+        BOOST_CHECK(vchBlock == std::vector<unsigned char>(ss.begin(), ss.end()));
+    }
+
+    // A record that is not preceded by our magic is refused
+    CMessageHeader::MessageStartChars wrongStart = {0x00, 0x01, 0x02, 0x03};
+    std::vector<unsigned char> vchBlock;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, chainActive.Tip(), wrongStart));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
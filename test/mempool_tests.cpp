@@ -105,6 +105,79 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(testPool.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolEpochTraversalTest)
+{
+    // Diamond: parent -> two children -> one grandchild spending both.
+    // Every entry must be reported exactly once by the epoch based walks.
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 20000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++) {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 10000LL;
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txGrandChild.vin[i].scriptSig = CScript() << OP_11;
+        txGrandChild.vin[i].prevout.hash = txChild[i].GetHash();
+        txGrandChild.vin[i].prevout.n = 0;
+    }
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 15000LL;
+
+    pool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+    pool.addUnchecked(txChild[0].GetHash(), entry.FromTx(txChild[0]));
+    pool.addUnchecked(txChild[1].GetHash(), entry.FromTx(txChild[1]));
+    pool.addUnchecked(txGrandChild.GetHash(), entry.FromTx(txGrandChild));
+
+    CTxMemPool::txiter parentIt = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter grandChildIt = pool.mapTx.find(txGrandChild.GetHash());
+
+    std::vector<CTxMemPool::txiter> vecDescendants;
+    pool.CalculateDescendants(parentIt, vecDescendants);
+    BOOST_CHECK_EQUAL(vecDescendants.size(), 4);
+    BOOST_CHECK(vecDescendants[0] == parentIt);
+    CTxMemPool::setEntries setFromVec(vecDescendants.begin(), vecDescendants.end());
+    CTxMemPool::setEntries setDescendants;
+    pool.CalculateDescendants(parentIt, setDescendants);
+    BOOST_CHECK(setFromVec == setDescendants);
+
+    // A second walk must start from a fresh epoch
+    vecDescendants.clear();
+    pool.CalculateDescendants(parentIt, vecDescendants);
+    BOOST_CHECK_EQUAL(vecDescendants.size(), 4);
+
+    CTxMemPool::setEntries setAncestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*grandChildIt, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 4);
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 4);
+    // Three ancestors plus the entry itself exceed a limit of three
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(*grandChildIt, setAncestors, 3, nNoLimit, nNoLimit, nNoLimit, dummy));
+
+    pool.removeRecursive(txParent);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
 template<typename name>
 void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
 {
@@ -7,6 +7,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "key.h"
 #include "validation.h"
 #include "miner.h"
 #include "policy/policy.h"
@@ -19,6 +20,7 @@
 
 #include "test/test_sigecoin.h"
 
+#include <limits>
 #include <memory>
 
 #include <boost/test/unit_test.hpp>
@@ -493,4 +495,164 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_FIXTURE_TEST_CASE(BlockTemplateCache_incremental, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    BlockTemplateCache cache;
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    BOOST_CHECK(pblocktemplate = cache.Get(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+
+    // Parent spending a mature coinbase, then a child of it
+    CMutableTransaction txns[2];
+    for (int i = 0; i < 2; i++) {
+        txns[i].nVersion = 1;
+        txns[i].vin.resize(1);
+        txns[i].vin[0].prevout.hash = i == 0 ? coinbaseTxns[0].GetHash() : txns[0].GetHash();
+        txns[i].vin[0].prevout.n = 0;
+        txns[i].vout.resize(1);
+        txns[i].vout[0].nValue = (11 - i) * CENT;
+        txns[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txns[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txns[i].vin[0].scriptSig << vchSig;
+
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txns[i]), false, NULL, NULL, true, 0));
+
+        // Each arrival is appended to the cached template
+        BOOST_CHECK(pblocktemplate = cache.Get(chainparams, scriptPubKey));
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), i + 2);
+        BOOST_CHECK(pblocktemplate->block.vtx[i + 1]->GetHash() == txns[i].GetHash());
+    }
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees.size(), 3);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -(pblocktemplate->vTxFees[1] + pblocktemplate->vTxFees[2]));
+
+    // Evicting a selected transaction forces a full reselection
+    mempool.removeRecursive(txns[0]);
+    BOOST_CHECK(pblocktemplate = cache.Get(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateCache_near_full, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // A parent with four outputs, each spent by a child paying its own fee
+    const CAmount nChildFees[4] = {10000, 1000, 50000, 500};
+    CMutableTransaction txParent;
+    txParent.nVersion = 1;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    txParent.vin[0].prevout.n = 0;
+    txParent.vout.resize(4);
+    for (int i = 0; i < 4; i++) {
+        txParent.vout[i].nValue = 10 * CENT;
+        txParent.vout[i].scriptPubKey = scriptPubKey;
+    }
+    CMutableTransaction txns[5];
+    for (int i = 0; i < 5; i++) {
+        if (i == 0) {
+            txns[i] = txParent;
+        } else {
+            txns[i].nVersion = 1;
+            txns[i].vin.resize(1);
+            txns[i].vin[0].prevout.hash = txns[0].GetHash();
+            txns[i].vin[0].prevout.n = i - 1;
+            txns[i].vout.resize(1);
+            txns[i].vout[0].nValue = 10 * CENT - nChildFees[i - 1];
+            txns[i].vout[0].scriptPubKey = scriptPubKey;
+        }
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txns[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txns[i].vin[0].scriptSig << vchSig;
+    }
+    const CTransaction txLow(txns[2]), txBest(txns[3]);
+
+    // Room for the parent and two children only, far less than a max-size
+    // transaction
+    int64_t nMaxWeight = 4000 + GetTransactionWeight(CTransaction(txns[0])) + GetTransactionWeight(CTransaction(txns[1])) +
+        std::max(GetTransactionWeight(txLow), GetTransactionWeight(txBest)) + 1;
+    ForceSetArg("-blockmaxweight", std::to_string(nMaxWeight));
+
+    LOCK(cs_main);
+    CValidationState state;
+    for (int i = 0; i < 2; i++)
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txns[i]), false, NULL, NULL, true, 0));
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+
+    // An arrival that fits extends the nearly full template
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txLow), false, NULL, NULL, true, 0));
+    pblocktemplate = BlockAssembler(chainparams).ExtendBlock(*pblocktemplate, std::vector<uint256>(1, txLow.GetHash()), scriptPubKey);
+    BOOST_CHECK(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    BOOST_CHECK(pblocktemplate->block.vtx[3]->GetHash() == txLow.GetHash());
+
+    // One that does not fit but pays less than everything selected is left out
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txns[4]), false, NULL, NULL, true, 0));
+    pblocktemplate = BlockAssembler(chainparams).ExtendBlock(*pblocktemplate, std::vector<uint256>(1, txns[4].GetHash()), scriptPubKey);
+    BOOST_CHECK(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+
+    // One that does not fit but pays more than the worst selected transaction
+    // forces a reselection, which takes it instead
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txBest), false, NULL, NULL, true, 0));
+    BOOST_CHECK(!BlockAssembler(chainparams).ExtendBlock(*pblocktemplate, std::vector<uint256>(1, txBest.GetHash()), scriptPubKey));
+    pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    bool fBest = false, fLow = false;
+    for (const auto& tx : pblocktemplate->block.vtx) {
+        fBest |= tx->GetHash() == txBest.GetHash();
+        fLow |= tx->GetHash() == txLow.GetHash();
+    }
+    BOOST_CHECK(fBest);
+    BOOST_CHECK(!fLow);
+
+    ForceSetArg("-blockmaxweight", std::to_string(DEFAULT_BLOCK_MAX_WEIGHT));
+    ForceSetArg("-blockmaxsize", std::to_string(DEFAULT_BLOCK_MAX_SIZE));
+}
+
+BOOST_FIXTURE_TEST_CASE(GenerateBlockProof_threads, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey);
+    CBlock& block = pblocktemplate->block;
+    const CBlockIndex* pindexPrev = chainActive.Tip();
+    const CScript scriptSigTemplate = block.vtx[0]->vin[0].scriptSig;
+
+    // The midstate hasher agrees with a full header hash
+    CBlockHeaderHasher hasher(block);
+    for (uint32_t nNonce = 0; nNonce < 4; nNonce++) {
+        block.nNonce = nNonce;
+        BOOST_CHECK(hasher.GetHash(nNonce) == block.GetHash());
+    }
+    block.nNonce = 0xffffffff;
+    BOOST_CHECK(hasher.GetHash(block.nNonce) == block.GetHash());
+
+    // Roughly one header in 65536 meets this target
+    block.nBits = 0x1f00ffff;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(block.nBits);
+
+    uint64_t nMaxTries = 100;
+    CBlock blockTried(block);
+    BOOST_CHECK(!GenerateBlockProof(blockTried, pindexPrev, 4, nMaxTries) || UintToArith256(blockTried.GetHash()) <= bnTarget);
+
+    nMaxTries = std::numeric_limits<uint64_t>::max();
+    BOOST_CHECK(GenerateBlockProof(block, pindexPrev, 4, nMaxTries));
+    BOOST_CHECK(UintToArith256(block.GetHash()) <= bnTarget);
+    BOOST_CHECK(block.hashMerkleRoot == BlockMerkleRoot(block));
+    BOOST_CHECK(block.vtx[0]->vin[0].scriptSig != scriptSigTemplate);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
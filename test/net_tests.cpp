@@ -12,6 +12,8 @@
 #include "net.h"
 #include "netbase.h"
 #include "chainparams.h"
+#include "netmessagemaker.h"
+#include "crypto/common.h"
 
 class CAddrManSerializationMock : public CAddrMan
 {
@@ -173,4 +175,119 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnode_receive_pooled_buffers)
+{
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode(new CNode(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true));
+
+    std::vector<unsigned char> vchPayload(300000, 0x5a);
+    CSharedNetMsg msg(CNetMsgMaker(INIT_PROTO_VERSION).Make("block", vchPayload));
+    std::vector<unsigned char> vchWire(*msg.header);
+    vchWire.insert(vchWire.end(), msg.payload->begin(), msg.payload->end());
+
+    // Feed the message in uneven pieces, splitting the header too
+    bool fComplete = false;
+    size_t nPos = 0;
+    size_t nChunk = 7;
+    while (nPos < vchWire.size()) {
+        size_t nBytes = std::min(nChunk, vchWire.size() - nPos);
+        BOOST_CHECK(!fComplete);
+        BOOST_CHECK(pnode->ReceiveMsgBytes((const char*)&vchWire[nPos], nBytes, fComplete));
+        nPos += nBytes;
+        nChunk = nChunk * 3 + 1;
+    }
+    BOOST_CHECK(fComplete);
+
+    CNodeStats stats;
+    pnode->copyStats(stats);
+    BOOST_CHECK(stats.nRecvBufferSize >= msg.payload->size());
+    BOOST_CHECK_EQUAL(stats.mapRecvBytesPerMsgCmd["block"], vchWire.size());
+
+    // Oversized messages are rejected as soon as the header is in
+    std::vector<unsigned char> vchHeader(*msg.header);
+    WriteLE32(&vchHeader[CMessageHeader::MESSAGE_SIZE_OFFSET], MAX_PROTOCOL_MESSAGE_LENGTH + 1);
+    BOOST_CHECK(!pnode->ReceiveMsgBytes((const char*)&vchHeader[0], vchHeader.size(), fComplete));
+}
+
+BOOST_AUTO_TEST_CASE(send_queue_priority)
+{
+    CNetMsgMaker msgMaker(INIT_PROTO_VERSION);
+    CSharedNetMsg tx1(msgMaker.Make("tx", std::vector<unsigned char>(1000)));
+    CSharedNetMsg tx2(msgMaker.Make("tx", std::vector<unsigned char>(1000)));
+    CSharedNetMsg cmpct1(msgMaker.Make("cmpctblock", std::vector<unsigned char>(500)));
+    CSharedNetMsg cmpct2(msgMaker.Make("cmpctblock", std::vector<unsigned char>(500)));
+    CSharedNetMsg headers(msgMaker.Make("headers", std::vector<unsigned char>(200)));
+    BOOST_CHECK_EQUAL(tx1.priority, SEND_PRIORITY_NORMAL);
+    BOOST_CHECK_EQUAL(cmpct1.priority, SEND_PRIORITY_BLOCK);
+    BOOST_CHECK_EQUAL(headers.priority, SEND_PRIORITY_HEADERS);
+
+    // Block messages and headers overtake queued transactions
+    CSendQueue queue;
+    queue.Push(tx1.priority, tx1.header, tx1.payload, 0);
+    queue.Push(tx2.priority, tx2.header, tx2.payload, 0);
+    queue.Push(headers.priority, headers.header, headers.payload, 0);
+    queue.Push(cmpct1.priority, cmpct1.header, cmpct1.payload, 0);
+    size_t nCmpctSize = cmpct1.header->size() + cmpct1.payload->size();
+    size_t nHeadersSize = headers.header->size() + headers.payload->size();
+    size_t nTxSize = tx1.header->size() + tx1.payload->size();
+    BOOST_CHECK_EQUAL(queue.size(), nCmpctSize + nHeadersSize + 2 * nTxSize);
+
+    std::vector<CSendQueue::Buffer> vBuffers;
+    queue.GetSendBuffers(vBuffers, 64);
+    BOOST_CHECK_EQUAL(vBuffers.size(), 8);
+    BOOST_CHECK(vBuffers[0].first == cmpct1.header->data());
+    BOOST_CHECK(vBuffers[1].first == cmpct1.payload->data());
+    BOOST_CHECK(vBuffers[2].first == headers.header->data());
+    BOOST_CHECK(vBuffers[4].first == tx1.header->data());
+    BOOST_CHECK(vBuffers[6].first == tx2.header->data());
+
+    // A partly sent message is finished before a new block message goes out
+    queue.Consume(nCmpctSize + nHeadersSize + 10, 500);
+    queue.Push(cmpct2.priority, cmpct2.header, cmpct2.payload, 500);
+    queue.GetSendBuffers(vBuffers, 64);
+    BOOST_CHECK(vBuffers[0].first == tx1.header->data() + 10);
+    BOOST_CHECK_EQUAL(vBuffers[0].second, tx1.header->size() - 10);
+    BOOST_CHECK(vBuffers[1].first == tx1.payload->data());
+    BOOST_CHECK(vBuffers[2].first == cmpct2.header->data());
+    BOOST_CHECK(vBuffers[4].first == tx2.header->data());
+
+    queue.Consume(queue.size(), 1500);
+    BOOST_CHECK(queue.empty());
+    queue.GetSendBuffers(vBuffers, 64);
+    BOOST_CHECK(vBuffers.empty());
+    BOOST_CHECK_EQUAL(queue.GetStats(SEND_PRIORITY_BLOCK).nMessages, 2);
+    BOOST_CHECK_EQUAL(queue.GetStats(SEND_PRIORITY_BLOCK).nWaitTotal, 1500);
+    BOOST_CHECK_EQUAL(queue.GetStats(SEND_PRIORITY_BLOCK).nWaitMax, 1000);
+    BOOST_CHECK_EQUAL(queue.GetStats(SEND_PRIORITY_HEADERS).nMessages, 1);
+    BOOST_CHECK_EQUAL(queue.GetStats(SEND_PRIORITY_NORMAL).nMessages, 2);
+    BOOST_CHECK_EQUAL(queue.GetStats(SEND_PRIORITY_NORMAL).nWaitMax, 1500);
+
+    // Under a steady stream of block messages the other classes still get a share
+    std::vector<CSharedNetMsg> vBlockMsgs, vTxMsgs;
+    for (int i = 0; i < 20; i++) {
+        vBlockMsgs.emplace_back(msgMaker.Make("blocktxn", std::vector<unsigned char>(40000)));
+        vTxMsgs.emplace_back(msgMaker.Make("tx", std::vector<unsigned char>(40000)));
+    }
+    for (int i = 0; i < 20; i++) {
+        queue.Push(vBlockMsgs[i].priority, vBlockMsgs[i].header, vBlockMsgs[i].payload, 0);
+        queue.Push(vTxMsgs[i].priority, vTxMsgs[i].header, vTxMsgs[i].payload, 0);
+    }
+    queue.GetSendBuffers(vBuffers, 32);
+    int nBlockMsgs = 0, nTxMsgs = 0;
+    for (size_t i = 0; i < vBuffers.size(); i += 2) {
+        bool fTx = false;
+        for (const CSharedNetMsg& msg : vTxMsgs)
+            fTx |= vBuffers[i].first == msg.header->data();
+        fTx ? nTxMsgs++ : nBlockMsgs++;
+    }
+    BOOST_CHECK(vBuffers[0].first == vBlockMsgs[0].header->data());
+    BOOST_CHECK(nTxMsgs >= 2);
+    BOOST_CHECK(nBlockMsgs >= 3 * nTxMsgs);
+    queue.Consume(queue.size(), 0);
+    BOOST_CHECK(queue.empty());
+    BOOST_CHECK_EQUAL(queue.GetStats(SEND_PRIORITY_BLOCK).nMessages, 22);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
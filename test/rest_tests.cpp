@@ -0,0 +1,69 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "httprpc.h"
+
+#include "chain.h"
+#include "script/script.h"
+#include "validation.h"
+
+#include "test/test_sigecoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(rest_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(rest_longpollid)
+{
+    const std::string strHash = "0f9188f13cb7b2c71f2a335e3a4fc328bf5beb436012afca590b1a11466e2206";
+    uint256 hashTip;
+    unsigned int nTxUpdated = 0;
+    BOOST_CHECK(ParseRestLongPollId(strHash + "42", hashTip, nTxUpdated));
+    BOOST_CHECK_EQUAL(hashTip.GetHex(), strHash);
+    BOOST_CHECK_EQUAL(nTxUpdated, 42);
+    BOOST_CHECK(ParseRestLongPollId(strHash + "4294967295", hashTip, nTxUpdated));
+    BOOST_CHECK_EQUAL(nTxUpdated, 4294967295U);
+
+    // A hash with no count, a short or non hex hash, and a bad count are all refused
+    for (const std::string& strId : std::vector<std::string>{
+             "", strHash, strHash.substr(1), "x" + strHash.substr(1) + "42",
+             strHash + "-1", strHash + "4294967296", strHash + "42x", strHash + " 42"}) {
+        hashTip.SetNull();
+        nTxUpdated = 7;
+        BOOST_CHECK_MESSAGE(!ParseRestLongPollId(strId, hashTip, nTxUpdated), strId);
+        BOOST_CHECK(hashTip.IsNull());
+        BOOST_CHECK_EQUAL(nTxUpdated, 7);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rest_blocktemplate_cache)
+{
+    // Requests never build a template themselves
+    BOOST_CHECK(!GetRestBlockTemplate());
+
+    BOOST_CHECK(UpdateRestBlockTemplate());
+    std::shared_ptr<const std::string> pTemplate = GetRestBlockTemplate();
+    BOOST_REQUIRE(pTemplate);
+    BOOST_CHECK(!pTemplate->empty());
+
+    // Nothing changed, so the same template is served
+    BOOST_CHECK(!UpdateRestBlockTemplate());
+    BOOST_CHECK(GetRestBlockTemplate() == pTemplate);
+
+    // A template on an older tip is not served, and a new one is built
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    BOOST_CHECK(!GetRestBlockTemplate());
+    BOOST_CHECK(UpdateRestBlockTemplate());
+    std::shared_ptr<const std::string> pNewTemplate = GetRestBlockTemplate();
+    BOOST_REQUIRE(pNewTemplate);
+    BOOST_CHECK(pNewTemplate != pTemplate);
+
+    StopREST();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 #include "rpc/client.h"
 
 #include "base58.h"
+#include "chainparams.h"
 #include "netbase.h"
 
 #include "test/test_sigecoin.h"
@@ -16,6 +17,8 @@
 
 #include <include/univalue.h>
 
+#include <thread>
+
 UniValue CallRPC(std::string args)
 {
     std::vector<std::string> vArgs;
@@ -343,4 +346,77 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+static UniValue BatchRequest(const std::string& strMethod, const UniValue& params, int id)
+{
+    UniValue req(UniValue::VOBJ);
+    req.push_back(Pair("method", strMethod));
+    req.push_back(Pair("params", params));
+    req.push_back(Pair("id", id));
+    return req;
+}
+
+static UniValue sleepms(const JSONRPCRequest& request)
+{
+    MilliSleep(request.params[0].get_int());
+    return NullUniValue;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    SetRPCWarmupFinished();
+
+    // A dispatcher running each task on a thread of its own
+    std::vector<std::thread> vThreads;
+    RPCTaskDispatcher dispatch = [&vThreads](const std::function<void(void)>& func) {
+        vThreads.emplace_back(func);
+        return true;
+    };
+
+    // Read-only calls are spread over the helpers, replies stay in order
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 50; i++)
+        vReq.push_back(BatchRequest(i % 2 ? "getblockcount" : "getbestblockhash", UniValue(UniValue::VARR), i));
+    UniValue ret;
+    BOOST_CHECK(ret.read(JSONRPCExecBatch(vReq, dispatch, 4)));
+    for (std::thread& thread : vThreads)
+        thread.join();
+    BOOST_CHECK_EQUAL(vThreads.size(), 4);
+    BOOST_CHECK_EQUAL(ret.size(), 50);
+    for (int i = 0; i < (int)ret.size(); i++) {
+        BOOST_CHECK_EQUAL(find_value(ret[i], "id").get_int(), i);
+        BOOST_CHECK(find_value(ret[i], "error").isNull());
+        if (i % 2)
+            BOOST_CHECK_EQUAL(find_value(ret[i], "result").get_int(), 0);
+        else
+            BOOST_CHECK_EQUAL(find_value(ret[i], "result").get_str(), Params().GenesisBlock().GetHash().GetHex());
+    }
+
+    // Anything else runs in order on the calling thread
+    vThreads.clear();
+    UniValue params(UniValue::VARR);
+    params.push_back("hello");
+    vReq.push_back(BatchRequest("echo", params, 50));
+    vReq.push_back(BatchRequest("nosuchmethod", UniValue(UniValue::VARR), 51));
+    BOOST_CHECK(ret.read(JSONRPCExecBatch(vReq, dispatch, 4)));
+    BOOST_CHECK(vThreads.empty());
+    BOOST_CHECK_EQUAL(ret.size(), 52);
+    BOOST_CHECK_EQUAL(find_value(ret[50], "result")[0].get_str(), "hello");
+    BOOST_CHECK_EQUAL(find_value(find_value(ret[51], "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+
+    // Requests not started before the deadline fail, the others still run
+    static const CRPCCommand sleepCommand = { "hidden", "sleepms", &sleepms, true, {"milliseconds"} };
+    BOOST_CHECK(tableRPC.appendCommand("sleepms", &sleepCommand));
+    vReq = UniValue(UniValue::VARR);
+    params = UniValue(UniValue::VARR);
+    params.push_back(200);
+    vReq.push_back(BatchRequest("sleepms", params, 0));
+    vReq.push_back(BatchRequest("getblockcount", UniValue(UniValue::VARR), 1));
+    BOOST_CHECK(ret.read(JSONRPCExecBatch(vReq, dispatch, 4, 100)));
+    BOOST_CHECK(find_value(ret[0], "error").isNull());
+    BOOST_CHECK_EQUAL(find_value(ret[1], "id").get_int(), 1);
+    BOOST_CHECK_EQUAL(find_value(find_value(ret[1], "error"), "message").get_str(), "Batch deadline exceeded");
+    BOOST_CHECK(tableRPC.removeCommand("sleepms", &sleepCommand));
+    BOOST_CHECK(!tableRPC.removeCommand("sleepms", &sleepCommand));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
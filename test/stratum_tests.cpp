@@ -0,0 +1,87 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "hash.h"
+#include "key.h"
+#include "miner.h"
+#include "pow.h"
+#include "stratum.h"
+#include "validation.h"
+
+#include "test/test_sigecoin.h"
+
+#include <memory>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stratum_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(stratum_job_roundtrip)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    StratumJob job;
+    int nHeight;
+    {
+        LOCK(cs_main);
+        job.block = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey)->block;
+        nHeight = chainActive.Height() + 1;
+        job.nMinTime = chainActive.Tip()->GetMedianTimePast() + 1;
+    }
+    BOOST_CHECK(BuildStratumJob(job, nHeight));
+    BOOST_CHECK(job.vMerkleBranch.empty());
+
+    // The miner's coinbase is coinb1 + extranonce + coinb2
+    std::vector<unsigned char> vchExtraNonce;
+    for (unsigned int i = 0; i < STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE; i++)
+        vchExtraNonce.push_back(i + 1);
+    std::vector<unsigned char> vchCoinbase(job.vchCoinbase1);
+    vchCoinbase.insert(vchCoinbase.end(), vchExtraNonce.begin(), vchExtraNonce.end());
+    vchCoinbase.insert(vchCoinbase.end(), job.vchCoinbase2.begin(), job.vchCoinbase2.end());
+
+    CBlock block;
+    BOOST_CHECK(AssembleStratumBlock(job, vchExtraNonce, job.block.nTime, 0, block));
+    BOOST_CHECK(block.vtx[0]->GetHash() == Hash(vchCoinbase.begin(), vchCoinbase.end()));
+    BOOST_CHECK(block.hashMerkleRoot == BlockMerkleRoot(block));
+    const CScript& scriptSig = block.vtx[0]->vin[0].scriptSig;
+    BOOST_CHECK(std::equal(vchExtraNonce.begin(), vchExtraNonce.end(), scriptSig.end() - vchExtraNonce.size()));
+
+    // Truncated or oversized extranonces are rejected
+    vchExtraNonce.pop_back();
+    BOOST_CHECK(!AssembleStratumBlock(job, vchExtraNonce, job.block.nTime, 0, block));
+    vchExtraNonce.push_back(0);
+    vchExtraNonce.push_back(0);
+    BOOST_CHECK(!AssembleStratumBlock(job, vchExtraNonce, job.block.nTime, 0, block));
+    vchExtraNonce.pop_back();
+
+    // The reassembled block extends the chain
+    BOOST_CHECK(AssembleStratumBlock(job, vchExtraNonce, job.block.nTime, 0, block));
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+    BOOST_CHECK(ProcessNewBlock(chainparams, std::make_shared<const CBlock>(block), true, NULL));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(stratum_share_target)
+{
+    arith_uint256 bnDiff1;
+    bnDiff1.SetCompact(0x1d00ffff);
+    BOOST_CHECK(StratumShareTarget(1) == bnDiff1);
+    BOOST_CHECK(StratumShareTarget(2) == bnDiff1 / 2);
+    BOOST_CHECK(StratumShareTarget(0.5) == bnDiff1 * 2);
+
+    // Fractional difficulties are not truncated
+    BOOST_CHECK(StratumShareTarget(1.5) == bnDiff1 * 2 / 3);
+    BOOST_CHECK(StratumShareTarget(1000.25) == (bnDiff1 << 2) / 4001);
+
+    // Past 2^32 the fixed point scale shrinks so the divisor fits 64 bits
+    BOOST_CHECK(StratumShareTarget(1099511627776.0) == bnDiff1 >> 40);
+
+    // Tiny difficulties are floored short of overflowing the target
+    BOOST_CHECK(StratumShareTarget(1e-9) == bnDiff1 * 65536);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
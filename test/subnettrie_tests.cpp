@@ -0,0 +1,120 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netbase.h"
+#include "random.h"
+#include "subnettrie.h"
+
+#include "test/test_sigecoin.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static CSubNet ResolveSubNet(const std::string& str)
+{
+    CSubNet subnet;
+    LookupSubNet(str.c_str(), subnet);
+    return subnet;
+}
+
+static CNetAddr ResolveIP(const std::string& str)
+{
+    CNetAddr addr;
+    LookupHost(str.c_str(), addr, false);
+    return addr;
+}
+
+BOOST_FIXTURE_TEST_SUITE(subnettrie_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(subnettrie_prefix_length)
+{
+    BOOST_CHECK_EQUAL(ResolveSubNet("1.2.3.4/32").GetPrefixLength(), 128);
+    BOOST_CHECK_EQUAL(ResolveSubNet("1.2.3.0/24").GetPrefixLength(), 120);
+    BOOST_CHECK_EQUAL(ResolveSubNet("0.0.0.0/0").GetPrefixLength(), 96);
+    BOOST_CHECK_EQUAL(ResolveSubNet("1:2::/32").GetPrefixLength(), 32);
+    BOOST_CHECK_EQUAL(ResolveSubNet("1.2.3.4/255.0.255.0").GetPrefixLength(), -1);
+}
+
+BOOST_AUTO_TEST_CASE(subnettrie_match)
+{
+    CSubNetTrie<int> trie;
+    BOOST_CHECK(trie.Insert(ResolveSubNet("10.0.0.0/8"), 1));
+    BOOST_CHECK(trie.Insert(ResolveSubNet("10.1.0.0/16"), 2));
+    BOOST_CHECK(trie.Insert(ResolveSubNet("192.168.1.7"), 3));
+    BOOST_CHECK(trie.Insert(ResolveSubNet("2a01:4f8::/32"), 4));
+    BOOST_CHECK(trie.Insert(ResolveSubNet("1.0.3.0/255.0.255.0"), 5));
+    BOOST_CHECK(!trie.Insert(ResolveSubNet("10.1.0.0/16"), 6));
+    BOOST_CHECK_EQUAL(trie.size(), 5);
+    BOOST_CHECK_EQUAL(*trie.Find(ResolveSubNet("10.1.0.0/16")), 6);
+    BOOST_CHECK(trie.Find(ResolveSubNet("10.2.0.0/16")) == NULL);
+
+    BOOST_CHECK(trie.Match(ResolveIP("10.200.3.4")));
+    BOOST_CHECK(trie.Match(ResolveIP("192.168.1.7")));
+    BOOST_CHECK(!trie.Match(ResolveIP("192.168.1.8")));
+    BOOST_CHECK(trie.Match(ResolveIP("2a01:4f8::1")));
+    BOOST_CHECK(!trie.Match(ResolveIP("2a01:4f9::1")));
+    BOOST_CHECK(trie.Match(ResolveIP("1.99.3.99")));
+    BOOST_CHECK(!trie.Match(ResolveIP("1.99.4.99")));
+    BOOST_CHECK(!trie.Match(ResolveIP("11.0.0.1")));
+
+    // The predicate sees every containing subnet's value
+    CNetAddr addr = ResolveIP("10.1.2.3");
+    BOOST_CHECK(trie.MatchAny(addr, [](int n) { return n == 1; }));
+    BOOST_CHECK(trie.MatchAny(addr, [](int n) { return n == 6; }));
+    BOOST_CHECK(!trie.MatchAny(addr, [](int n) { return n == 3; }));
+
+    // Removing the inner subnet leaves the outer one matching
+    BOOST_CHECK(trie.Erase(ResolveSubNet("10.1.0.0/16")));
+    BOOST_CHECK(!trie.Erase(ResolveSubNet("10.1.0.0/16")));
+    BOOST_CHECK(!trie.MatchAny(addr, [](int n) { return n == 6; }));
+    BOOST_CHECK(trie.Match(addr));
+    BOOST_CHECK(trie.Erase(ResolveSubNet("10.0.0.0/8")));
+    BOOST_CHECK(!trie.Match(addr));
+    BOOST_CHECK(trie.Erase(ResolveSubNet("1.0.3.0/255.0.255.0")));
+    BOOST_CHECK(!trie.Match(ResolveIP("1.99.3.99")));
+    BOOST_CHECK_EQUAL(trie.size(), 2);
+
+    trie.clear();
+    BOOST_CHECK(trie.empty());
+    BOOST_CHECK(!trie.Match(ResolveIP("192.168.1.7")));
+}
+
+BOOST_AUTO_TEST_CASE(subnettrie_random)
+{
+    // Compare against a linear scan over random nested IPv4 subnets
+    FastRandomContext insecure_rand(true);
+    CSubNetTrie<int> trie;
+    std::vector<CSubNet> vSubNets;
+    for (int i = 0; i < 400; i++) {
+        uint32_t ip = insecure_rand.rand32() & 0x0F0F00FF;
+        std::string str = strprintf("%u.%u.%u.%u/%u", ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF, 4 + insecure_rand.rand32() % 29);
+        CSubNet subnet = ResolveSubNet(str);
+        BOOST_CHECK(subnet.IsValid());
+        bool fNew = std::find(vSubNets.begin(), vSubNets.end(), subnet) == vSubNets.end();
+        BOOST_CHECK_EQUAL(trie.Insert(subnet, i), fNew);
+        if (fNew)
+            vSubNets.push_back(subnet);
+        // Drop every third subnet again to exercise node merging
+        if (i % 3 == 0) {
+            size_t n = insecure_rand.rand32() % vSubNets.size();
+            BOOST_CHECK(trie.Erase(vSubNets[n]));
+            vSubNets.erase(vSubNets.begin() + n);
+        }
+    }
+    BOOST_CHECK_EQUAL(trie.size(), vSubNets.size());
+
+    for (int i = 0; i < 2000; i++) {
+        uint32_t ip = insecure_rand.rand32() & 0x0F0F00FF;
+        CNetAddr addr = ResolveIP(strprintf("%u.%u.%u.%u", ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF));
+        bool fExpected = false;
+        for (const CSubNet& subnet : vSubNets)
+            fExpected |= subnet.Match(addr);
+        BOOST_CHECK_EQUAL(trie.Match(addr), fExpected);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -278,6 +278,28 @@ BOOST_AUTO_TEST_CASE(basic_transaction_tests)
     BOOST_CHECK_MESSAGE(!CheckTransaction(tx, state) || !state.IsValid(), "Transaction with duplicate txins should be invalid.");
 }
 
+BOOST_AUTO_TEST_CASE(duplicate_inputs_large)
+{
+    // Enough inputs to use the hashed duplicate detector
+    CMutableTransaction tx;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    for (int i = 0; i < 200; i++) {
+        // Pairs of inputs share a txid, and many share an output index
+        tx.vin.push_back(CTxIn(COutPoint(uint256(i / 2 + 1), i % 2)));
+    }
+    CValidationState state;
+    BOOST_CHECK(CheckTransaction(tx, state) && state.IsValid());
+
+    tx.vin.push_back(tx.vin[137]);
+    BOOST_CHECK(!CheckTransaction(tx, state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-inputs-duplicate");
+
+    // Without the duplicate check the transaction passes
+    CValidationState state2;
+    BOOST_CHECK(CheckTransaction(tx, state2, false));
+}
+
 //
 // Helper: create two dummy transactions, each with
 // two outputs.  The first has 11 and 50 CENT outputs
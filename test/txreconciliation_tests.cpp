@@ -0,0 +1,225 @@
+// Copyright (c) 2017 SIGE developer
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pinsketch.h"
+#include "random.h"
+#include "txreconciliation.h"
+#include "uint256.h"
+
+#include "test/test_sigecoin.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pinsketch_decode)
+{
+    FastRandomContext insecure_rand(true);
+    for (size_t nCapacity = 1; nCapacity <= 24; nCapacity++) {
+        for (size_t nElements = 0; nElements <= nCapacity + 2; nElements++) {
+            std::set<uint32_t> setElements;
+            while (setElements.size() < nElements) {
+                uint32_t n = insecure_rand.rand32();
+                if (n != 0)
+                    setElements.insert(n);
+            }
+            CPinSketch sketch(nCapacity);
+            for (uint32_t n : setElements)
+                sketch.Add(n);
+
+            std::vector<uint32_t> vDecoded;
+            bool fDecoded = sketch.Decode(vDecoded);
+            if (nElements <= nCapacity) {
+                BOOST_CHECK(fDecoded);
+                BOOST_CHECK(std::set<uint32_t>(vDecoded.begin(), vDecoded.end()) == setElements);
+            } else {
+                // An overfull sketch may only decode to some other set with the same syndromes
+                if (fDecoded)
+                    BOOST_CHECK(std::set<uint32_t>(vDecoded.begin(), vDecoded.end()) != setElements);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pinsketch_merge)
+{
+    CPinSketch a(4), b(4);
+    a.Add(1); a.Add(2); a.Add(3);
+    b.Add(2); b.Add(3); b.Add(0xFFFFFFFF);
+    a.Merge(b);
+
+    std::vector<uint32_t> vDiff;
+    BOOST_CHECK(a.Decode(vDiff));
+    std::sort(vDiff.begin(), vDiff.end());
+    BOOST_CHECK_EQUAL(vDiff.size(), 2);
+    BOOST_CHECK_EQUAL(vDiff[0], 1);
+    BOOST_CHECK_EQUAL(vDiff[1], 0xFFFFFFFF);
+
+    // Adding an element twice cancels it
+    CPinSketch c(4);
+    c.Add(7);
+    c.Add(7);
+    BOOST_CHECK(c.Decode(vDiff));
+    BOOST_CHECK(vDiff.empty());
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_round)
+{
+    CTxReconciliationState initiator(true, 11, 22);
+    CTxReconciliationState responder(false, 22, 11);
+    BOOST_CHECK(initiator.ComputeShortID(uint256S("01")) == responder.ComputeShortID(uint256S("01")));
+
+    // Shared transactions plus a few only one side has
+    std::vector<uint256> vOnlyInitiator, vOnlyResponder;
+    for (int i = 0; i < 50; i++) {
+        uint256 hash = GetRandHash();
+        initiator.AddToSet(hash);
+        responder.AddToSet(hash);
+    }
+    for (int i = 0; i < 3; i++) {
+        vOnlyInitiator.push_back(GetRandHash());
+        initiator.AddToSet(vOnlyInitiator.back());
+    }
+    for (int i = 0; i < 4; i++) {
+        vOnlyResponder.push_back(GetRandHash());
+        responder.AddToSet(vOnlyResponder.back());
+    }
+
+    BOOST_CHECK(initiator.ShouldRequest(100));
+    uint16_t nSetSize = initiator.StartRound(100);
+    BOOST_CHECK_EQUAL(nSetSize, 53);
+    BOOST_CHECK(!initiator.ShouldRequest(100));
+
+    std::vector<uint256> vAnnounce;
+    std::vector<uint32_t> vSketch = responder.RespondToRequest(100, nSetSize, DEFAULT_RECON_Q, vAnnounce);
+    BOOST_CHECK(vAnnounce.empty());
+    BOOST_CHECK(!vSketch.empty());
+    BOOST_CHECK_EQUAL(responder.GetSetSize(), 0);
+
+    // Transactions arriving mid-round go to the next round
+    initiator.AddToSet(GetRandHash());
+    BOOST_CHECK_EQUAL(initiator.GetSetSize(), 1);
+
+    std::vector<uint32_t> vAsk;
+    BOOST_CHECK(initiator.ProcessSketch(vSketch, vAnnounce, vAsk));
+    BOOST_CHECK(!initiator.IsRoundInProgress());
+    std::sort(vAnnounce.begin(), vAnnounce.end());
+    std::sort(vOnlyInitiator.begin(), vOnlyInitiator.end());
+    BOOST_CHECK(vAnnounce == vOnlyInitiator);
+
+    std::vector<uint256> vResponderAnnounce;
+    responder.ProcessDiff(true, vAsk, vResponderAnnounce);
+    BOOST_CHECK(!responder.IsRoundInProgress());
+    std::sort(vResponderAnnounce.begin(), vResponderAnnounce.end());
+    std::sort(vOnlyResponder.begin(), vOnlyResponder.end());
+    BOOST_CHECK(vResponderAnnounce == vOnlyResponder);
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_fallback)
+{
+    CTxReconciliationState initiator(true, 1, 2);
+    CTxReconciliationState responder(false, 2, 1);
+    for (int i = 0; i < 20; i++)
+        initiator.AddToSet(GetRandHash());
+    for (int i = 0; i < 20; i++)
+        responder.AddToSet(GetRandHash());
+
+    // A difference far beyond what q predicts overflows the sketch
+    std::vector<uint256> vAnnounce;
+    uint16_t nSetSize = initiator.StartRound(0);
+    std::vector<uint32_t> vSketch = responder.RespondToRequest(0, nSetSize, 0, vAnnounce);
+    BOOST_CHECK_EQUAL(vSketch.size(), MIN_SKETCH_CAPACITY);
+    std::vector<uint32_t> vAsk;
+    BOOST_CHECK(!initiator.ProcessSketch(vSketch, vAnnounce, vAsk));
+    BOOST_CHECK_EQUAL(vAnnounce.size(), 20);
+    BOOST_CHECK(vAsk.empty());
+
+    // The responder times out and floods its set as well
+    vAnnounce.clear();
+    responder.CheckTimeout(RECON_ROUND_TIMEOUT, vAnnounce);
+    BOOST_CHECK(vAnnounce.empty());
+    responder.CheckTimeout(RECON_ROUND_TIMEOUT + 1, vAnnounce);
+    BOOST_CHECK_EQUAL(vAnnounce.size(), 20);
+    BOOST_CHECK(!responder.IsRoundInProgress());
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_capacity)
+{
+    BOOST_CHECK_EQUAL(EstimateSketchCapacity(0, 0, DEFAULT_RECON_Q), MIN_SKETCH_CAPACITY);
+    BOOST_CHECK_EQUAL(EstimateSketchCapacity(100, 40, 0), 61);
+    BOOST_CHECK_EQUAL(EstimateSketchCapacity(40, 100, RECON_Q_PRECISION), 101);
+
+    // Fixed txids, known not to collide under this key
+    CTxReconciliationState state(true, 0, 0);
+    for (uint32_t i = 0; i < MAX_RECON_SET_SIZE; i++)
+        BOOST_CHECK(state.AddToSet(ArithToUint256(arith_uint256(i))));
+    BOOST_CHECK_EQUAL(state.GetSetSize(), MAX_RECON_SET_SIZE);
+    BOOST_CHECK(!state.AddToSet(ArithToUint256(arith_uint256(MAX_RECON_SET_SIZE))));
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_collision)
+{
+    // Find two txids with the same short ID
+    CTxReconciliationState state(true, 0, 0);
+    std::map<uint32_t, uint256> mapSeen;
+    uint256 hashFirst, hashSecond;
+    for (uint32_t i = 0; i < 1000000 && hashSecond.IsNull(); i++) {
+        uint256 hash = ArithToUint256(arith_uint256(i + 1));
+        std::pair<std::map<uint32_t, uint256>::iterator, bool> ret = mapSeen.insert(std::make_pair(state.ComputeShortID(hash), hash));
+        if (!ret.second) {
+            hashFirst = ret.first->second;
+            hashSecond = hash;
+        }
+    }
+    BOOST_REQUIRE(!hashSecond.IsNull());
+
+    // The first one stays queued, the second is to be flooded
+    BOOST_CHECK(state.AddToSet(hashFirst));
+    BOOST_CHECK(!state.AddToSet(hashSecond));
+    BOOST_CHECK(state.AddToSet(hashFirst));
+    BOOST_CHECK_EQUAL(state.GetSetSize(), 1);
+    state.RemoveFromSet(hashSecond);
+    BOOST_CHECK_EQUAL(state.GetSetSize(), 1);
+
+    std::vector<uint256> vAnnounce;
+    std::vector<uint32_t> vAsk;
+    state.StartRound(0);
+    BOOST_CHECK(!state.ProcessSketch(std::vector<uint32_t>(), vAnnounce, vAsk));
+    BOOST_CHECK(vAnnounce == std::vector<uint256>{hashFirst});
+}
+
+BOOST_AUTO_TEST_CASE(reconciliation_responder_expiry)
+{
+    CTxReconciliationState responder(false, 2, 1);
+    std::vector<uint256> vAnnounce;
+    responder.CheckTimeout(0, vAnnounce);
+    for (int i = 0; i < 5; i++)
+        responder.AddToSet(GetRandHash());
+
+    // A peer that never asks gets the set announced once it is old enough
+    responder.CheckTimeout(10, vAnnounce);
+    responder.CheckTimeout(10 + RECON_ROUND_TIMEOUT, vAnnounce);
+    BOOST_CHECK(vAnnounce.empty());
+    BOOST_CHECK_EQUAL(responder.GetSetSize(), 5);
+    responder.CheckTimeout(11 + RECON_ROUND_TIMEOUT, vAnnounce);
+    BOOST_CHECK_EQUAL(vAnnounce.size(), 5);
+    BOOST_CHECK_EQUAL(responder.GetSetSize(), 0);
+
+    // A request restarts the clock
+    vAnnounce.clear();
+    responder.AddToSet(GetRandHash());
+    responder.CheckTimeout(100, vAnnounce);
+    responder.RespondToRequest(100 + RECON_ROUND_TIMEOUT, 1, DEFAULT_RECON_Q, vAnnounce);
+    responder.AddToSet(GetRandHash());
+    responder.CheckTimeout(101 + RECON_ROUND_TIMEOUT, vAnnounce);
+    BOOST_CHECK(vAnnounce.empty());
+    BOOST_CHECK_EQUAL(responder.GetSetSize(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
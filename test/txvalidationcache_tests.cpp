@@ -84,4 +84,245 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_parallel_scriptchecks, TestChain100Setup)
+{
+    // Transactions with enough inputs have their script checks spread over
+    // the script-checking threads when entering the mempool; the outcome and
+    // reject reason must match the serial path.
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const unsigned int nInputs = MEMPOOL_PARALLEL_SCRIPTCHECK_MIN_INPUTS * 2;
+
+    // Fan a mature coinbase out into enough outputs and confirm it:
+    CMutableTransaction fanout;
+    fanout.nVersion = 1;
+    fanout.vin.resize(1);
+    fanout.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    fanout.vin[0].prevout.n = 0;
+    fanout.vout.resize(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        fanout.vout[i].nValue = 11*CENT;
+        fanout.vout[i].scriptPubKey = scriptPubKey;
+    }
+    {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, fanout, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        fanout.vin[0].scriptSig << vchSig;
+    }
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, fanout), scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    // Sweep all of them in one transaction:
+    CMutableTransaction sweep;
+    sweep.nVersion = 1;
+    sweep.vin.resize(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++) {
+        sweep.vin[i].prevout.hash = fanout.GetHash();
+        sweep.vin[i].prevout.n = i;
+    }
+    sweep.vout.resize(1);
+    sweep.vout[0].nValue = nInputs * 10*CENT;
+    sweep.vout[0].scriptPubKey = scriptPubKey;
+    for (unsigned int i = 0; i < nInputs; i++) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, sweep, i, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        sweep.vin[i].scriptSig = CScript() << vchSig;
+    }
+
+    // A single bad signature among many is still caught, with the same
+    // reason the serial path reports:
+    BOOST_REQUIRE(nScriptCheckThreads > 0);
+    uint64_t nParallelBefore = nMempoolParallelScriptChecks;
+    CMutableTransaction badSweep(sweep);
+    badSweep.vin[nInputs - 1].scriptSig = sweep.vin[0].scriptSig;
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, MakeTransactionRef(badSweep), false, NULL, NULL, true, 0));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "mandatory-script-verify-flag-failed (Signature must be zero for failed CHECK(MULTI)SIG operation)");
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    BOOST_CHECK_EQUAL(nMempoolParallelScriptChecks.load(), nParallelBefore + 1);
+
+    BOOST_CHECK(ToMemPool(sweep));
+    BOOST_CHECK(mempool.exists(sweep.GetHash()));
+    // Once against the standard flags and once against the consensus flags
+    BOOST_CHECK_EQUAL(nMempoolParallelScriptChecks.load(), nParallelBefore + 3);
+    mempool.clear();
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_batch_accept, TestChain100Setup)
+{
+    // A batch is accepted regardless of the order its members are given in,
+    // and each member gets its own outcome.
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // parent spends a mature coinbase, child spends parent, and invalid has no inputs
+    std::vector<CMutableTransaction> txns(3);
+    for (int i = 0; i < 2; i++) {
+        txns[i].nVersion = 1;
+        txns[i].vin.resize(1);
+        txns[i].vin[0].prevout.hash = i == 0 ? coinbaseTxns[0].GetHash() : txns[0].GetHash();
+        txns[i].vin[0].prevout.n = 0;
+        txns[i].vout.resize(1);
+        txns[i].vout[0].nValue = (11 - i) * CENT;
+        txns[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, txns[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        txns[i].vin[0].scriptSig << vchSig;
+    }
+    txns[2].nVersion = 1;
+    txns[2].vout.resize(1);
+    txns[2].vout[0].nValue = CENT;
+    txns[2].vout[0].scriptPubKey = scriptPubKey;
+
+    // Submit child first
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txns[1]));
+    vtx.push_back(MakeTransactionRef(txns[2]));
+    vtx.push_back(MakeTransactionRef(txns[0]));
+
+    std::vector<CValidationState> vState;
+    std::vector<bool> vMissingInputs;
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false), 2);
+    BOOST_CHECK_EQUAL(vState.size(), 3);
+    BOOST_CHECK(vState[0].IsValid() && !vMissingInputs[0]);
+    BOOST_CHECK(!vState[1].IsValid());
+    BOOST_CHECK_EQUAL(vState[1].GetRejectReason(), "bad-txns-vin-empty");
+    BOOST_CHECK(vState[2].IsValid() && !vMissingInputs[2]);
+    BOOST_CHECK(mempool.exists(txns[0].GetHash()));
+    BOOST_CHECK(mempool.exists(txns[1].GetHash()));
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+
+    // Resubmitting reports the members as already known
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false), 0);
+    BOOST_CHECK_EQUAL(vState[0].GetRejectReason(), "txn-already-in-mempool");
+    mempool.clear();
+
+    // Without its parent, the child is only missing inputs
+    vtx.pop_back();
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false), 0);
+    BOOST_CHECK(vState[0].IsValid());
+    BOOST_CHECK(vMissingInputs[0]);
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    // The members of a source that sent an invalid one are left untried
+    vtx.push_back(MakeTransactionRef(txns[0]));
+    std::vector<int64_t> vSource;
+    vSource.push_back(2);
+    vSource.push_back(1);
+    vSource.push_back(1);
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false, NULL, 0, &vSource), 0);
+    BOOST_CHECK_EQUAL(vState[1].GetRejectReason(), "bad-txns-vin-empty");
+    BOOST_CHECK(vState[2].IsValid() && vMissingInputs[2]);
+    BOOST_CHECK(vState[0].IsValid() && vMissingInputs[0]);
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    // A package over the chain limits is rejected whole, before its parent
+    // could be accepted on its own
+    ForceSetArg("-limitancestorcount", "1");
+    vtx.erase(vtx.begin() + 1);
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false), 0);
+    BOOST_CHECK_EQUAL(vState[0].GetRejectReason(), "too-long-mempool-chain");
+    BOOST_CHECK_EQUAL(vState[1].GetRejectReason(), "too-long-mempool-chain");
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    ForceSetArg("-limitancestorcount", std::to_string(DEFAULT_ANCESTOR_LIMIT));
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false), 2);
+    mempool.clear();
+}
+
+/** Sign every input of tx, each spending an output paying to scriptPubKey */
+static void SignInputs(CMutableTransaction& tx, const CScript& scriptPubKey, const CKey& key)
+{
+    for (unsigned int n = 0; n < tx.vin.size(); n++) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, tx, n, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        tx.vin[n].scriptSig = CScript() << vchSig;
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_batch_wide_package, TestChain100Setup)
+{
+    // A package with more members than the chain limits allow for any one
+    // transaction is fine as long as no member goes over them: two parents
+    // with 12 children each, and one transaction spending a child of each.
+
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const int nChildren = 12;
+
+    // One more block, so the second coinbase is mature as well
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+
+    std::vector<CMutableTransaction> vParents(2);
+    std::vector<CMutableTransaction> vChildren;
+    for (int i = 0; i < 2; i++) {
+        vParents[i].nVersion = 1;
+        vParents[i].vin.resize(1);
+        vParents[i].vin[0].prevout.hash = coinbaseTxns[i].GetHash();
+        vParents[i].vin[0].prevout.n = 0;
+        vParents[i].vout.resize(nChildren);
+        for (int j = 0; j < nChildren; j++) {
+            vParents[i].vout[j].nValue = CENT;
+            vParents[i].vout[j].scriptPubKey = scriptPubKey;
+        }
+        SignInputs(vParents[i], scriptPubKey, coinbaseKey);
+
+        for (int j = 0; j < nChildren; j++) {
+            CMutableTransaction child;
+            child.nVersion = 1;
+            child.vin.resize(1);
+            child.vin[0].prevout.hash = vParents[i].GetHash();
+            child.vin[0].prevout.n = j;
+            child.vout.resize(1);
+            child.vout[0].nValue = CENT - 10000;
+            child.vout[0].scriptPubKey = scriptPubKey;
+            SignInputs(child, scriptPubKey, coinbaseKey);
+            vChildren.push_back(child);
+        }
+    }
+    CMutableTransaction joint;
+    joint.nVersion = 1;
+    joint.vin.resize(2);
+    for (int i = 0; i < 2; i++) {
+        joint.vin[i].prevout.hash = vChildren[i * nChildren].GetHash();
+        joint.vin[i].prevout.n = 0;
+    }
+    joint.vout.resize(1);
+    joint.vout[0].nValue = 2 * CENT - 30000;
+    joint.vout[0].scriptPubKey = scriptPubKey;
+    SignInputs(joint, scriptPubKey, coinbaseKey);
+
+    // Children before parents, so the batch has to order them itself
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(joint));
+    BOOST_FOREACH(const CMutableTransaction& tx, vChildren)
+        vtx.push_back(MakeTransactionRef(tx));
+    BOOST_FOREACH(const CMutableTransaction& tx, vParents)
+        vtx.push_back(MakeTransactionRef(tx));
+    BOOST_CHECK(vtx.size() > DEFAULT_ANCESTOR_LIMIT && vtx.size() > DEFAULT_DESCENDANT_LIMIT);
+
+    // Each parent ends up with 14 descendants, itself included
+    std::vector<CValidationState> vState;
+    std::vector<bool> vMissingInputs;
+    ForceSetArg("-limitdescendantcount", "13");
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false), 0);
+    BOOST_CHECK_EQUAL(vState[0].GetRejectReason(), "too-long-mempool-chain");
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    ForceSetArg("-limitdescendantcount", "14");
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vState, vMissingInputs, vtx, std::vector<int64_t>(), false), vtx.size());
+    BOOST_CHECK_EQUAL(mempool.size(), vtx.size());
+    ForceSetArg("-limitdescendantcount", std::to_string(DEFAULT_DESCENDANT_LIMIT));
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()